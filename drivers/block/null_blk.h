@@ -32,6 +32,24 @@ struct nullb_queue {
 	struct nullb_cmd *cmds;
 };
 
+/*
+ * Latency distribution, as an inverse cumulative distribution function:
+ * latencies between two points are interpolated linearly.
+ */
+struct nullb_latency {
+	unsigned int nr;	/* number of points */
+	u32 *pct;		/* percentile of each point, in 1/1000 % */
+	u64 *nsec;		/* latency at each point */
+	char *desc;		/* distribution as written to configfs */
+};
+
+/* Recorded latencies, replayed in a loop */
+struct nullb_lat_trace {
+	unsigned int nr;
+	atomic_t pos;
+	u32 *nsec;
+};
+
 struct nullb_device {
 	struct nullb *nullb;
 	struct config_item item;
@@ -50,6 +68,9 @@ struct nullb_device {
 	unsigned long cache_size; /* disk cache size in MB */
 	unsigned long zone_size; /* zone size in MB if device is zoned */
 	unsigned int zone_nr_conv; /* number of conventional zones */
+	/* Completion latencies with irqmode=2, indexed by op_is_write() */
+	struct nullb_latency *latency[2];
+	struct nullb_lat_trace lat_trace[2];
 	unsigned int submit_queues; /* number of submission queues */
 	unsigned int home_node; /* home node for the device */
 	unsigned int queue_mode; /* block interface */
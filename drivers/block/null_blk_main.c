@@ -9,6 +9,7 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/random.h>
 #include "null_blk.h"
 
 #define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
@@ -262,6 +263,205 @@ static ssize_t nullb_device_bool_attr_store(bool *val, const char *page,
 	return count;
 }
 
+#define NULL_LAT_PCT_MAX	100000	/* 100 %, in 1/1000 % */
+#define NULL_LAT_MAX_POINTS	64
+#define NULL_LAT_TRACE_WRITE	(1U << 31)
+#define NULL_LAT_TRACE_MAX_SIZE	(16 << 20)
+
+static struct nullb_latency *null_latency_alloc(unsigned int nr)
+{
+	struct nullb_latency *lat;
+
+	lat = kzalloc(sizeof(*lat) + nr * (sizeof(u64) + sizeof(u32)),
+		      GFP_KERNEL);
+	if (!lat)
+		return NULL;
+	lat->nsec = (u64 *)(lat + 1);
+	lat->pct = (u32 *)(lat->nsec + nr);
+	return lat;
+}
+
+static void null_latency_free(struct nullb_latency *lat)
+{
+	if (!lat)
+		return;
+	kfree(lat->desc);
+	kfree(lat);
+}
+
+static void null_latency_add(struct nullb_latency *lat, u32 pct, u64 nsec)
+{
+	lat->pct[lat->nr] = pct;
+	lat->nsec[lat->nr] = nsec;
+	lat->nr++;
+}
+
+static char *null_latency_token(char **p)
+{
+	char *tok;
+
+	do {
+		tok = strsep(p, " \t\n");
+	} while (tok && !*tok);
+
+	return tok;
+}
+
+/* Parse a percentile with up to three decimals, such as 99.9 */
+static int null_latency_parse_pct(char *str, u32 *pct)
+{
+	char *frac = strchr(str, '.');
+	unsigned int whole, part = 0;
+	int i, ret;
+
+	if (frac) {
+		*frac++ = '\0';
+		if (!*frac || strlen(frac) > 3)
+			return -EINVAL;
+		ret = kstrtouint(frac, 10, &part);
+		if (ret)
+			return ret;
+		for (i = strlen(frac); i < 3; i++)
+			part *= 10;
+	}
+
+	ret = kstrtouint(str, 10, &whole);
+	if (ret)
+		return ret;
+	if (whole > 100 || whole * 1000 + part > NULL_LAT_PCT_MAX)
+		return -EINVAL;
+
+	*pct = whole * 1000 + part;
+	return 0;
+}
+
+/*
+ * Latencies are capped at U32_MAX ns, like the records of a latency trace,
+ * which also keeps the interpolation in null_latency_sample() from
+ * overflowing.
+ */
+static int null_latency_parse_nsec(char *str, u64 *nsec)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(str, 0, &val);
+	if (ret)
+		return ret;
+
+	*nsec = val;
+	return 0;
+}
+
+/*
+ * Parse a latency distribution, with latencies in ns:
+ *
+ *   none				completion_nsec
+ *   uniform MIN MAX			uniform between MIN and MAX
+ *   bimodal FAST SLOW SLOW_PCT		SLOW for SLOW_PCT % of the commands
+ *   table PCT:NSEC ...			percentiles, e.g. 50:80000 99.9:2000000
+ *
+ * Returns NULL for none.
+ */
+static struct nullb_latency *null_latency_parse(const char *page,
+						size_t count)
+{
+	struct nullb_latency *lat = NULL;
+	char *orig, *desc = NULL, *p, *type, *tok, *sep;
+	u64 fast, slow;
+	u32 pct;
+	int ret = -ENOMEM;
+
+	orig = kstrndup(page, count, GFP_KERNEL);
+	if (!orig)
+		return ERR_PTR(-ENOMEM);
+	p = strstrip(orig);
+
+	/* Keep the distribution as written, for show */
+	desc = kstrdup(p, GFP_KERNEL);
+	if (!desc)
+		goto out;
+
+	ret = -EINVAL;
+	type = null_latency_token(&p);
+	if (!type || !strcmp(type, "none")) {
+		ret = 0;
+		goto out;
+	}
+
+	lat = null_latency_alloc(NULL_LAT_MAX_POINTS + 2);
+	if (!lat) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (!strcmp(type, "uniform")) {
+		tok = null_latency_token(&p);
+		if (!tok || null_latency_parse_nsec(tok, &fast))
+			goto out;
+		tok = null_latency_token(&p);
+		if (!tok || null_latency_parse_nsec(tok, &slow) || slow < fast)
+			goto out;
+		null_latency_add(lat, 0, fast);
+		null_latency_add(lat, NULL_LAT_PCT_MAX, slow);
+	} else if (!strcmp(type, "bimodal")) {
+		tok = null_latency_token(&p);
+		if (!tok || null_latency_parse_nsec(tok, &fast))
+			goto out;
+		tok = null_latency_token(&p);
+		if (!tok || null_latency_parse_nsec(tok, &slow) || slow < fast)
+			goto out;
+		tok = null_latency_token(&p);
+		if (!tok || null_latency_parse_pct(tok, &pct))
+			goto out;
+		null_latency_add(lat, 0, fast);
+		null_latency_add(lat, NULL_LAT_PCT_MAX - pct, fast);
+		null_latency_add(lat, NULL_LAT_PCT_MAX - pct, slow);
+		null_latency_add(lat, NULL_LAT_PCT_MAX, slow);
+	} else if (!strcmp(type, "table")) {
+		while ((tok = null_latency_token(&p))) {
+			if (lat->nr >= NULL_LAT_MAX_POINTS)
+				goto out;
+			sep = strchr(tok, ':');
+			if (!sep)
+				goto out;
+			*sep++ = '\0';
+			if (null_latency_parse_pct(tok, &pct) ||
+			    null_latency_parse_nsec(sep, &slow))
+				goto out;
+			/* Below the first percentile, use its latency */
+			if (!lat->nr && pct)
+				null_latency_add(lat, 0, slow);
+			if (lat->nr && (pct < lat->pct[lat->nr - 1] ||
+					slow < lat->nsec[lat->nr - 1]))
+				goto out;
+			null_latency_add(lat, pct, slow);
+		}
+		if (!lat->nr)
+			goto out;
+		if (lat->pct[lat->nr - 1] < NULL_LAT_PCT_MAX)
+			null_latency_add(lat, NULL_LAT_PCT_MAX,
+					 lat->nsec[lat->nr - 1]);
+	} else {
+		goto out;
+	}
+
+	if (null_latency_token(&p))
+		goto out;
+
+	lat->desc = desc;
+	desc = NULL;
+	ret = 0;
+out:
+	kfree(desc);
+	kfree(orig);
+	if (ret) {
+		null_latency_free(lat);
+		return ERR_PTR(ret);
+	}
+	return lat;
+}
+
 /* The following macro should only be used with TYPE = {uint, ulong, bool}. */
 #define NULLB_DEVICE_ATTR(NAME, TYPE)						\
 static ssize_t									\
@@ -394,6 +594,120 @@ static ssize_t nullb_device_badblocks_store(struct config_item *item,
 }
 CONFIGFS_ATTR(nullb_device_, badblocks);
 
+static ssize_t nullb_device_latency_show(struct nullb_device *dev, int rw,
+					 char *page)
+{
+	struct nullb_latency *lat = dev->latency[rw];
+
+	return snprintf(page, PAGE_SIZE, "%s\n", lat ? lat->desc : "none");
+}
+
+static ssize_t nullb_device_latency_store(struct nullb_device *dev, int rw,
+					  const char *page, size_t count)
+{
+	struct nullb_latency *lat;
+
+	if (test_bit(NULLB_DEV_FL_CONFIGURED, &dev->flags))
+		return -EBUSY;
+
+	lat = null_latency_parse(page, count);
+	if (IS_ERR(lat))
+		return PTR_ERR(lat);
+
+	null_latency_free(dev->latency[rw]);
+	dev->latency[rw] = lat;
+	return count;
+}
+
+static ssize_t nullb_device_read_latency_show(struct config_item *item,
+					      char *page)
+{
+	return nullb_device_latency_show(to_nullb_device(item), READ, page);
+}
+
+static ssize_t nullb_device_read_latency_store(struct config_item *item,
+					       const char *page, size_t count)
+{
+	return nullb_device_latency_store(to_nullb_device(item), READ, page,
+					  count);
+}
+CONFIGFS_ATTR(nullb_device_, read_latency);
+
+static ssize_t nullb_device_write_latency_show(struct config_item *item,
+					       char *page)
+{
+	return nullb_device_latency_show(to_nullb_device(item), WRITE, page);
+}
+
+static ssize_t nullb_device_write_latency_store(struct config_item *item,
+						const char *page, size_t count)
+{
+	return nullb_device_latency_store(to_nullb_device(item), WRITE, page,
+					  count);
+}
+CONFIGFS_ATTR(nullb_device_, write_latency);
+
+static void null_lat_trace_free(struct nullb_device *dev)
+{
+	int rw;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		kvfree(dev->lat_trace[rw].nsec);
+		dev->lat_trace[rw].nsec = NULL;
+		dev->lat_trace[rw].nr = 0;
+	}
+}
+
+/*
+ * Recorded completion latencies to replay, such as the D to C times of a
+ * blktrace: little endian 32 bit records holding the latency in ns, with
+ * the top bit set for writes.  Reads and writes each loop over their own
+ * records, in place of read_latency and write_latency.
+ */
+static ssize_t nullb_device_latency_trace_write(struct config_item *item,
+						const void *buf, size_t count)
+{
+	struct nullb_device *dev = to_nullb_device(item);
+	const __le32 *rec = buf;
+	unsigned int nr[2] = { 0, 0 }, i;
+	u32 *nsec[2] = { NULL, NULL };
+	u32 val;
+	int rw;
+
+	if (test_bit(NULLB_DEV_FL_CONFIGURED, &dev->flags))
+		return -EBUSY;
+	if (count % sizeof(*rec))
+		return -EINVAL;
+
+	for (i = 0; i < count / sizeof(*rec); i++)
+		nr[!!(le32_to_cpu(rec[i]) & NULL_LAT_TRACE_WRITE)]++;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		if (!nr[rw])
+			continue;
+		nsec[rw] = kvmalloc_array(nr[rw], sizeof(u32), GFP_KERNEL);
+		if (!nsec[rw]) {
+			kvfree(nsec[READ]);
+			return -ENOMEM;
+		}
+	}
+
+	null_lat_trace_free(dev);
+	for (i = 0; i < count / sizeof(*rec); i++) {
+		val = le32_to_cpu(rec[i]);
+		rw = !!(val & NULL_LAT_TRACE_WRITE);
+		nsec[rw][dev->lat_trace[rw].nr++] = val & ~NULL_LAT_TRACE_WRITE;
+	}
+	for (rw = READ; rw <= WRITE; rw++) {
+		dev->lat_trace[rw].nsec = nsec[rw];
+		atomic_set(&dev->lat_trace[rw].pos, 0);
+	}
+
+	return count;
+}
+CONFIGFS_BIN_ATTR_WO(nullb_device_, latency_trace, NULL,
+		     NULL_LAT_TRACE_MAX_SIZE);
+
 static struct configfs_attribute *nullb_device_attrs[] = {
 	&nullb_device_attr_size,
 	&nullb_device_attr_completion_nsec,
@@ -415,6 +729,13 @@ static struct configfs_attribute *nullb_device_attrs[] = {
 	&nullb_device_attr_zoned,
 	&nullb_device_attr_zone_size,
 	&nullb_device_attr_zone_nr_conv,
+	&nullb_device_attr_read_latency,
+	&nullb_device_attr_write_latency,
+	NULL,
+};
+
+static struct configfs_bin_attribute *nullb_device_bin_attrs[] = {
+	&nullb_device_attr_latency_trace,
 	NULL,
 };
 
@@ -433,6 +754,7 @@ static struct configfs_item_operations nullb_device_ops = {
 static const struct config_item_type nullb_device_type = {
 	.ct_item_ops	= &nullb_device_ops,
 	.ct_attrs	= nullb_device_attrs,
+	.ct_bin_attrs	= nullb_device_bin_attrs,
 	.ct_owner	= THIS_MODULE,
 };
 
@@ -467,7 +789,7 @@ nullb_group_drop_item(struct config_group *group, struct config_item *item)
 
 static ssize_t memb_group_features_show(struct config_item *item, char *page)
 {
-	return snprintf(page, PAGE_SIZE, "memory_backed,discard,bandwidth,cache,badblocks,zoned,zone_size\n");
+	return snprintf(page, PAGE_SIZE, "memory_backed,discard,bandwidth,cache,badblocks,zoned,zone_size,latency\n");
 }
 
 CONFIGFS_ATTR_RO(memb_group_, features);
@@ -539,6 +861,9 @@ static void null_free_dev(struct nullb_device *dev)
 
 	null_zone_exit(dev);
 	badblocks_exit(&dev->badblocks);
+	null_latency_free(dev->latency[READ]);
+	null_latency_free(dev->latency[WRITE]);
+	null_lat_trace_free(dev);
 	kfree(dev);
 }
 
@@ -637,9 +962,46 @@ static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+static u64 null_latency_sample(struct nullb_latency *lat)
+{
+	u32 r = prandom_u32_max(NULL_LAT_PCT_MAX + 1);
+	u32 span;
+	unsigned int i = 1;
+
+	/* Find the two points around r and interpolate between them */
+	while (i < lat->nr - 1 && lat->pct[i] < r)
+		i++;
+
+	span = lat->pct[i] - lat->pct[i - 1];
+	if (!span)
+		return lat->nsec[i];
+
+	return lat->nsec[i - 1] + div_u64((lat->nsec[i] - lat->nsec[i - 1]) *
+					  (r - lat->pct[i - 1]), span);
+}
+
 static void null_cmd_end_timer(struct nullb_cmd *cmd)
 {
-	ktime_t kt = cmd->nq->dev->completion_nsec;
+	struct nullb_device *dev = cmd->nq->dev;
+	struct nullb_lat_trace *trace;
+	ktime_t kt = dev->completion_nsec;
+	int rw;
+
+	if (dev->latency[READ] || dev->latency[WRITE] ||
+	    dev->lat_trace[READ].nr || dev->lat_trace[WRITE].nr) {
+		if (dev->queue_mode == NULL_Q_BIO)
+			rw = op_is_write(bio_op(cmd->bio));
+		else
+			rw = op_is_write(req_op(cmd->rq));
+
+		trace = &dev->lat_trace[rw];
+		if (trace->nr)
+			kt = trace->nsec[(unsigned int)
+				(atomic_inc_return(&trace->pos) - 1) %
+				trace->nr];
+		else if (dev->latency[rw])
+			kt = null_latency_sample(dev->latency[rw]);
+	}
 
 	hrtimer_start(&cmd->timer, kt, HRTIMER_MODE_REL);
 }
@@ -1578,6 +1940,11 @@ static void null_validate_conf(struct nullb_device *dev)
 	dev->queue_mode = min_t(unsigned int, dev->queue_mode, NULL_Q_MQ);
 	dev->irqmode = min_t(unsigned int, dev->irqmode, NULL_IRQ_TIMER);
 
+	if (dev->irqmode != NULL_IRQ_TIMER &&
+	    (dev->latency[READ] || dev->latency[WRITE] ||
+	     dev->lat_trace[READ].nr || dev->lat_trace[WRITE].nr))
+		pr_warn("null_blk: latency distributions need irqmode=2, ignoring them\n");
+
 	/* Do memory allocation, so set blocking */
 	if (dev->memory_backed)
 		dev->blocking = true;
@@ -74,6 +74,9 @@
 #include <linux/crc32.h>
 #include <linux/math64.h>
 #include <linux/random.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include "ubi.h"
 
 static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai);
@@ -927,30 +930,71 @@ static bool vol_ignored(int vol_id)
 }
 
 /**
- * scan_peb - scan and process UBI headers of a PEB.
+ * struct ubi_peb_hdrs - UBI headers of a PEB read for scanning.
+ * @bad: what 'ubi_io_is_bad()' returned
+ * @ec_err: what 'ubi_io_read_ec_hdr()' returned
+ * @vid_err: what 'ubi_io_read_vid_hdr()' returned, the VID header is not read
+ *           if the PEB is bad or its EC header could not be read or is empty
+ * @ech: EC header
+ * @vidb: VID header buffer
+ */
+struct ubi_peb_hdrs {
+	int bad;
+	int ec_err;
+	int vid_err;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_io_buf *vidb;
+};
+
+/**
+ * read_peb_hdrs - read UBI headers of a PEB.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock number
+ * @hdrs: where to store the headers and the results of reading them
+ *
+ * This function does not touch the attaching information and may thus run in
+ * parallel for different PEBs.
+ */
+static void read_peb_hdrs(struct ubi_device *ubi, int pnum,
+			  struct ubi_peb_hdrs *hdrs)
+{
+	hdrs->bad = ubi_io_is_bad(ubi, pnum);
+	if (hdrs->bad)
+		return;
+
+	hdrs->ec_err = ubi_io_read_ec_hdr(ubi, pnum, hdrs->ech, 0);
+	if (hdrs->ec_err < 0 || hdrs->ec_err == UBI_IO_FF ||
+	    hdrs->ec_err == UBI_IO_FF_BITFLIPS)
+		return;
+
+	hdrs->vid_err = ubi_io_read_vid_hdr(ubi, pnum, hdrs->vidb, 0);
+}
+
+/**
+ * process_peb - process UBI headers of a PEB.
  * @ubi: UBI device description object
  * @ai: attaching information
  * @pnum: the physical eraseblock number
+ * @hdrs: headers of the PEB, as read by 'read_peb_hdrs()'
  * @fast: true if we're scanning for a Fastmap
  *
- * This function reads UBI headers of PEB @pnum, checks them, and adds
- * information about this PEB to the corresponding list or RB-tree in the
- * "attaching info" structure. Returns zero if the physical eraseblock was
- * successfully handled and a negative error code in case of failure.
+ * This function checks UBI headers of PEB @pnum and adds information about
+ * this PEB to the corresponding list or RB-tree in the "attaching info"
+ * structure. Returns zero if the physical eraseblock was successfully handled
+ * and a negative error code in case of failure.
  */
-static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
-		    int pnum, bool fast)
+static int process_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		       int pnum, struct ubi_peb_hdrs *hdrs, bool fast)
 {
-	struct ubi_ec_hdr *ech = ai->ech;
-	struct ubi_vid_io_buf *vidb = ai->vidb;
-	struct ubi_vid_hdr *vidh = ubi_get_vid_hdr(vidb);
+	struct ubi_ec_hdr *ech = hdrs->ech;
+	struct ubi_vid_hdr *vidh = ubi_get_vid_hdr(hdrs->vidb);
 	long long ec;
 	int err, bitflips = 0, vol_id = -1, ec_err = 0;
 
 	dbg_bld("scan PEB %d", pnum);
 
 	/* Skip bad physical eraseblocks */
-	err = ubi_io_is_bad(ubi, pnum);
+	err = hdrs->bad;
 	if (err < 0)
 		return err;
 	else if (err) {
@@ -958,7 +1002,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = hdrs->ec_err;
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -1041,7 +1085,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidb, 0);
+	err = hdrs->vid_err;
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -1193,6 +1237,30 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	return 0;
 }
 
+/**
+ * scan_peb - scan and process UBI headers of a PEB.
+ * @ubi: UBI device description object
+ * @ai: attaching information
+ * @pnum: the physical eraseblock number
+ * @fast: true if we're scanning for a Fastmap
+ *
+ * This function reads UBI headers of PEB @pnum, checks them, and adds
+ * information about this PEB to the corresponding list or RB-tree in the
+ * "attaching info" structure. Returns zero if the physical eraseblock was
+ * successfully handled and a negative error code in case of failure.
+ */
+static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		    int pnum, bool fast)
+{
+	struct ubi_peb_hdrs hdrs = {
+		.ech = ai->ech,
+		.vidb = ai->vidb,
+	};
+
+	read_peb_hdrs(ubi, pnum, &hdrs);
+	return process_peb(ubi, ai, pnum, &hdrs, fast);
+}
+
 /**
  * late_analysis - analyze the overall situation with PEB.
  * @ubi: UBI device description object
@@ -1361,6 +1429,81 @@ static void destroy_ai(struct ubi_attach_info *ai)
 	kfree(ai);
 }
 
+/**
+ * struct ubi_scan_ra - UBI headers of a PEB read ahead of its processing.
+ * @work: work reading the headers
+ * @done: completed once the headers have been read
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock number
+ * @hdrs: the headers
+ */
+struct ubi_scan_ra {
+	struct work_struct work;
+	struct completion done;
+	struct ubi_device *ubi;
+	int pnum;
+	struct ubi_peb_hdrs hdrs;
+};
+
+static void scan_ra_work(struct work_struct *work)
+{
+	struct ubi_scan_ra *ra = container_of(work, struct ubi_scan_ra, work);
+
+	read_peb_hdrs(ra->ubi, ra->pnum, &ra->hdrs);
+	complete(&ra->done);
+}
+
+static void scan_ra_queue(struct ubi_scan_ra *ra, int pnum)
+{
+	ra->pnum = pnum;
+	reinit_completion(&ra->done);
+	queue_work(system_unbound_wq, &ra->work);
+}
+
+static void scan_ra_free(struct ubi_scan_ra *ra, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		flush_work(&ra[i].work);
+		ubi_free_vid_buf(ra[i].hdrs.vidb);
+		kfree(ra[i].hdrs.ech);
+	}
+	kfree(ra);
+}
+
+/**
+ * scan_ra_alloc - allocate read-ahead slots for scanning.
+ * @ubi: UBI device description object
+ * @count: number of slots
+ *
+ * Returns the slots or %NULL if memory is short, in which case the PEBs are
+ * scanned one by one.
+ */
+static struct ubi_scan_ra *scan_ra_alloc(struct ubi_device *ubi, int count)
+{
+	struct ubi_scan_ra *ra;
+	int i;
+
+	ra = kcalloc(count, sizeof(*ra), GFP_KERNEL);
+	if (!ra)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		INIT_WORK(&ra[i].work, scan_ra_work);
+		init_completion(&ra[i].done);
+		ra[i].ubi = ubi;
+		ra[i].hdrs.ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+		ra[i].hdrs.vidb = ubi_alloc_vid_buf(ubi, GFP_KERNEL);
+		if (!ra[i].hdrs.ech || !ra[i].hdrs.vidb) {
+			scan_ra_free(ra, i + 1);
+			return NULL;
+		}
+	}
+
+	return ra;
+}
+
 /**
  * scan_all - scan entire MTD device.
  * @ubi: UBI device description object
@@ -1374,10 +1517,11 @@ static void destroy_ai(struct ubi_attach_info *ai)
 static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		    int start)
 {
-	int err, pnum;
+	int err, pnum, nr_ra;
 	struct rb_node *rb1, *rb2;
 	struct ubi_ainf_volume *av;
 	struct ubi_ainf_peb *aeb;
+	struct ubi_scan_ra *ra = NULL;
 
 	err = -ENOMEM;
 
@@ -1389,15 +1533,41 @@ static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	if (!ai->vidb)
 		goto out_ech;
 
+	/*
+	 * Reading the headers is what takes time, so they are read in
+	 * parallel for the next @nr_ra PEBs. The PEBs are still processed
+	 * one by one and in order, the attaching information does not depend
+	 * on the read-ahead.
+	 */
+	nr_ra = min(ubi->scan_readahead, ubi->peb_count - start);
+	if (nr_ra > 1)
+		ra = scan_ra_alloc(ubi, nr_ra);
+	if (ra) {
+		for (pnum = start; pnum < start + nr_ra; pnum++)
+			scan_ra_queue(&ra[pnum - start], pnum);
+	}
+
 	for (pnum = start; pnum < ubi->peb_count; pnum++) {
 		cond_resched();
 
 		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, ai, pnum, false);
+		if (ra) {
+			struct ubi_scan_ra *r = &ra[(pnum - start) % nr_ra];
+
+			wait_for_completion(&r->done);
+			err = process_peb(ubi, ai, pnum, &r->hdrs, false);
+			if (!err && pnum + nr_ra < ubi->peb_count)
+				scan_ra_queue(r, pnum + nr_ra);
+		} else {
+			err = scan_peb(ubi, ai, pnum, false);
+		}
 		if (err < 0)
-			goto out_vidh;
+			goto out_ra;
 	}
 
+	if (ra)
+		scan_ra_free(ra, nr_ra);
+
 	ubi_msg(ubi, "scanning is finished");
 
 	/* Calculate mean erase counter */
@@ -1440,6 +1610,9 @@ static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 
 	return 0;
 
+out_ra:
+	if (ra)
+		scan_ra_free(ra, nr_ra);
 out_vidh:
 	ubi_free_vid_buf(ai->vidb);
 out_ech:
@@ -1544,6 +1717,21 @@ static int scan_fast(struct ubi_device *ubi, struct ubi_attach_info **ai)
 
 #endif
 
+/**
+ * attach_phase_done - record the duration of a phase of attaching.
+ * @phase: where to store the duration, in microseconds
+ * @since: when the phase started
+ *
+ * Returns the current time, which is when the next phase starts.
+ */
+static ktime_t attach_phase_done(s64 *phase, ktime_t since)
+{
+	ktime_t now = ktime_get();
+
+	*phase = ktime_us_delta(now, since);
+	return now;
+}
+
 /**
  * ubi_attach - attach an MTD device.
  * @ubi: UBI device descriptor
@@ -1556,11 +1744,14 @@ int ubi_attach(struct ubi_device *ubi, int force_scan)
 {
 	int err;
 	struct ubi_attach_info *ai;
+	ktime_t start, t;
 
 	ai = alloc_ai();
 	if (!ai)
 		return -ENOMEM;
 
+	start = ktime_get();
+
 #ifdef CONFIG_MTD_UBI_FASTMAP
 	/* On small flash devices we disable fastmap in any case. */
 	if ((int)mtd_div_by_eb(ubi->mtd->size, ubi->mtd) <= UBI_FM_MAX_START) {
@@ -1591,6 +1782,8 @@ int ubi_attach(struct ubi_device *ubi, int force_scan)
 	if (err)
 		goto out_ai;
 
+	t = attach_phase_done(&ubi->dbg.attach_times.scan, start);
+
 	ubi->bad_peb_count = ai->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
 	ubi->corr_peb_count = ai->corr_peb_count;
@@ -1602,14 +1795,20 @@ int ubi_attach(struct ubi_device *ubi, int force_scan)
 	if (err)
 		goto out_ai;
 
+	t = attach_phase_done(&ubi->dbg.attach_times.vtbl, t);
+
 	err = ubi_wl_init(ubi, ai);
 	if (err)
 		goto out_vtbl;
 
+	t = attach_phase_done(&ubi->dbg.attach_times.wl, t);
+
 	err = ubi_eba_init(ubi, ai);
 	if (err)
 		goto out_wl;
 
+	attach_phase_done(&ubi->dbg.attach_times.eba, t);
+
 #ifdef CONFIG_MTD_UBI_FASTMAP
 	if (ubi->fm && ubi_dbg_chk_fastmap(ubi)) {
 		struct ubi_attach_info *scan_ai;
@@ -1635,6 +1834,7 @@ int ubi_attach(struct ubi_device *ubi, int force_scan)
 #endif
 
 	destroy_ai(ai);
+	attach_phase_done(&ubi->dbg.attach_times.total, start);
 	return 0;
 
 out_wl:
@@ -25,6 +25,14 @@
  * to allow early creation of block devices on top of UBI volumes. Runtime
  * block creation/removal for UBI volumes is provided through two UBI ioctls:
  * UBI_IOCVOLCRBLK and UBI_IOCVOLRMBLK.
+ *
+ * Requests are read in the context dispatching them, with one hardware queue
+ * per CPU. Contiguous requests dispatched together, e.g. a large read-ahead
+ * split because of the UBI_MAX_SG_COUNT segments limit, are read at once.
+ * Optionally, the last 'block_cache_lebs' LEBs read are cached, which is only
+ * meant for volumes holding read-only images. The cache is dropped when the
+ * device is first opened and on every update or resize notification of the
+ * volume, but it doesn't see writes of other in-kernel users of the volume.
  */
 
 #include <linux/module.h>
@@ -33,14 +41,17 @@
 #include <linux/kernel.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/slab.h>
 #include <linux/mtd/ubi.h>
-#include <linux/workqueue.h>
 #include <linux/blkdev.h>
 #include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/scatterlist.h>
 #include <linux/idr.h>
+#include <linux/list_sort.h>
+#include <linux/vmalloc.h>
 #include <asm/div64.h>
 
 #include "ubi-media.h"
@@ -61,17 +72,43 @@ struct ubiblock_param {
 	char name[UBIBLOCK_PARAM_LEN+1];
 };
 
+/* Maximum number of LEBs in the read cache of a device */
+#define UBIBLOCK_MAX_CACHE_LEBS 64
+
 struct ubiblock_pdu {
-	struct work_struct work;
+	struct list_head list;
 	struct ubi_sgl usgl;
 };
 
+/* Requests queued on a hardware queue until the last one is dispatched */
+struct ubiblock_queue {
+	spinlock_t lock;
+	struct list_head pending;
+};
+
+/*
+ * @leb and @users are protected by the cache lock of the device. An entry
+ * in use can't be given to another LEB, and @buf is only read once @valid
+ * has been set under @fill_mutex.
+ */
+struct ubiblock_cache {
+	struct list_head lru;
+	int leb;
+	int users;
+	bool valid;
+	struct mutex fill_mutex;
+	void *buf;
+};
+
 /* Numbers of elements set in the @ubiblock_param array */
 static int ubiblock_devs __initdata;
 
 /* MTD devices specification parameters */
 static struct ubiblock_param ubiblock_param[UBIBLOCK_MAX_DEVICES] __initdata;
 
+/* Number of LEBs cached per device */
+static unsigned int ubiblock_cache_lebs;
+
 struct ubiblock {
 	struct ubi_volume_desc *desc;
 	int ubi_num;
@@ -82,7 +119,12 @@ struct ubiblock {
 	struct gendisk *gd;
 	struct request_queue *rq;
 
-	struct workqueue_struct *wq;
+	/* LEB read cache, most recently used first */
+	spinlock_t cache_lock;
+	wait_queue_head_t cache_wait;
+	struct list_head cache_lru;
+	unsigned int cache_lebs;
+	struct ubiblock_cache *cache;
 
 	struct mutex dev_mutex;
 	struct list_head list;
@@ -170,6 +212,9 @@ MODULE_PARM_DESC(block, "Attach block devices to UBI volumes. Parameter format:
 			"ubi.block=0,rootfs\n"
 			"Using both UBI device number and UBI volume number:\n"
 			"ubi.block=0,0\n");
+module_param_named(block_cache_lebs, ubiblock_cache_lebs, uint, 0644);
+MODULE_PARM_DESC(block_cache_lebs, "Number of LEBs cached by each block device created afterwards (max. "
+			__stringify(UBIBLOCK_MAX_CACHE_LEBS) ", default 0). Only for volumes which are not changed while in use, e.g. holding a squashfs image.");
 
 static struct ubiblock *find_dev_nolock(int ubi_num, int vol_id)
 {
@@ -181,15 +226,118 @@ static struct ubiblock *find_dev_nolock(int ubi_num, int vol_id)
 	return NULL;
 }
 
-static int ubiblock_read(struct ubiblock_pdu *pdu)
+/*
+ * Returns the entry holding @leb, or else the least recently used idle entry,
+ * given to @leb. Returns NULL if every entry is in use. The entry is pinned
+ * until ubiblock_cache_put().
+ */
+static struct ubiblock_cache *ubiblock_cache_get(struct ubiblock *dev, int leb)
 {
-	int ret, leb, offset, bytes_left, to_read;
-	u64 pos;
-	struct request *req = blk_mq_rq_from_pdu(pdu);
-	struct ubiblock *dev = req->q->queuedata;
+	struct ubiblock_cache *c;
+
+	spin_lock(&dev->cache_lock);
+	list_for_each_entry(c, &dev->cache_lru, lru) {
+		if (c->leb == leb)
+			goto found;
+	}
+
+	list_for_each_entry_reverse(c, &dev->cache_lru, lru) {
+		if (!c->users) {
+			c->leb = leb;
+			c->valid = false;
+			goto found;
+		}
+	}
+	spin_unlock(&dev->cache_lock);
+	return NULL;
+
+found:
+	c->users++;
+	list_move(&c->lru, &dev->cache_lru);
+	spin_unlock(&dev->cache_lock);
+	return c;
+}
+
+static void ubiblock_cache_put(struct ubiblock *dev, struct ubiblock_cache *c)
+{
+	bool idle;
+
+	spin_lock(&dev->cache_lock);
+	idle = !--c->users;
+	/* Don't keep an entry whose read failed */
+	if (idle && !c->valid)
+		c->leb = -1;
+	spin_unlock(&dev->cache_lock);
+
+	if (idle)
+		wake_up(&dev->cache_wait);
+}
+
+/* Must be called with @c->fill_mutex held */
+static int ubiblock_cache_fill(struct ubiblock *dev, struct ubiblock_cache *c,
+			       int leb)
+{
+	struct ubi_volume_info vi;
+	long long size;
+	int ret;
+
+	/* The last LEB of a static volume may not be full */
+	ubi_get_volume_info(dev->desc, &vi);
+	size = vi.used_bytes - (long long)leb * dev->leb_size;
+	if (size > dev->leb_size)
+		size = dev->leb_size;
+
+	ret = ubi_read(dev->desc, leb, c->buf, 0, size);
+	if (ret < 0)
+		return ret;
+
+	/* Pairs with the acquire in ubiblock_read_cached() */
+	smp_store_release(&c->valid, true);
+	return 0;
+}
+
+static void ubiblock_cache_invalidate(struct ubiblock *dev)
+{
+	struct ubiblock_cache *c;
+
+	if (!dev->cache)
+		return;
+
+	/* Entries still in use are recycled once their readers are done */
+	spin_lock(&dev->cache_lock);
+	list_for_each_entry(c, &dev->cache_lru, lru)
+		c->leb = -1;
+	spin_unlock(&dev->cache_lock);
+}
+
+static int ubiblock_read_cached(struct ubiblock *dev, struct ubi_sgl *usgl,
+				int nents, int leb, int offset, int len,
+				int skip)
+{
+	struct ubiblock_cache *c;
+	int ret = 0;
 
-	to_read = blk_rq_bytes(req);
-	pos = blk_rq_pos(req) << 9;
+	/* There are more entries than CPUs reading at once on most systems */
+	wait_event(dev->cache_wait, (c = ubiblock_cache_get(dev, leb)) != NULL);
+
+	if (!smp_load_acquire(&c->valid)) {
+		mutex_lock(&c->fill_mutex);
+		if (!c->valid)
+			ret = ubiblock_cache_fill(dev, c, leb);
+		mutex_unlock(&c->fill_mutex);
+	}
+	if (!ret)
+		sg_pcopy_from_buffer(usgl->sg, nents, c->buf + offset, len,
+				     skip);
+	ubiblock_cache_put(dev, c);
+
+	return ret;
+}
+
+static int ubiblock_read(struct ubiblock *dev, struct ubi_sgl *usgl,
+			 int nents, u64 pos, int to_read)
+{
+	int ret, leb, offset, bytes_left, done = 0;
 
 	/* Get LEB:offset address to read from */
 	offset = do_div(pos, dev->leb_size);
@@ -204,10 +352,15 @@ static int ubiblock_read(struct ubiblock_pdu *pdu)
 		if (offset + to_read > dev->leb_size)
 			to_read = dev->leb_size - offset;
 
-		ret = ubi_read_sg(dev->desc, leb, &pdu->usgl, offset, to_read);
+		if (dev->cache)
+			ret = ubiblock_read_cached(dev, usgl, nents, leb, offset,
+						   to_read, done);
+		else
+			ret = ubi_read_sg(dev->desc, leb, usgl, offset, to_read);
 		if (ret < 0)
 			return ret;
 
+		done += to_read;
 		bytes_left -= to_read;
 		to_read = bytes_left;
 		leb += 1;
@@ -249,6 +402,9 @@ static int ubiblock_open(struct block_device *bdev, fmode_t mode)
 		goto out_unlock;
 	}
 
+	/* The volume may have been changed while it was closed */
+	ubiblock_cache_invalidate(dev);
+
 out_done:
 	dev->refcnt++;
 	mutex_unlock(&dev->dev_mutex);
@@ -289,38 +445,102 @@ static const struct block_device_operations ubiblock_ops = {
 	.getgeo	= ubiblock_getgeo,
 };
 
-static void ubiblock_do_work(struct work_struct *work)
+static int ubiblock_rq_cmp(void *priv, struct list_head *a,
+			   struct list_head *b)
 {
-	int ret;
-	struct ubiblock_pdu *pdu = container_of(work, struct ubiblock_pdu, work);
-	struct request *req = blk_mq_rq_from_pdu(pdu);
+	struct ubiblock_pdu *pa = container_of(a, struct ubiblock_pdu, list);
+	struct ubiblock_pdu *pb = container_of(b, struct ubiblock_pdu, list);
+	sector_t sa = blk_rq_pos(blk_mq_rq_from_pdu(pa));
+	sector_t sb = blk_rq_pos(blk_mq_rq_from_pdu(pb));
 
-	blk_mq_start_request(req);
+	return sa < sb ? -1 : sa > sb;
+}
 
-	/*
-	 * It is safe to ignore the return value of blk_rq_map_sg() because
-	 * the number of sg entries is limited to UBI_MAX_SG_COUNT
-	 * and ubi_read_sg() will check that limit.
-	 */
-	blk_rq_map_sg(req->q, req, pdu->usgl.sg);
+/*
+ * Reads the requests of @list, which have been started. Contiguous requests
+ * are read at once into the scatterlist of the first one, as long as their
+ * segments fit in it.
+ */
+static void ubiblock_dispatch(struct ubiblock *dev, struct list_head *list)
+{
+	struct ubiblock_pdu *pdu, *next, *tmp;
+	struct scatterlist *sg;
+	struct request *req;
+	LIST_HEAD(run);
+	int ret, nents, len;
+	u64 pos;
+
+	list_sort(NULL, list, ubiblock_rq_cmp);
+
+	while (!list_empty(list)) {
+		pdu = list_first_entry(list, struct ubiblock_pdu, list);
+		list_move_tail(&pdu->list, &run);
+		req = blk_mq_rq_from_pdu(pdu);
+		sg = pdu->usgl.sg;
+
+		/*
+		 * It is safe to ignore the return value of blk_rq_map_sg()
+		 * because the number of sg entries is limited to
+		 * UBI_MAX_SG_COUNT and ubi_read_sg() will check that limit.
+		 */
+		nents = blk_rq_map_sg(req->q, req, sg);
+		pos = (u64)blk_rq_pos(req) << 9;
+		len = blk_rq_bytes(req);
+
+		list_for_each_entry_safe(next, tmp, list, list) {
+			req = blk_mq_rq_from_pdu(next);
+			if ((u64)blk_rq_pos(req) << 9 != pos + len ||
+			    nents + blk_rq_nr_phys_segments(req) > UBI_MAX_SG_COUNT)
+				break;
+
+			sg_unmark_end(&sg[nents - 1]);
+			nents += blk_rq_map_sg(req->q, req, sg + nents);
+			len += blk_rq_bytes(req);
+			list_move_tail(&next->list, &run);
+		}
+
+		ubi_sgl_init(&pdu->usgl);
+		ret = ubiblock_read(dev, &pdu->usgl, nents, pos, len);
+
+		list_for_each_entry_safe(pdu, tmp, &run, list) {
+			list_del_init(&pdu->list);
+			req = blk_mq_rq_from_pdu(pdu);
+			rq_flush_dcache_pages(req);
+			blk_mq_end_request(req, errno_to_blk_status(ret));
+		}
+	}
+}
 
-	ret = ubiblock_read(pdu);
-	rq_flush_dcache_pages(req);
+static void ubiblock_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+	struct ubiblock_queue *uq = hctx->driver_data;
+	LIST_HEAD(list);
+
+	spin_lock(&uq->lock);
+	list_splice_init(&uq->pending, &list);
+	spin_unlock(&uq->lock);
 
-	blk_mq_end_request(req, errno_to_blk_status(ret));
+	ubiblock_dispatch(hctx->queue->queuedata, &list);
 }
 
 static blk_status_t ubiblock_queue_rq(struct blk_mq_hw_ctx *hctx,
 			     const struct blk_mq_queue_data *bd)
 {
 	struct request *req = bd->rq;
-	struct ubiblock *dev = hctx->queue->queuedata;
+	struct ubiblock_queue *uq = hctx->driver_data;
 	struct ubiblock_pdu *pdu = blk_mq_rq_to_pdu(req);
 
 	switch (req_op(req)) {
 	case REQ_OP_READ:
-		ubi_sgl_init(&pdu->usgl);
-		queue_work(dev->wq, &pdu->work);
+		blk_mq_start_request(req);
+
+		spin_lock(&uq->lock);
+		list_add_tail(&pdu->list, &uq->pending);
+		spin_unlock(&uq->lock);
+
+		/* Earlier requests of the batch are read along with the last */
+		if (bd->last)
+			ubiblock_commit_rqs(hctx);
 		return BLK_STS_OK;
 	default:
 		return BLK_STS_IOERR;
@@ -328,6 +548,28 @@ static blk_status_t ubiblock_queue_rq(struct blk_mq_hw_ctx *hctx,
 
 }
 
+static int ubiblock_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			      unsigned int hctx_idx)
+{
+	struct ubiblock_queue *uq;
+
+	uq = kzalloc_node(sizeof(*uq), GFP_KERNEL, hctx->numa_node);
+	if (!uq)
+		return -ENOMEM;
+
+	spin_lock_init(&uq->lock);
+	INIT_LIST_HEAD(&uq->pending);
+	hctx->driver_data = uq;
+
+	return 0;
+}
+
+static void ubiblock_exit_hctx(struct blk_mq_hw_ctx *hctx,
+			       unsigned int hctx_idx)
+{
+	kfree(hctx->driver_data);
+}
+
 static int ubiblock_init_request(struct blk_mq_tag_set *set,
 		struct request *req, unsigned int hctx_idx,
 		unsigned int numa_node)
@@ -335,16 +577,62 @@ static int ubiblock_init_request(struct blk_mq_tag_set *set,
 	struct ubiblock_pdu *pdu = blk_mq_rq_to_pdu(req);
 
 	sg_init_table(pdu->usgl.sg, UBI_MAX_SG_COUNT);
-	INIT_WORK(&pdu->work, ubiblock_do_work);
+	INIT_LIST_HEAD(&pdu->list);
 
 	return 0;
 }
 
 static const struct blk_mq_ops ubiblock_mq_ops = {
 	.queue_rq       = ubiblock_queue_rq,
+	.commit_rqs	= ubiblock_commit_rqs,
+	.init_hctx	= ubiblock_init_hctx,
+	.exit_hctx	= ubiblock_exit_hctx,
 	.init_request	= ubiblock_init_request,
 };
 
+static void ubiblock_free_cache(struct ubiblock *dev)
+{
+	unsigned int i;
+
+	if (!dev->cache)
+		return;
+
+	for (i = 0; i < dev->cache_lebs; i++)
+		vfree(dev->cache[i].buf);
+	kfree(dev->cache);
+	dev->cache = NULL;
+}
+
+static int ubiblock_alloc_cache(struct ubiblock *dev)
+{
+	unsigned int i;
+
+	spin_lock_init(&dev->cache_lock);
+	init_waitqueue_head(&dev->cache_wait);
+	INIT_LIST_HEAD(&dev->cache_lru);
+	dev->cache_lebs = min_t(unsigned int, ubiblock_cache_lebs,
+				UBIBLOCK_MAX_CACHE_LEBS);
+	if (!dev->cache_lebs)
+		return 0;
+
+	dev->cache = kcalloc(dev->cache_lebs, sizeof(*dev->cache), GFP_KERNEL);
+	if (!dev->cache)
+		return -ENOMEM;
+
+	for (i = 0; i < dev->cache_lebs; i++) {
+		dev->cache[i].leb = -1;
+		mutex_init(&dev->cache[i].fill_mutex);
+		dev->cache[i].buf = vmalloc(dev->leb_size);
+		if (!dev->cache[i].buf) {
+			ubiblock_free_cache(dev);
+			return -ENOMEM;
+		}
+		list_add_tail(&dev->cache[i].lru, &dev->cache_lru);
+	}
+
+	return 0;
+}
+
 int ubiblock_create(struct ubi_volume_info *vi)
 {
 	struct ubiblock *dev;
@@ -373,12 +661,16 @@ int ubiblock_create(struct ubi_volume_info *vi)
 	dev->vol_id = vi->vol_id;
 	dev->leb_size = vi->usable_leb_size;
 
+	ret = ubiblock_alloc_cache(dev);
+	if (ret)
+		goto out_free_dev;
+
 	/* Initialize the gendisk of this ubiblock device */
 	gd = alloc_disk(1);
 	if (!gd) {
 		pr_err("UBI: block: alloc_disk failed\n");
 		ret = -ENODEV;
-		goto out_free_dev;
+		goto out_free_cache;
 	}
 
 	gd->fops = &ubiblock_ops;
@@ -398,10 +690,10 @@ int ubiblock_create(struct ubi_volume_info *vi)
 	dev->tag_set.ops = &ubiblock_mq_ops;
 	dev->tag_set.queue_depth = 64;
 	dev->tag_set.numa_node = NUMA_NO_NODE;
-	dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+	dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
 	dev->tag_set.cmd_size = sizeof(struct ubiblock_pdu);
 	dev->tag_set.driver_data = dev;
-	dev->tag_set.nr_hw_queues = 1;
+	dev->tag_set.nr_hw_queues = num_online_cpus();
 
 	ret = blk_mq_alloc_tag_set(&dev->tag_set);
 	if (ret) {
@@ -420,16 +712,6 @@ int ubiblock_create(struct ubi_volume_info *vi)
 	dev->rq->queuedata = dev;
 	dev->gd->queue = dev->rq;
 
-	/*
-	 * Create one workqueue per volume (per registered block device).
-	 * Rembember workqueues are cheap, they're not threads.
-	 */
-	dev->wq = alloc_workqueue("%s", 0, 0, gd->disk_name);
-	if (!dev->wq) {
-		ret = -ENOMEM;
-		goto out_free_queue;
-	}
-
 	list_add_tail(&dev->list, &ubiblock_devices);
 
 	/* Must be the last step: anyone can call file ops from now on */
@@ -439,14 +721,14 @@ int ubiblock_create(struct ubi_volume_info *vi)
 	mutex_unlock(&devices_mutex);
 	return 0;
 
-out_free_queue:
-	blk_cleanup_queue(dev->rq);
 out_free_tags:
 	blk_mq_free_tag_set(&dev->tag_set);
 out_remove_minor:
 	idr_remove(&ubiblock_minor_idr, gd->first_minor);
 out_put_disk:
 	put_disk(dev->gd);
+out_free_cache:
+	ubiblock_free_cache(dev);
 out_free_dev:
 	kfree(dev);
 out_unlock:
@@ -459,11 +741,10 @@ static void ubiblock_cleanup(struct ubiblock *dev)
 {
 	/* Stop new requests to arrive */
 	del_gendisk(dev->gd);
-	/* Flush pending work */
-	destroy_workqueue(dev->wq);
 	/* Finally destroy the blk queue */
 	blk_cleanup_queue(dev->rq);
 	blk_mq_free_tag_set(&dev->tag_set);
+	ubiblock_free_cache(dev);
 	dev_info(disk_to_dev(dev->gd), "released");
 	idr_remove(&ubiblock_minor_idr, dev->gd->first_minor);
 	put_disk(dev->gd);
@@ -529,6 +810,9 @@ static int ubiblock_resize(struct ubi_volume_info *vi)
 
 	mutex_lock(&dev->dev_mutex);
 
+	/* The contents may have changed as well */
+	ubiblock_cache_invalidate(dev);
+
 	if (get_capacity(dev->gd) != disk_capacity) {
 		set_capacity(dev->gd, disk_capacity);
 		dev_info(disk_to_dev(dev->gd), "resized to %lld bytes",
@@ -560,10 +844,10 @@ static int ubiblock_notify(struct notifier_block *nb,
 	case UBI_VOLUME_UPDATED:
 		/*
 		 * If the volume is static, a content update might mean the
-		 * size (i.e. used_bytes) was also changed.
+		 * size (i.e. used_bytes) was also changed. In any case, the
+		 * cached LEBs are stale, which ubiblock_resize() handles.
 		 */
-		if (nt->vi.vol_type == UBI_STATIC_VOLUME)
-			ubiblock_resize(&nt->vi);
+		ubiblock_resize(&nt->vi);
 		break;
 	default:
 		break;
@@ -350,6 +350,7 @@ static ssize_t vol_cdev_write(struct file *file, const char __user *buf,
 		count = err;
 
 		if (vol->changing_leb) {
+			ubi_volume_notify(ubi, vol, UBI_VOLUME_UPDATED);
 			revoke_exclusive(desc, UBI_READWRITE);
 			return count;
 		}
@@ -454,8 +455,11 @@ static long vol_cdev_ioctl(struct file *file, unsigned int cmd,
 			break;
 
 		err = ubi_start_leb_change(ubi, vol, &req);
-		if (req.bytes == 0)
+		if (req.bytes == 0) {
+			if (!err)
+				ubi_volume_notify(ubi, vol, UBI_VOLUME_UPDATED);
 			revoke_exclusive(desc, UBI_READWRITE);
+		}
 		break;
 	}
 
@@ -500,6 +500,54 @@ static const struct file_operations eraseblk_count_fops = {
 	.release = eraseblk_count_release,
 };
 
+static int attach_times_show(struct seq_file *s, void *v)
+{
+	struct ubi_device *ubi = s->private;
+	struct ubi_debug_info *d = &ubi->dbg;
+
+	seq_printf(s, "scan_readahead:\t%d\n", ubi->scan_readahead);
+	seq_printf(s, "scan_us:\t%lld\n", d->attach_times.scan);
+	seq_printf(s, "vtbl_us:\t%lld\n", d->attach_times.vtbl);
+	seq_printf(s, "wl_us:\t\t%lld\n", d->attach_times.wl);
+	seq_printf(s, "eba_us:\t\t%lld\n", d->attach_times.eba);
+	seq_printf(s, "total_us:\t%lld\n", d->attach_times.total);
+
+	return 0;
+}
+
+static int attach_times_open(struct inode *inode, struct file *f)
+{
+	struct ubi_device *ubi;
+	int err;
+
+	ubi = ubi_get_device((unsigned long)inode->i_private);
+	if (!ubi)
+		return -ENODEV;
+
+	err = single_open(f, attach_times_show, ubi);
+	if (err)
+		ubi_put_device(ubi);
+
+	return err;
+}
+
+static int attach_times_release(struct inode *inode, struct file *f)
+{
+	struct seq_file *s = f->private_data;
+
+	ubi_put_device(s->private);
+
+	return single_release(inode, f);
+}
+
+static const struct file_operations attach_times_fops = {
+	.owner = THIS_MODULE,
+	.open = attach_times_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = attach_times_release,
+};
+
 /**
  * ubi_debugfs_init_dev - initialize debugfs for an UBI device.
  * @ubi: UBI device description object
@@ -602,6 +650,12 @@ int ubi_debugfs_init_dev(struct ubi_device *ubi)
 	if (IS_ERR_OR_NULL(dent))
 		goto out_remove;
 
+	fname = "attach_times";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, (void *)ubi_num,
+				   &attach_times_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+
 	return 0;
 
 out_remove:
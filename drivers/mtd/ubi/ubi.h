@@ -414,6 +414,7 @@ struct ubi_wl_entry;
  * @dfs_emulate_power_cut: debugfs knob to emulate power cuts
  * @dfs_power_cut_min: debugfs knob for minimum writes before power cut
  * @dfs_power_cut_max: debugfs knob for maximum writes until power cut
+ * @attach_times: time spent in the phases of attaching, in microseconds
  */
 struct ubi_debug_info {
 	unsigned int chk_gen:1;
@@ -437,6 +438,13 @@ struct ubi_debug_info {
 	struct dentry *dfs_emulate_power_cut;
 	struct dentry *dfs_power_cut_min;
 	struct dentry *dfs_power_cut_max;
+	struct {
+		s64 scan;
+		s64 vtbl;
+		s64 wl;
+		s64 eba;
+		s64 total;
+	} attach_times;
 };
 
 /**
@@ -547,6 +555,8 @@ struct ubi_debug_info {
  * @max_write_size: maximum amount of bytes the underlying flash can write at a
  *                  time (MTD write buffer size)
  * @mtd: MTD device descriptor
+ * @scan_readahead: count of PEBs whose headers are read in advance when
+ *                  scanning, zero to read them one by one
  *
  * @peb_buf: a buffer of PEB size used for different purposes
  * @buf_mutex: protects @peb_buf
@@ -645,6 +655,7 @@ struct ubi_device {
 	unsigned int nor_flash:1;
 	int max_write_size;
 	struct mtd_info *mtd;
+	int scan_readahead;
 
 	void *peb_buf;
 	struct mutex buf_mutex;
@@ -11,12 +11,16 @@
 #include <linux/nvme-tcp.h>
 #include <net/sock.h>
 #include <net/tcp.h>
+#include <net/busy_poll.h>
 #include <linux/blk-mq.h>
 #include <crypto/hash.h>
 
 #include "nvme.h"
 #include "fabrics.h"
 
+/* Completions run at once after a tcp_read_sock() pass */
+#define NVME_TCP_COMP_BATCH	32
+
 struct nvme_tcp_queue;
 
 enum nvme_tcp_send_state {
@@ -49,6 +53,7 @@ struct nvme_tcp_request {
 enum nvme_tcp_queue_flags {
 	NVME_TCP_Q_ALLOCATED	= 0,
 	NVME_TCP_Q_LIVE		= 1,
+	NVME_TCP_Q_POLLING	= 2,
 };
 
 enum nvme_tcp_recv_state {
@@ -72,6 +77,9 @@ struct nvme_tcp_queue {
 	int			pdu_offset;
 	size_t			data_remaining;
 	size_t			ddgst_remaining;
+	int			nr_cqe;
+	int			nr_comp;
+	struct request		*comp[NVME_TCP_COMP_BATCH];
 
 	/* send state */
 	struct nvme_tcp_request *request;
@@ -423,6 +431,37 @@ static void nvme_tcp_error_recovery(struct nvme_ctrl *ctrl)
 	queue_work(nvme_wq, &to_tcp_ctrl(ctrl)->err_work);
 }
 
+static void nvme_tcp_complete_batch(struct request **comp, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		blk_mq_complete_request(comp[i]);
+}
+
+/*
+ * Like nvme_end_request(), but for the receive path: the request is
+ * completed once the current tcp_read_sock() pass is over, along with the
+ * other requests it completed.
+ */
+static void nvme_tcp_recv_end_request(struct nvme_tcp_queue *queue,
+		struct request *rq, __le16 status, union nvme_result result)
+{
+	struct nvme_request *req = nvme_req(rq);
+
+	req->status = le16_to_cpu(status) >> 1;
+	req->result = result;
+	/* inject error when permitted by fault injection framework */
+	nvme_should_fail(rq);
+
+	if (queue->nr_comp == NVME_TCP_COMP_BATCH) {
+		nvme_tcp_complete_batch(queue->comp, queue->nr_comp);
+		queue->nr_comp = 0;
+	}
+	queue->comp[queue->nr_comp++] = rq;
+	queue->nr_cqe++;
+}
+
 static int nvme_tcp_process_nvme_cqe(struct nvme_tcp_queue *queue,
 		struct nvme_completion *cqe)
 {
@@ -437,7 +476,7 @@ static int nvme_tcp_process_nvme_cqe(struct nvme_tcp_queue *queue,
 		return -EINVAL;
 	}
 
-	nvme_end_request(rq, cqe->status, cqe->result);
+	nvme_tcp_recv_end_request(queue, rq, cqe->status, cqe->result);
 
 	return 0;
 }
@@ -634,6 +673,15 @@ static inline void nvme_tcp_end_request(struct request *rq, u16 status)
 	nvme_end_request(rq, cpu_to_le16(status << 1), res);
 }
 
+static inline void nvme_tcp_recv_success(struct nvme_tcp_queue *queue,
+		struct request *rq)
+{
+	union nvme_result res = {};
+
+	nvme_tcp_recv_end_request(queue, rq,
+			cpu_to_le16(NVME_SC_SUCCESS << 1), res);
+}
+
 static int nvme_tcp_recv_data(struct nvme_tcp_queue *queue, struct sk_buff *skb,
 			      unsigned int *offset, size_t *len)
 {
@@ -702,7 +750,7 @@ static int nvme_tcp_recv_data(struct nvme_tcp_queue *queue, struct sk_buff *skb,
 			queue->ddgst_remaining = NVME_TCP_DIGEST_LENGTH;
 		} else {
 			if (pdu->hdr.flags & NVME_TCP_F_DATA_SUCCESS)
-				nvme_tcp_end_request(rq, NVME_SC_SUCCESS);
+				nvme_tcp_recv_success(queue, rq);
 			nvme_tcp_init_recv_ctx(queue);
 		}
 	}
@@ -741,7 +789,7 @@ static int nvme_tcp_recv_ddgst(struct nvme_tcp_queue *queue,
 		struct request *rq = blk_mq_tag_to_rq(nvme_tcp_tagset(queue),
 						pdu->command_id);
 
-		nvme_tcp_end_request(rq, NVME_SC_SUCCESS);
+		nvme_tcp_recv_success(queue, rq);
 	}
 
 	nvme_tcp_init_recv_ctx(queue);
@@ -787,7 +835,8 @@ static void nvme_tcp_data_ready(struct sock *sk)
 
 	read_lock(&sk->sk_callback_lock);
 	queue = sk->sk_user_data;
-	if (likely(queue && queue->rd_enabled))
+	if (likely(queue && queue->rd_enabled) &&
+	    !test_bit(NVME_TCP_Q_POLLING, &queue->flags))
 		queue_work_on(queue->io_cpu, nvme_tcp_wq, &queue->io_work);
 	read_unlock(&sk->sk_callback_lock);
 }
@@ -1024,14 +1073,21 @@ static int nvme_tcp_try_send(struct nvme_tcp_queue *queue)
 static int nvme_tcp_try_recv(struct nvme_tcp_queue *queue)
 {
 	struct sock *sk = queue->sock->sk;
+	struct request *comp[NVME_TCP_COMP_BATCH];
 	read_descriptor_t rd_desc;
-	int consumed;
+	int consumed, nr_comp;
 
 	rd_desc.arg.data = queue;
 	rd_desc.count = 1;
 	lock_sock(sk);
+	queue->nr_cqe = 0;
 	consumed = tcp_read_sock(sk, &rd_desc, nvme_tcp_recv_skb);
+	nr_comp = queue->nr_comp;
+	memcpy(comp, queue->comp, nr_comp * sizeof(*comp));
+	queue->nr_comp = 0;
 	release_sock(sk);
+
+	nvme_tcp_complete_batch(comp, nr_comp);
 	return consumed;
 }
 
@@ -1469,7 +1525,7 @@ static struct blk_mq_tag_set *nvme_tcp_alloc_tagset(struct nvme_ctrl *nctrl,
 		set->driver_data = ctrl;
 		set->nr_hw_queues = nctrl->queue_count - 1;
 		set->timeout = NVME_IO_TIMEOUT;
-		set->nr_maps = 2 /* default + read */;
+		set->nr_maps = nctrl->opts->nr_poll_queues ? HCTX_MAX_TYPES : 2;
 	}
 
 	ret = blk_mq_alloc_tag_set(set);
@@ -1568,6 +1624,7 @@ static unsigned int nvme_tcp_nr_io_queues(struct nvme_ctrl *ctrl)
 
 	nr_io_queues = min(ctrl->opts->nr_io_queues, num_online_cpus());
 	nr_io_queues += min(ctrl->opts->nr_write_queues, num_online_cpus());
+	nr_io_queues += min(ctrl->opts->nr_poll_queues, num_online_cpus());
 
 	return nr_io_queues;
 }
@@ -1599,6 +1656,12 @@ static void nvme_tcp_set_io_queues(struct nvme_ctrl *nctrl,
 			min(opts->nr_io_queues, nr_io_queues);
 		nr_io_queues -= ctrl->io_queues[HCTX_TYPE_DEFAULT];
 	}
+
+	if (opts->nr_poll_queues && nr_io_queues) {
+		/* map dedicated poll queues only if we have queues left */
+		ctrl->io_queues[HCTX_TYPE_POLL] =
+			min(opts->nr_poll_queues, nr_io_queues);
+	}
 }
 
 static int nvme_tcp_alloc_io_queues(struct nvme_ctrl *ctrl)
@@ -2151,14 +2214,43 @@ static int nvme_tcp_map_queues(struct blk_mq_tag_set *set)
 	blk_mq_map_queues(&set->map[HCTX_TYPE_DEFAULT]);
 	blk_mq_map_queues(&set->map[HCTX_TYPE_READ]);
 
+	if (opts->nr_poll_queues && ctrl->io_queues[HCTX_TYPE_POLL]) {
+		/* map dedicated poll queues only if we have queues left */
+		set->map[HCTX_TYPE_POLL].nr_queues =
+				ctrl->io_queues[HCTX_TYPE_POLL];
+		set->map[HCTX_TYPE_POLL].queue_offset =
+			ctrl->io_queues[HCTX_TYPE_DEFAULT] +
+			ctrl->io_queues[HCTX_TYPE_READ];
+		blk_mq_map_queues(&set->map[HCTX_TYPE_POLL]);
+	}
+
 	dev_info(ctrl->ctrl.device,
-		"mapped %d/%d default/read queues.\n",
+		"mapped %d/%d/%d default/read/poll queues.\n",
 		ctrl->io_queues[HCTX_TYPE_DEFAULT],
-		ctrl->io_queues[HCTX_TYPE_READ]);
+		ctrl->io_queues[HCTX_TYPE_READ],
+		ctrl->io_queues[HCTX_TYPE_POLL]);
 
 	return 0;
 }
 
+static int nvme_tcp_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct nvme_tcp_queue *queue = hctx->driver_data;
+	struct sock *sk = queue->sock->sk;
+
+	if (!test_bit(NVME_TCP_Q_LIVE, &queue->flags))
+		return 0;
+
+	/* The poller reaps the completions, don't kick io_work for them */
+	set_bit(NVME_TCP_Q_POLLING, &queue->flags);
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue))
+		sk_busy_loop(sk, true);
+	nvme_tcp_try_recv(queue);
+	clear_bit(NVME_TCP_Q_POLLING, &queue->flags);
+
+	return queue->nr_cqe;
+}
+
 static struct blk_mq_ops nvme_tcp_mq_ops = {
 	.queue_rq	= nvme_tcp_queue_rq,
 	.complete	= nvme_complete_rq,
@@ -2167,6 +2259,7 @@ static struct blk_mq_ops nvme_tcp_mq_ops = {
 	.init_hctx	= nvme_tcp_init_hctx,
 	.timeout	= nvme_tcp_timeout,
 	.map_queues	= nvme_tcp_map_queues,
+	.poll		= nvme_tcp_poll,
 };
 
 static struct blk_mq_ops nvme_tcp_admin_mq_ops = {
@@ -2220,7 +2313,8 @@ static struct nvme_ctrl *nvme_tcp_create_ctrl(struct device *dev,
 
 	INIT_LIST_HEAD(&ctrl->list);
 	ctrl->ctrl.opts = opts;
-	ctrl->ctrl.queue_count = opts->nr_io_queues + opts->nr_write_queues + 1;
+	ctrl->ctrl.queue_count = opts->nr_io_queues + opts->nr_write_queues +
+				opts->nr_poll_queues + 1;
 	ctrl->ctrl.sqsize = opts->queue_size - 1;
 	ctrl->ctrl.kato = opts->kato;
 
@@ -2314,7 +2408,7 @@ static struct nvmf_transport_ops nvme_tcp_transport = {
 	.allowed_opts	= NVMF_OPT_TRSVCID | NVMF_OPT_RECONNECT_DELAY |
 			  NVMF_OPT_HOST_TRADDR | NVMF_OPT_CTRL_LOSS_TMO |
 			  NVMF_OPT_HDR_DIGEST | NVMF_OPT_DATA_DIGEST |
-			  NVMF_OPT_NR_WRITE_QUEUES,
+			  NVMF_OPT_NR_WRITE_QUEUES | NVMF_OPT_NR_POLL_QUEUES,
 	.create_ctrl	= nvme_tcp_create_ctrl,
 };
 
@@ -22,6 +22,7 @@
 #define NVMET_TCP_RECV_BUDGET		8
 #define NVMET_TCP_SEND_BUDGET		8
 #define NVMET_TCP_IO_WORK_BUDGET	64
+#define NVMET_TCP_RSP_BATCH		16
 
 enum nvmet_tcp_send_state {
 	NVMET_TCP_SEND_DATA_PDU,
@@ -138,6 +139,39 @@ struct nvmet_tcp_port {
 	void (*data_ready)(struct sock *);
 };
 
+/* CPUs running the io_work of new queues, all online CPUs if empty */
+static struct cpumask nvmet_tcp_io_cpus;
+
+static int nvmet_tcp_set_io_cpus(const char *val,
+		const struct kernel_param *kp)
+{
+	cpumask_var_t mask;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(val, mask);
+	if (!ret)
+		cpumask_copy(&nvmet_tcp_io_cpus, mask);
+
+	free_cpumask_var(mask);
+	return ret;
+}
+
+static int nvmet_tcp_get_io_cpus(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%*pbl\n", cpumask_pr_args(&nvmet_tcp_io_cpus));
+}
+
+static const struct kernel_param_ops nvmet_tcp_io_cpus_ops = {
+	.set = nvmet_tcp_set_io_cpus,
+	.get = nvmet_tcp_get_io_cpus,
+};
+
+module_param_cb(io_cpus, &nvmet_tcp_io_cpus_ops, NULL, 0644);
+MODULE_PARM_DESC(io_cpus, "CPU list running the queues io_work, round-robin per port (default: all online CPUs)");
+
 static DEFINE_IDA(nvmet_tcp_queue_ida);
 static LIST_HEAD(nvmet_tcp_queue_list);
 static DEFINE_MUTEX(nvmet_tcp_queue_mutex);
@@ -523,9 +557,17 @@ static int nvmet_try_send_data(struct nvmet_tcp_cmd *cmd)
 	while (cmd->cur_sg) {
 		struct page *page = sg_page(cmd->cur_sg);
 		u32 left = cmd->cur_sg->length - cmd->offset;
+		int flags = MSG_DONTWAIT;
+
+		/* Don't cork the last page when no digest or response follows */
+		if (cmd->wbytes_done + left < cmd->req.transfer_len ||
+		    queue->data_digest || !queue->nvme_sq.sqhd_disabled)
+			flags |= MSG_MORE;
+		else
+			flags |= MSG_EOR;
 
 		ret = kernel_sendpage(cmd->queue->sock, page, cmd->offset,
-					left, MSG_DONTWAIT | MSG_MORE);
+					left, flags);
 		if (ret <= 0)
 			return ret;
 
@@ -560,34 +602,78 @@ static int nvmet_try_send_data(struct nvmet_tcp_cmd *cmd)
 
 }
 
+/*
+ * Sends the response of @cmd along with the responses of the following
+ * commands which have no data to transfer, in a single kernel_sendmsg().
+ * Commands whose response isn't fully sent are put back on the send list,
+ * the first of them becoming the queue's current send command.
+ */
 static int nvmet_try_send_response(struct nvmet_tcp_cmd *cmd,
 		bool last_in_batch)
 {
-	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
-	int left = sizeof(*cmd->rsp_pdu) - cmd->offset + hdgst;
-	int flags = MSG_DONTWAIT;
-	int ret;
+	struct nvmet_tcp_queue *queue = cmd->queue;
+	u8 hdgst = nvmet_tcp_hdgst_len(queue);
+	size_t len = sizeof(*cmd->rsp_pdu) + hdgst;
+	struct nvmet_tcp_cmd *batch[NVMET_TCP_RSP_BATCH];
+	struct kvec iov[NVMET_TCP_RSP_BATCH];
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+	size_t total, sent;
+	int i, nr = 0, ret;
 
-	if (!last_in_batch && cmd->queue->send_list_len)
-		flags |= MSG_MORE;
+	batch[nr] = cmd;
+	iov[nr].iov_base = (void *)cmd->rsp_pdu + cmd->offset;
+	iov[nr].iov_len = len - cmd->offset;
+	total = iov[nr++].iov_len;
+
+	while (nr < NVMET_TCP_RSP_BATCH) {
+		struct nvmet_tcp_cmd *next;
+
+		if (list_empty(&queue->resp_send_list))
+			nvmet_tcp_process_resp_list(queue);
+		next = list_first_entry_or_null(&queue->resp_send_list,
+				struct nvmet_tcp_cmd, entry);
+		if (!next || nvmet_tcp_need_data_out(next) ||
+		    nvmet_tcp_need_data_in(next))
+			break;
+
+		list_del_init(&next->entry);
+		queue->send_list_len--;
+		nvmet_setup_response_pdu(next);
+
+		batch[nr] = next;
+		iov[nr].iov_base = next->rsp_pdu;
+		iov[nr].iov_len = len;
+		total += iov[nr++].iov_len;
+	}
+
+	if (!last_in_batch && queue->send_list_len)
+		msg.msg_flags |= MSG_MORE;
 	else
-		flags |= MSG_EOR;
+		msg.msg_flags |= MSG_EOR;
 
-	ret = kernel_sendpage(cmd->queue->sock, virt_to_page(cmd->rsp_pdu),
-		offset_in_page(cmd->rsp_pdu) + cmd->offset, left, flags);
-	if (ret <= 0)
-		return ret;
-	cmd->offset += ret;
-	left -= ret;
+	ret = kernel_sendmsg(queue->sock, &msg, iov, nr, total);
 
-	if (left)
-		return -EAGAIN;
+	sent = ret > 0 ? ret : 0;
+	for (i = 0; i < nr && sent >= iov[i].iov_len; i++) {
+		sent -= iov[i].iov_len;
+		kfree(batch[i]->iov);
+		sgl_free(batch[i]->req.sg);
+		nvmet_tcp_put_cmd(batch[i]);
+	}
 
-	kfree(cmd->iov);
-	sgl_free(cmd->req.sg);
-	cmd->queue->snd_cmd = NULL;
-	nvmet_tcp_put_cmd(cmd);
-	return 1;
+	if (i == nr) {
+		queue->snd_cmd = NULL;
+		return 1;
+	}
+
+	batch[i]->offset += sent;
+	queue->snd_cmd = batch[i];
+	while (--nr > i) {
+		list_add(&batch[nr]->entry, &queue->resp_send_list);
+		queue->send_list_len++;
+	}
+
+	return ret <= 0 ? ret : -EAGAIN;
 }
 
 static int nvmet_try_send_r2t(struct nvmet_tcp_cmd *cmd, bool last_in_batch)
@@ -626,6 +712,12 @@ static int nvmet_try_send_ddgst(struct nvmet_tcp_cmd *cmd)
 	};
 	int ret;
 
+	/* The response is sent right after */
+	if (!queue->nvme_sq.sqhd_disabled)
+		msg.msg_flags |= MSG_MORE;
+	else
+		msg.msg_flags |= MSG_EOR;
+
 	ret = kernel_sendmsg(queue->sock, &msg, &iov, 1, iov.iov_len);
 	if (unlikely(ret <= 0))
 		return ret;
@@ -1446,6 +1538,27 @@ static int nvmet_tcp_set_queue_sock(struct nvmet_tcp_queue *queue)
 	return 0;
 }
 
+static int nvmet_tcp_next_io_cpu(struct nvmet_tcp_port *port)
+{
+	const struct cpumask *mask = cpu_online_mask;
+	int cpu = port->last_cpu;
+	int i;
+
+	if (cpumask_intersects(&nvmet_tcp_io_cpus, cpu_online_mask))
+		mask = &nvmet_tcp_io_cpus;
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		cpu = cpumask_next_wrap(cpu, mask, -1, false);
+		if (cpu < nr_cpu_ids && cpu_online(cpu))
+			break;
+	}
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+		cpu = cpumask_first(cpu_online_mask);
+
+	port->last_cpu = cpu;
+	return cpu;
+}
+
 static int nvmet_tcp_alloc_queue(struct nvmet_tcp_port *port,
 		struct socket *newsock)
 {
@@ -1481,9 +1594,7 @@ static int nvmet_tcp_alloc_queue(struct nvmet_tcp_port *port,
 	if (ret)
 		goto out_free_connect;
 
-	port->last_cpu = cpumask_next_wrap(port->last_cpu,
-				cpu_online_mask, -1, false);
-	queue->cpu = port->last_cpu;
+	queue->cpu = nvmet_tcp_next_io_cpu(port);
 	nvmet_prepare_receive_pdu(queue);
 
 	mutex_lock(&nvmet_tcp_queue_mutex);
@@ -22,6 +22,11 @@ static bool force_bulk;
 module_param(force_bulk, bool, 0444);
 MODULE_PARM_DESC(force_bulk, "Force use of vchiq bulk for audio");
 
+static unsigned int bulk_threshold;
+module_param(bulk_threshold, uint, 0644);
+MODULE_PARM_DESC(bulk_threshold,
+		 "Send writes of at least this many bytes as a zero-copy bulk transfer (0 = never)");
+
 static void bcm2835_audio_lock(struct bcm2835_audio_instance *instance)
 {
 	mutex_lock(&instance->vchi_mutex);
@@ -320,10 +325,10 @@ int bcm2835_audio_write(struct bcm2835_alsa_stream *alsa_stream,
 			unsigned int size, void *src)
 {
 	struct bcm2835_audio_instance *instance = alsa_stream->instance;
+	unsigned int max_packet = instance->max_packet;
 	struct vc_audio_msg m = {
 		.type = VC_AUDIO_MSG_TYPE_WRITE,
 		.write.count = size,
-		.write.max_packet = instance->max_packet,
 		.write.cookie1 = VC_AUDIO_WRITE_COOKIE1,
 		.write.cookie2 = VC_AUDIO_WRITE_COOKIE2,
 	};
@@ -333,13 +338,22 @@ int bcm2835_audio_write(struct bcm2835_alsa_stream *alsa_stream,
 	if (!size)
 		return 0;
 
+	/*
+	 * Large writes are cheaper as a bulk transfer, which lets the VPU
+	 * read the PCM buffer directly instead of copying the data through
+	 * the vchiq slots in max_packet sized messages.
+	 */
+	if (bulk_threshold && size >= bulk_threshold)
+		max_packet = 0;
+	m.write.max_packet = max_packet;
+
 	bcm2835_audio_lock(instance);
 	err = bcm2835_audio_send_msg_locked(instance, &m, false);
 	if (err < 0)
 		goto unlock;
 
 	count = size;
-	if (!instance->max_packet) {
+	if (!max_packet) {
 		/* Send the message to the videocore */
 		status = vchi_bulk_queue_transmit(instance->vchi_handle,
 						  src, count,
@@ -347,7 +361,7 @@ int bcm2835_audio_write(struct bcm2835_alsa_stream *alsa_stream,
 						  NULL);
 	} else {
 		while (count > 0) {
-			int bytes = min(instance->max_packet, count);
+			int bytes = min(max_packet, count);
 
 			status = vchi_queue_kernel_message(instance->vchi_handle,
 							   src, bytes);
@@ -20,6 +20,7 @@
 #include <linux/vmalloc.h>
 #include <linux/falloc.h>
 #include <linux/uio.h>
+#include <linux/list_sort.h>
 #include <scsi/scsi_proto.h>
 #include <asm/unaligned.h>
 
@@ -79,6 +80,8 @@ static struct se_device *fd_alloc_device(struct se_hba *hba, const char *name)
 	}
 
 	fd_dev->fd_host = fd_host;
+	spin_lock_init(&fd_dev->fd_aio_lock);
+	INIT_LIST_HEAD(&fd_dev->fd_aio_list);
 
 	pr_debug("FILEIO: Allocated fd_dev for %p\n", name);
 
@@ -241,68 +244,100 @@ struct target_core_file_cmd {
 	unsigned long	len;
 	struct se_cmd	*cmd;
 	struct kiocb	iocb;
+	struct scatterlist *sgl;
+	u32		sgl_nents;
+	loff_t		pos;
+	bool		is_write;
+	/* Entry in fd_aio_list, or in the merged list of another command */
+	struct list_head list;
+	/* Adjacent commands submitted along with this one */
+	struct list_head merged;
 };
 
 static void cmd_rw_aio_complete(struct kiocb *iocb, long ret, long ret2)
 {
-	struct target_core_file_cmd *cmd;
+	struct target_core_file_cmd *cmd, *m, *tmp;
+	u8 status;
 
 	cmd = container_of(iocb, struct target_core_file_cmd, iocb);
 
 	if (ret != cmd->len)
-		target_complete_cmd(cmd->cmd, SAM_STAT_CHECK_CONDITION);
+		status = SAM_STAT_CHECK_CONDITION;
 	else
-		target_complete_cmd(cmd->cmd, SAM_STAT_GOOD);
+		status = SAM_STAT_GOOD;
 
+	list_for_each_entry_safe(m, tmp, &cmd->merged, list) {
+		target_complete_cmd(m->cmd, status);
+		kfree(m);
+	}
+	target_complete_cmd(cmd->cmd, status);
 	kfree(cmd);
 }
 
-static sense_reason_t
-fd_execute_rw_aio(struct se_cmd *cmd, struct scatterlist *sgl, u32 sgl_nents,
-	      enum dma_data_direction data_direction)
+static int fd_aio_cmp(void *priv, struct list_head *a, struct list_head *b)
 {
-	int is_write = !(data_direction == DMA_FROM_DEVICE);
-	struct se_device *dev = cmd->se_dev;
-	struct fd_dev *fd_dev = FD_DEV(dev);
-	struct file *file = fd_dev->fd_file;
-	struct target_core_file_cmd *aio_cmd;
-	struct iov_iter iter = {};
-	struct scatterlist *sg;
-	struct bio_vec *bvec;
-	ssize_t len = 0;
-	int ret = 0, i;
+	struct target_core_file_cmd *ca, *cb;
 
-	aio_cmd = kmalloc(sizeof(struct target_core_file_cmd), GFP_KERNEL);
-	if (!aio_cmd)
-		return TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
+	ca = list_entry(a, struct target_core_file_cmd, list);
+	cb = list_entry(b, struct target_core_file_cmd, list);
 
-	bvec = kcalloc(sgl_nents, sizeof(struct bio_vec), GFP_KERNEL);
-	if (!bvec) {
-		kfree(aio_cmd);
-		return TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
-	}
+	if (ca->is_write != cb->is_write)
+		return ca->is_write - cb->is_write;
+	if (ca->pos != cb->pos)
+		return ca->pos < cb->pos ? -1 : 1;
+	return 0;
+}
 
-	for_each_sg(sgl, sg, sgl_nents, i) {
+static int fd_aio_fill_bvec(struct bio_vec *bvec,
+			    struct target_core_file_cmd *aio_cmd)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(aio_cmd->sgl, sg, aio_cmd->sgl_nents, i) {
 		bvec[i].bv_page = sg_page(sg);
 		bvec[i].bv_len = sg->length;
 		bvec[i].bv_offset = sg->offset;
+	}
 
-		len += sg->length;
+	return aio_cmd->sgl_nents;
+}
+
+/*
+ * Submits @aio_cmd along with the commands merged into it as a single
+ * kiocb. Their status is the status of the whole I/O.
+ */
+static void fd_aio_submit_one(struct fd_dev *fd_dev,
+			      struct target_core_file_cmd *aio_cmd,
+			      u32 nents, bool fua)
+{
+	struct file *file = fd_dev->fd_file;
+	struct target_core_file_cmd *m;
+	struct iov_iter iter = {};
+	struct bio_vec *bvec;
+	int ret = 0, i;
+
+	bvec = kcalloc(nents, sizeof(struct bio_vec), GFP_KERNEL);
+	if (!bvec) {
+		cmd_rw_aio_complete(&aio_cmd->iocb, -ENOMEM, 0);
+		return;
 	}
 
-	iov_iter_bvec(&iter, is_write, bvec, sgl_nents, len);
+	i = fd_aio_fill_bvec(bvec, aio_cmd);
+	list_for_each_entry(m, &aio_cmd->merged, list)
+		i += fd_aio_fill_bvec(bvec + i, m);
 
-	aio_cmd->cmd = cmd;
-	aio_cmd->len = len;
-	aio_cmd->iocb.ki_pos = cmd->t_task_lba * dev->dev_attrib.block_size;
+	iov_iter_bvec(&iter, aio_cmd->is_write, bvec, nents, aio_cmd->len);
+
+	aio_cmd->iocb.ki_pos = aio_cmd->pos;
 	aio_cmd->iocb.ki_filp = file;
 	aio_cmd->iocb.ki_complete = cmd_rw_aio_complete;
 	aio_cmd->iocb.ki_flags = IOCB_DIRECT;
 
-	if (is_write && (cmd->se_cmd_flags & SCF_FUA))
+	if (fua)
 		aio_cmd->iocb.ki_flags |= IOCB_DSYNC;
 
-	if (is_write)
+	if (aio_cmd->is_write)
 		ret = call_write_iter(file, &aio_cmd->iocb, &iter);
 	else
 		ret = call_read_iter(file, &aio_cmd->iocb, &iter);
@@ -311,13 +346,118 @@ fd_execute_rw_aio(struct se_cmd *cmd, struct scatterlist *sgl, u32 sgl_nents,
 
 	if (ret != -EIOCBQUEUED)
 		cmd_rw_aio_complete(&aio_cmd->iocb, ret, 0);
+}
 
+static bool fd_aio_is_fua(struct target_core_file_cmd *aio_cmd)
+{
+	return aio_cmd->is_write && (aio_cmd->cmd->se_cmd_flags & SCF_FUA);
+}
+
+/*
+ * Sorts the commands by direction and offset, and submits each run of
+ * adjacent commands going the same way as one I/O.
+ */
+static void fd_aio_submit_list(struct fd_dev *fd_dev, struct list_head *list)
+{
+	struct target_core_file_cmd *aio_cmd, *next, *tmp;
+	u32 nents;
+	bool fua;
+
+	list_sort(NULL, list, fd_aio_cmp);
+
+	while (!list_empty(list)) {
+		aio_cmd = list_first_entry(list, struct target_core_file_cmd,
+					   list);
+		list_del_init(&aio_cmd->list);
+		nents = aio_cmd->sgl_nents;
+		fua = fd_aio_is_fua(aio_cmd);
+
+		list_for_each_entry_safe(next, tmp, list, list) {
+			if (next->is_write != aio_cmd->is_write ||
+			    next->pos != aio_cmd->pos + aio_cmd->len ||
+			    fd_aio_is_fua(next) != fua ||
+			    aio_cmd->len + next->len > FD_MAX_BYTES)
+				break;
+
+			list_move_tail(&next->list, &aio_cmd->merged);
+			aio_cmd->len += next->len;
+			nents += next->sgl_nents;
+		}
+
+		fd_aio_submit_one(fd_dev, aio_cmd, nents, fua);
+	}
+}
+
+/*
+ * Commands are queued on fd_aio_list and submitted by whoever finds no
+ * submission running, along with the commands queued by others meanwhile.
+ * Submissions are plugged, and adjacent commands are merged.
+ */
+static void fd_aio_submit(struct fd_dev *fd_dev)
+{
+	struct blk_plug plug;
+	LIST_HEAD(list);
+
+	spin_lock(&fd_dev->fd_aio_lock);
+	if (fd_dev->fd_aio_running) {
+		spin_unlock(&fd_dev->fd_aio_lock);
+		return;
+	}
+	fd_dev->fd_aio_running = true;
+
+	while (!list_empty(&fd_dev->fd_aio_list)) {
+		list_splice_init(&fd_dev->fd_aio_list, &list);
+		spin_unlock(&fd_dev->fd_aio_lock);
+
+		blk_start_plug(&plug);
+		fd_aio_submit_list(fd_dev, &list);
+		blk_finish_plug(&plug);
+
+		spin_lock(&fd_dev->fd_aio_lock);
+	}
+
+	fd_dev->fd_aio_running = false;
+	spin_unlock(&fd_dev->fd_aio_lock);
+}
+
+static sense_reason_t
+fd_execute_rw_aio(struct se_cmd *cmd, struct scatterlist *sgl, u32 sgl_nents,
+	      enum dma_data_direction data_direction)
+{
+	struct se_device *dev = cmd->se_dev;
+	struct fd_dev *fd_dev = FD_DEV(dev);
+	struct target_core_file_cmd *aio_cmd;
+	struct scatterlist *sg;
+	ssize_t len = 0;
+	int i;
+
+	aio_cmd = kmalloc(sizeof(struct target_core_file_cmd), GFP_KERNEL);
+	if (!aio_cmd)
+		return TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
+
+	for_each_sg(sgl, sg, sgl_nents, i)
+		len += sg->length;
+
+	aio_cmd->cmd = cmd;
+	aio_cmd->sgl = sgl;
+	aio_cmd->sgl_nents = sgl_nents;
+	aio_cmd->len = len;
+	aio_cmd->pos = cmd->t_task_lba * dev->dev_attrib.block_size;
+	aio_cmd->is_write = !(data_direction == DMA_FROM_DEVICE);
+	INIT_LIST_HEAD(&aio_cmd->merged);
+
+	spin_lock(&fd_dev->fd_aio_lock);
+	list_add_tail(&aio_cmd->list, &fd_dev->fd_aio_list);
+	spin_unlock(&fd_dev->fd_aio_lock);
+
+	fd_aio_submit(fd_dev);
 	return 0;
 }
 
 static int fd_do_rw(struct se_cmd *cmd, struct file *fd,
 		    u32 block_size, struct scatterlist *sgl,
-		    u32 sgl_nents, u32 data_length, int is_write)
+		    u32 sgl_nents, u32 data_length, int is_write,
+		    rwf_t flags)
 {
 	struct scatterlist *sg;
 	struct iov_iter iter;
@@ -342,9 +482,9 @@ static int fd_do_rw(struct se_cmd *cmd, struct file *fd,
 
 	iov_iter_bvec(&iter, READ, bvec, sgl_nents, len);
 	if (is_write)
-		ret = vfs_iter_write(fd, &iter, &pos, 0);
+		ret = vfs_iter_write(fd, &iter, &pos, flags);
 	else
-		ret = vfs_iter_read(fd, &iter, &pos, 0);
+		ret = vfs_iter_read(fd, &iter, &pos, flags);
 
 	if (is_write) {
 		if (ret < 0 || ret != data_length) {
@@ -609,13 +749,13 @@ fd_execute_rw_buffered(struct se_cmd *cmd, struct scatterlist *sgl, u32 sgl_nent
 		if (cmd->prot_type && dev->dev_attrib.pi_prot_type) {
 			ret = fd_do_rw(cmd, pfile, dev->prot_length,
 				       cmd->t_prot_sg, cmd->t_prot_nents,
-				       cmd->prot_length, 0);
+				       cmd->prot_length, 0, 0);
 			if (ret < 0)
 				return TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
 		}
 
 		ret = fd_do_rw(cmd, file, dev->dev_attrib.block_size,
-			       sgl, sgl_nents, cmd->data_length, 0);
+			       sgl, sgl_nents, cmd->data_length, 0, 0);
 
 		if (ret > 0 && cmd->prot_type && dev->dev_attrib.pi_prot_type &&
 		    dev->dev_attrib.pi_prot_verify) {
@@ -639,30 +779,19 @@ fd_execute_rw_buffered(struct se_cmd *cmd, struct scatterlist *sgl, u32 sgl_nent
 				return rc;
 		}
 
-		ret = fd_do_rw(cmd, file, dev->dev_attrib.block_size,
-			       sgl, sgl_nents, cmd->data_length, 1);
 		/*
-		 * Perform implicit vfs_fsync_range() for fd_do_writev() ops
-		 * for SCSI WRITEs with Forced Unit Access (FUA) set.
-		 * Allow this to happen independent of WCE=0 setting.
+		 * Write with RWF_DSYNC for SCSI WRITEs with Forced Unit
+		 * Access (FUA) set, which syncs the written range as part of
+		 * the write. Allow this to happen independent of WCE=0 setting.
 		 */
-		if (ret > 0 && (cmd->se_cmd_flags & SCF_FUA)) {
-			loff_t start = cmd->t_task_lba *
-				dev->dev_attrib.block_size;
-			loff_t end;
-
-			if (cmd->data_length)
-				end = start + cmd->data_length - 1;
-			else
-				end = LLONG_MAX;
-
-			vfs_fsync_range(fd_dev->fd_file, start, end, 1);
-		}
+		ret = fd_do_rw(cmd, file, dev->dev_attrib.block_size,
+			       sgl, sgl_nents, cmd->data_length, 1,
+			       (cmd->se_cmd_flags & SCF_FUA) ? RWF_DSYNC : 0);
 
 		if (ret > 0 && cmd->prot_type && dev->dev_attrib.pi_prot_type) {
 			ret = fd_do_rw(cmd, pfile, dev->prot_length,
 				       cmd->t_prot_sg, cmd->t_prot_nents,
-				       cmd->prot_length, 1);
+				       cmd->prot_length, 1, 0);
 			if (ret < 0)
 				return TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
 		}
@@ -908,6 +1037,65 @@ static void fd_free_prot(struct se_device *dev)
 	fd_dev->fd_prot_file = NULL;
 }
 
+/*
+ * EXTENDED COPY between two FILEIO devices: let the filesystem share the
+ * extents or splice the data between the page caches, instead of bouncing
+ * it through the XCOPY READ/WRITE pass-through commands.
+ */
+static int fd_xcopy_range(struct se_device *src_dev, sector_t src_lba,
+			  struct se_device *dst_dev, sector_t dst_lba, u32 nolb)
+{
+	struct fd_dev *src = FD_DEV(src_dev);
+	struct fd_dev *dst = FD_DEV(dst_dev);
+	u32 block_size = dst_dev->dev_attrib.block_size;
+	loff_t pos_in = src_lba * block_size;
+	loff_t pos_out = dst_lba * block_size;
+	size_t len = (size_t)nolb * block_size;
+	loff_t start = pos_out;
+	ssize_t ret;
+
+	/* The protection information would have to be copied as well */
+	if (src_dev->dev_attrib.pi_prot_type ||
+	    dst_dev->dev_attrib.pi_prot_type)
+		return -EOPNOTSUPP;
+
+	while (len) {
+		ret = vfs_copy_file_range(src->fd_file, pos_in, dst->fd_file,
+					  pos_out, len, 0);
+		if (ret < 0) {
+			/*
+			 * Block device backed files and file systems refusing
+			 * the copy fall back to the bounce buffer, as long as
+			 * nothing has been written yet.
+			 */
+			if (pos_out == start &&
+			    (ret == -EINVAL || ret == -EXDEV ||
+			     ret == -EOPNOTSUPP))
+				return -EOPNOTSUPP;
+			pr_err("FILEIO: vfs_copy_file_range() failed: %zd\n",
+			       ret);
+			return ret;
+		}
+		if (!ret) {
+			pr_err("FILEIO: short copy at %lld, %zu bytes left\n",
+			       pos_in, len);
+			return -EIO;
+		}
+		pos_in += ret;
+		pos_out += ret;
+		len -= ret;
+	}
+
+	/*
+	 * Extents shared by the file system are not written through the
+	 * O_DSYNC file, so make them stable like any other WRITE.
+	 */
+	if (!(dst->fbd_flags & FDBD_HAS_BUFFERED_IO_WCE))
+		return vfs_fsync_range(dst->fd_file, start, pos_out - 1, 1);
+
+	return 0;
+}
+
 static struct sbc_ops fd_sbc_ops = {
 	.execute_rw		= fd_execute_rw,
 	.execute_sync_cache	= fd_execute_sync_cache,
@@ -940,6 +1128,7 @@ static const struct target_backend_ops fileio_ops = {
 	.init_prot		= fd_init_prot,
 	.format_prot		= fd_format_prot,
 	.free_prot		= fd_free_prot,
+	.xcopy_range		= fd_xcopy_range,
 	.tb_dev_attrib_attrs	= sbc_attrib_attrs,
 };
 
@@ -39,6 +39,10 @@ struct fd_dev {
 	unsigned long long fd_dev_size;
 	struct file	*fd_file;
 	struct file	*fd_prot_file;
+	/* Async I/O commands waiting for submission */
+	spinlock_t	fd_aio_lock;
+	struct list_head fd_aio_list;
+	bool		fd_aio_running;
 	/* FILEIO HBA device is connected to */
 	struct fd_host *fd_host;
 } ____cacheline_aligned;
@@ -22,6 +22,7 @@
 #include <linux/genhd.h>
 #include <linux/file.h>
 #include <linux/module.h>
+#include <linux/scatterlist.h>
 #include <scsi/scsi_proto.h>
 #include <asm/unaligned.h>
 
@@ -32,6 +33,7 @@
 
 #define IBLOCK_MAX_BIO_PER_TASK	 32	/* max # of bios to submit at a time */
 #define IBLOCK_BIO_POOL_SIZE	128
+#define IBLOCK_XCOPY_CHUNK	(4 * 1024 * 1024)	/* bytes per XCOPY pass */
 
 static inline struct iblock_dev *IBLOCK_DEV(struct se_device *dev)
 {
@@ -857,6 +859,91 @@ static bool iblock_get_write_cache(struct se_device *dev)
 	return test_bit(QUEUE_FLAG_WC, &q->queue_flags);
 }
 
+/*
+ * Read or write len bytes at sector from/to the pages of sgl, chaining as
+ * many bios as needed and waiting for all of them.
+ */
+static int iblock_xcopy_rw(struct iblock_dev *ib_dev, sector_t sector,
+			   struct scatterlist *sgl, u32 len, int op)
+{
+	struct scatterlist *sg;
+	struct bio *bio = NULL, *new;
+	unsigned int n;
+
+	for (sg = sgl; len; sg = sg_next(sg)) {
+		n = min(sg->length, len);
+
+		if (!bio || bio_add_page(bio, sg_page(sg), n, sg->offset) != n) {
+			new = bio_alloc_bioset(GFP_NOIO, BIO_MAX_PAGES,
+					       &ib_dev->ibd_bio_set);
+			bio_set_dev(new, ib_dev->ibd_bd);
+			new->bi_iter.bi_sector = sector;
+			bio_set_op_attrs(new, op, 0);
+			if (bio) {
+				bio_chain(bio, new);
+				submit_bio(bio);
+			}
+			bio = new;
+			bio_add_page(bio, sg_page(sg), n, sg->offset);
+		}
+
+		sector += n >> SECTOR_SHIFT;
+		len -= n;
+	}
+
+	return submit_bio_wait(bio);
+}
+
+/*
+ * EXTENDED COPY between two IBLOCK devices: move the data with bios issued
+ * straight to the block devices, instead of going through READ and WRITE
+ * pass-through commands and the target core for every chunk.
+ */
+static int iblock_xcopy_range(struct se_device *src_dev, sector_t src_lba,
+			      struct se_device *dst_dev, sector_t dst_lba,
+			      u32 nolb)
+{
+	struct iblock_dev *src = IBLOCK_DEV(src_dev);
+	struct iblock_dev *dst = IBLOCK_DEV(dst_dev);
+	u32 block_size = dst_dev->dev_attrib.block_size;
+	sector_t src_sector, dst_sector;
+	u64 len = (u64)nolb * block_size;
+	struct scatterlist *sgl;
+	unsigned int nents;
+	u32 cur;
+	int ret = 0;
+
+	if (dst->ibd_readonly || src_dev->dev_attrib.pi_prot_type ||
+	    dst_dev->dev_attrib.pi_prot_type)
+		return -EOPNOTSUPP;
+
+	sgl = sgl_alloc(min_t(u64, len, IBLOCK_XCOPY_CHUNK), GFP_KERNEL,
+			&nents);
+	if (!sgl)
+		return -ENOMEM;
+
+	src_sector = src_lba << (ilog2(block_size) - SECTOR_SHIFT);
+	dst_sector = dst_lba << (ilog2(block_size) - SECTOR_SHIFT);
+
+	while (len) {
+		cur = min_t(u64, len, IBLOCK_XCOPY_CHUNK);
+
+		ret = iblock_xcopy_rw(src, src_sector, sgl, cur, REQ_OP_READ);
+		if (ret)
+			break;
+		ret = iblock_xcopy_rw(dst, dst_sector, sgl, cur, REQ_OP_WRITE);
+		if (ret)
+			break;
+
+		src_sector += cur >> SECTOR_SHIFT;
+		dst_sector += cur >> SECTOR_SHIFT;
+		len -= cur;
+	}
+
+	sgl_free(sgl);
+	return ret;
+}
+
 static const struct target_backend_ops iblock_ops = {
 	.name			= "iblock",
 	.inquiry_prod		= "IBLOCK",
@@ -878,6 +965,7 @@ static const struct target_backend_ops iblock_ops = {
 	.get_io_min		= iblock_get_io_min,
 	.get_io_opt		= iblock_get_io_opt,
 	.get_write_cache	= iblock_get_write_cache,
+	.xcopy_range		= iblock_xcopy_range,
 	.tb_dev_attrib_attrs	= sbc_attrib_attrs,
 };
 
@@ -309,6 +309,47 @@ static ssize_t target_stat_lu_write_mbytes_show(struct config_item *item,
 			atomic_long_read(&dev->write_bytes) >> 20);
 }
 
+/*
+ * EXTENDED COPY statistics, not part of the SCSI MIB: bytes written to this
+ * device by XCOPY, READ + WRITE chunks bounced through the target core,
+ * copies done by the backend directly and the time spent copying.
+ */
+static ssize_t target_stat_lu_xcopy_mbytes_show(struct config_item *item,
+		char *page)
+{
+	struct se_device *dev = to_stat_lu_dev(item);
+
+	return snprintf(page, PAGE_SIZE, "%lu\n",
+			atomic_long_read(&dev->xcopy_bytes) >> 20);
+}
+
+static ssize_t target_stat_lu_xcopy_chunks_show(struct config_item *item,
+		char *page)
+{
+	struct se_device *dev = to_stat_lu_dev(item);
+
+	return snprintf(page, PAGE_SIZE, "%lu\n",
+			atomic_long_read(&dev->xcopy_chunks));
+}
+
+static ssize_t target_stat_lu_xcopy_offloads_show(struct config_item *item,
+		char *page)
+{
+	struct se_device *dev = to_stat_lu_dev(item);
+
+	return snprintf(page, PAGE_SIZE, "%lu\n",
+			atomic_long_read(&dev->xcopy_offloads));
+}
+
+static ssize_t target_stat_lu_xcopy_usecs_show(struct config_item *item,
+		char *page)
+{
+	struct se_device *dev = to_stat_lu_dev(item);
+
+	return snprintf(page, PAGE_SIZE, "%lu\n",
+			atomic_long_read(&dev->xcopy_usecs));
+}
+
 static ssize_t target_stat_lu_resets_show(struct config_item *item, char *page)
 {
 	struct se_device *dev = to_stat_lu_dev(item);
@@ -356,6 +397,10 @@ CONFIGFS_ATTR_RO(target_stat_lu_, state_bit);
 CONFIGFS_ATTR_RO(target_stat_lu_, num_cmds);
 CONFIGFS_ATTR_RO(target_stat_lu_, read_mbytes);
 CONFIGFS_ATTR_RO(target_stat_lu_, write_mbytes);
+CONFIGFS_ATTR_RO(target_stat_lu_, xcopy_mbytes);
+CONFIGFS_ATTR_RO(target_stat_lu_, xcopy_chunks);
+CONFIGFS_ATTR_RO(target_stat_lu_, xcopy_offloads);
+CONFIGFS_ATTR_RO(target_stat_lu_, xcopy_usecs);
 CONFIGFS_ATTR_RO(target_stat_lu_, resets);
 CONFIGFS_ATTR_RO(target_stat_lu_, full_stat);
 CONFIGFS_ATTR_RO(target_stat_lu_, hs_num_cmds);
@@ -376,6 +421,10 @@ static struct configfs_attribute *target_stat_scsi_lu_attrs[] = {
 	&target_stat_lu_attr_num_cmds,
 	&target_stat_lu_attr_read_mbytes,
 	&target_stat_lu_attr_write_mbytes,
+	&target_stat_lu_attr_xcopy_mbytes,
+	&target_stat_lu_attr_xcopy_chunks,
+	&target_stat_lu_attr_xcopy_offloads,
+	&target_stat_lu_attr_xcopy_usecs,
 	&target_stat_lu_attr_resets,
 	&target_stat_lu_attr_full_stat,
 	&target_stat_lu_attr_hs_num_cmds,
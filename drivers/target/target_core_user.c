@@ -143,6 +143,15 @@ struct tcmu_dev {
 	unsigned long *data_bitmap;
 	struct radix_tree_root data_blocks;
 
+	/*
+	 * Pages of zero copy commands, standing in for the data blocks'
+	 * own pages until the commands complete. Pages of write commands
+	 * are tagged TCMU_ZC_READONLY, userspace must not modify them.
+	 */
+#define TCMU_ZC_READONLY 0
+	struct radix_tree_root zc_blocks;
+	u32 zero_copy_min_kb;
+
 	struct idr commands;
 
 	struct timer_list cmd_timer;
@@ -182,6 +191,7 @@ struct tcmu_cmd {
 
 #define TCMU_CMD_BIT_EXPIRED 0
 #define TCMU_CMD_BIT_INFLIGHT 1
+#define TCMU_CMD_BIT_ZERO_COPY 2
 	unsigned long flags;
 };
 /*
@@ -540,6 +550,109 @@ tcmu_get_block_page(struct tcmu_dev *udev, uint32_t dbi)
 	return radix_tree_lookup(&udev->data_blocks, dbi);
 }
 
+static inline struct page *
+tcmu_get_user_page(struct tcmu_dev *udev, uint32_t dbi)
+{
+	struct page *page;
+
+	page = radix_tree_lookup(&udev->zc_blocks, dbi);
+	if (page)
+		return page;
+	return tcmu_get_block_page(udev, dbi);
+}
+
+/* Zap the user mappings of the data blocks of a command */
+static void tcmu_cmd_unmap_user(struct tcmu_dev *udev,
+				struct tcmu_cmd *tcmu_cmd)
+{
+	uint32_t i, start, n;
+
+	if (!udev->inode)
+		return;
+
+	for (i = 0; i < tcmu_cmd->dbi_cnt; i += n) {
+		start = tcmu_cmd->dbi[i];
+		for (n = 1; i + n < tcmu_cmd->dbi_cnt; n++)
+			if (tcmu_cmd->dbi[i + n] != start + n)
+				break;
+
+		unmap_mapping_range(udev->inode->i_mapping,
+				    udev->data_off + start * DATA_BLOCK_SIZE,
+				    n * DATA_BLOCK_SIZE, 1);
+	}
+}
+
+/*
+ * A command is zero copy if its data buffer is made of whole pages that
+ * target core allocated itself. Those pages are mapped in place of the
+ * command's data blocks, so userspace accesses them directly and nothing is
+ * copied in or out of the data area. This costs zapping the user mappings
+ * of the blocks twice per command, so it's only done for commands of at
+ * least zero_copy_min_kb.
+ */
+static bool tcmu_cmd_zc_map(struct tcmu_dev *udev, struct tcmu_cmd *tcmu_cmd)
+{
+	struct se_cmd *se_cmd = tcmu_cmd->se_cmd;
+	struct scatterlist *sg;
+	int i;
+
+	if (!udev->zero_copy_min_kb ||
+	    se_cmd->data_length < udev->zero_copy_min_kb * 1024 ||
+	    se_cmd->se_cmd_flags & (SCF_BIDI |
+				    SCF_PASSTHROUGH_SG_TO_MEM_NOALLOC) ||
+	    se_cmd->data_direction == DMA_NONE ||
+	    se_cmd->t_data_nents != tcmu_cmd->dbi_cnt)
+		return false;
+
+	for_each_sg(se_cmd->t_data_sg, sg, se_cmd->t_data_nents, i) {
+		if (sg->offset || sg->length != DATA_BLOCK_SIZE)
+			return false;
+		/* User or page cache pages must not end up in our VMA */
+		if (PageAnon(sg_page(sg)) || page_mapping(sg_page(sg)))
+			return false;
+	}
+
+	for_each_sg(se_cmd->t_data_sg, sg, se_cmd->t_data_nents, i) {
+		if (radix_tree_insert(&udev->zc_blocks, tcmu_cmd->dbi[i],
+				      sg_page(sg))) {
+			while (i--)
+				radix_tree_delete(&udev->zc_blocks,
+						  tcmu_cmd->dbi[i]);
+			return false;
+		}
+		if (se_cmd->data_direction == DMA_TO_DEVICE)
+			radix_tree_tag_set(&udev->zc_blocks, tcmu_cmd->dbi[i],
+					   TCMU_ZC_READONLY);
+	}
+
+	/* Userspace may still map the blocks' own pages */
+	tcmu_cmd_unmap_user(udev, tcmu_cmd);
+	set_bit(TCMU_CMD_BIT_ZERO_COPY, &tcmu_cmd->flags);
+	return true;
+}
+
+/*
+ * Returns the command's pages to the kernel once userspace is done with
+ * them or the command is completed without it. Returns whether the
+ * command was zero copy.
+ */
+static bool tcmu_cmd_zc_unmap(struct tcmu_dev *udev, struct tcmu_cmd *tcmu_cmd)
+{
+	struct page *page;
+	uint32_t i;
+
+	if (!test_and_clear_bit(TCMU_CMD_BIT_ZERO_COPY, &tcmu_cmd->flags))
+		return false;
+
+	tcmu_cmd_unmap_user(udev, tcmu_cmd);
+	for (i = 0; i < tcmu_cmd->dbi_cnt; i++) {
+		page = radix_tree_delete(&udev->zc_blocks, tcmu_cmd->dbi[i]);
+		if (page)
+			flush_dcache_page(page);
+	}
+	return true;
+}
+
 static inline void tcmu_free_cmd(struct tcmu_cmd *tcmu_cmd)
 {
 	kfree(tcmu_cmd->dbi);
@@ -962,7 +1075,7 @@ static int queue_cmd_ring(struct tcmu_cmd *tcmu_cmd, sense_reason_t *scsi_err)
 	int iov_cnt, ret;
 	uint32_t cmd_head;
 	uint64_t cdb_off;
-	bool copy_to_data_area;
+	bool copy_to_data_area, zero_copy;
 	size_t data_length = tcmu_cmd_get_data_length(tcmu_cmd);
 
 	*scsi_err = TCM_NO_SENSE;
@@ -1043,8 +1156,10 @@ static int queue_cmd_ring(struct tcmu_cmd *tcmu_cmd, sense_reason_t *scsi_err)
 	tcmu_cmd_reset_dbi_cur(tcmu_cmd);
 	iov = &entry->req.iov[0];
 	iov_cnt = 0;
-	copy_to_data_area = (se_cmd->data_direction == DMA_TO_DEVICE
-		|| se_cmd->se_cmd_flags & SCF_BIDI);
+	zero_copy = tcmu_cmd_zc_map(udev, tcmu_cmd);
+	copy_to_data_area = !zero_copy &&
+		(se_cmd->data_direction == DMA_TO_DEVICE ||
+		 se_cmd->se_cmd_flags & SCF_BIDI);
 	scatter_data_area(udev, tcmu_cmd, se_cmd->t_data_sg,
 			  se_cmd->t_data_nents, &iov, &iov_cnt,
 			  copy_to_data_area);
@@ -1063,6 +1178,7 @@ static int queue_cmd_ring(struct tcmu_cmd *tcmu_cmd, sense_reason_t *scsi_err)
 	ret = tcmu_setup_cmd_timer(tcmu_cmd, udev->cmd_time_out,
 				   &udev->cmd_timer);
 	if (ret) {
+		tcmu_cmd_zc_unmap(udev, tcmu_cmd);
 		tcmu_cmd_free_data(tcmu_cmd, tcmu_cmd->dbi_cnt);
 
 		*scsi_err = TCM_OUT_OF_RESOURCES;
@@ -1132,6 +1248,7 @@ static void tcmu_handle_completion(struct tcmu_cmd *cmd, struct tcmu_cmd_entry *
 	struct se_cmd *se_cmd = cmd->se_cmd;
 	struct tcmu_dev *udev = cmd->tcmu_dev;
 	bool read_len_valid = false;
+	bool zero_copy;
 	uint32_t read_len;
 
 	/*
@@ -1146,6 +1263,7 @@ static void tcmu_handle_completion(struct tcmu_cmd *cmd, struct tcmu_cmd_entry *
 	list_del_init(&cmd->queue_entry);
 
 	tcmu_cmd_reset_dbi_cur(cmd);
+	zero_copy = tcmu_cmd_zc_unmap(udev, cmd);
 
 	if (entry->hdr.uflags & TCMU_UFLAG_UNKNOWN_OP) {
 		pr_warn("TCMU: Userspace set UNKNOWN_OP flag on se_cmd %p\n",
@@ -1169,7 +1287,9 @@ static void tcmu_handle_completion(struct tcmu_cmd *cmd, struct tcmu_cmd_entry *
 		else
 			se_cmd->se_cmd_flags |= SCF_TREAT_READ_AS_NORMAL;
 	}
-	if (se_cmd->se_cmd_flags & SCF_BIDI) {
+	if (zero_copy) {
+		/* The data is already in the command's pages */
+	} else if (se_cmd->se_cmd_flags & SCF_BIDI) {
 		/* Get Data-In buffer before clean up */
 		gather_data_area(udev, cmd, true, read_len);
 	} else if (se_cmd->data_direction == DMA_FROM_DEVICE) {
@@ -1305,6 +1425,7 @@ static int tcmu_check_expired_cmd(int id, void *p, void *data)
 			return 0;
 
 		set_bit(TCMU_CMD_BIT_EXPIRED, &cmd->flags);
+		tcmu_cmd_zc_unmap(udev, cmd);
 		/*
 		 * target_complete_cmd will translate this to LUN COMM FAILURE
 		 */
@@ -1403,6 +1524,7 @@ static struct se_device *tcmu_alloc_device(struct se_hba *hba, const char *name)
 	timer_setup(&udev->cmd_timer, tcmu_cmd_timedout, 0);
 
 	INIT_RADIX_TREE(&udev->data_blocks, GFP_KERNEL);
+	INIT_RADIX_TREE(&udev->zc_blocks, GFP_KERNEL);
 
 	return &udev->se_dev;
 }
@@ -1504,12 +1626,11 @@ static struct page *tcmu_try_get_block_page(struct tcmu_dev *udev, uint32_t dbi)
 {
 	struct page *page;
 
-	mutex_lock(&udev->cmdr_lock);
-	page = tcmu_get_block_page(udev, dbi);
-	if (likely(page)) {
-		mutex_unlock(&udev->cmdr_lock);
+	lockdep_assert_held(&udev->cmdr_lock);
+
+	page = tcmu_get_user_page(udev, dbi);
+	if (likely(page))
 		return page;
-	}
 
 	/*
 	 * Userspace messed up and passed in a address not in the
@@ -1517,10 +1638,7 @@ static struct page *tcmu_try_get_block_page(struct tcmu_dev *udev, uint32_t dbi)
 	 */
 	pr_err("Invalid addr to data block mapping  (dbi %u) on device %s\n",
 	       dbi, udev->name);
-	page = NULL;
-	mutex_unlock(&udev->cmdr_lock);
-
-	return page;
+	return NULL;
 }
 
 static vm_fault_t tcmu_vma_fault(struct vm_fault *vmf)
@@ -1546,13 +1664,23 @@ static vm_fault_t tcmu_vma_fault(struct vm_fault *vmf)
 		addr = (void *)(unsigned long)info->mem[mi].addr + offset;
 		page = vmalloc_to_page(addr);
 	} else {
+		vm_fault_t ret = VM_FAULT_SIGBUS;
 		uint32_t dbi;
 
 		/* For the dynamically growing data area pages */
 		dbi = (offset - udev->data_off) / DATA_BLOCK_SIZE;
+
+		/*
+		 * Zero copy switches the page behind a block and zaps its
+		 * mappings under cmdr_lock. Install the PTE under the same
+		 * lock, so that it can't map a page the zap already missed.
+		 */
+		mutex_lock(&udev->cmdr_lock);
 		page = tcmu_try_get_block_page(udev, dbi);
-		if (!page)
-			return VM_FAULT_SIGBUS;
+		if (page)
+			ret = vmf_insert_page(vmf->vma, vmf->address, page);
+		mutex_unlock(&udev->cmdr_lock);
+		return ret;
 	}
 
 	get_page(page);
@@ -1560,15 +1688,55 @@ static vm_fault_t tcmu_vma_fault(struct vm_fault *vmf)
 	return 0;
 }
 
+/*
+ * Having ->page_mkwrite makes the core map the pages read-only first, so
+ * writes to the pages of zero copy write commands can be refused here.
+ */
+static vm_fault_t tcmu_vma_page_mkwrite(struct vm_fault *vmf)
+{
+	struct tcmu_dev *udev = vmf->vma->vm_private_data;
+	struct page *page = vmf->page;
+	unsigned long offset;
+	bool readonly = false;
+	uint32_t dbi;
+
+	int mi = tcmu_find_mem_index(vmf->vma);
+	if (mi < 0)
+		return VM_FAULT_SIGBUS;
+
+	offset = (vmf->pgoff - mi) << PAGE_SHIFT;
+	if (offset >= udev->data_off) {
+		dbi = (offset - udev->data_off) / DATA_BLOCK_SIZE;
+
+		/* If the page was switched meanwhile, the fault is retried */
+		mutex_lock(&udev->cmdr_lock);
+		readonly = radix_tree_lookup(&udev->zc_blocks, dbi) == page &&
+			   radix_tree_tag_get(&udev->zc_blocks, dbi,
+					      TCMU_ZC_READONLY);
+		mutex_unlock(&udev->cmdr_lock);
+	}
+	if (readonly)
+		return VM_FAULT_SIGBUS;
+
+	/*
+	 * Our pages have no mapping: if the core had to lock the page, it
+	 * would take that for a truncation and retry the fault forever.
+	 */
+	lock_page(page);
+	return VM_FAULT_LOCKED;
+}
+
 static const struct vm_operations_struct tcmu_vm_ops = {
 	.fault = tcmu_vma_fault,
+	.page_mkwrite = tcmu_vma_page_mkwrite,
 };
 
 static int tcmu_mmap(struct uio_info *info, struct vm_area_struct *vma)
 {
 	struct tcmu_dev *udev = container_of(info, struct tcmu_dev, uio_info);
 
-	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	/* VM_MIXEDMAP for the data area pages installed by the fault handler */
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP | VM_MIXEDMAP;
 	vma->vm_ops = &tcmu_vm_ops;
 
 	vma->vm_private_data = udev;
@@ -1656,6 +1824,9 @@ static void tcmu_dev_kref_release(struct kref *kref)
 	WARN_ON(!all_expired);
 
 	tcmu_blocks_release(&udev->data_blocks, 0, udev->dbi_max + 1);
+	/* Zero copy pages belong to their commands, only drop the entries */
+	for (i = 0; i <= udev->dbi_max; i++)
+		radix_tree_delete(&udev->zc_blocks, i);
 	bitmap_free(udev->data_bitmap);
 	mutex_unlock(&udev->cmdr_lock);
 
@@ -2025,6 +2196,7 @@ static void tcmu_reset_ring(struct tcmu_dev *udev, u8 err_level)
 			  test_bit(TCMU_CMD_BIT_EXPIRED, &cmd->flags));
 
 		idr_remove(&udev->commands, i);
+		tcmu_cmd_zc_unmap(udev, cmd);
 		if (!test_bit(TCMU_CMD_BIT_EXPIRED, &cmd->flags)) {
 			WARN_ON(!cmd->se_cmd);
 			list_del_init(&cmd->queue_entry);
@@ -2445,6 +2617,36 @@ static ssize_t tcmu_nl_reply_supported_store(struct config_item *item,
 }
 CONFIGFS_ATTR(tcmu_, nl_reply_supported);
 
+static ssize_t tcmu_zero_copy_min_kb_show(struct config_item *item,
+					  char *page)
+{
+	struct se_dev_attrib *da = container_of(to_config_group(item),
+						struct se_dev_attrib, da_group);
+	struct tcmu_dev *udev = TCMU_DEV(da->da_dev);
+
+	return snprintf(page, PAGE_SIZE, "%u\n", udev->zero_copy_min_kb);
+}
+
+static ssize_t tcmu_zero_copy_min_kb_store(struct config_item *item,
+					   const char *page, size_t count)
+{
+	struct se_dev_attrib *da = container_of(to_config_group(item),
+						struct se_dev_attrib, da_group);
+	struct tcmu_dev *udev = TCMU_DEV(da->da_dev);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(page, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&udev->cmdr_lock);
+	udev->zero_copy_min_kb = val;
+	mutex_unlock(&udev->cmdr_lock);
+	return count;
+}
+CONFIGFS_ATTR(tcmu_, zero_copy_min_kb);
+
 static ssize_t tcmu_emulate_write_cache_show(struct config_item *item,
 					     char *page)
 {
@@ -2582,6 +2784,7 @@ static struct configfs_attribute *tcmu_attrib_attrs[] = {
 	&tcmu_attr_dev_size,
 	&tcmu_attr_emulate_write_cache,
 	&tcmu_attr_nl_reply_supported,
+	&tcmu_attr_zero_copy_min_kb,
 	NULL,
 };
 
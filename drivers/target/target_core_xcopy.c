@@ -17,6 +17,7 @@
 #include <linux/list.h>
 #include <linux/configfs.h>
 #include <linux/ratelimit.h>
+#include <linux/ktime.h>
 #include <scsi/scsi_proto.h>
 #include <asm/unaligned.h>
 
@@ -729,6 +730,7 @@ static void target_xcopy_do_work(struct work_struct *work)
 	struct se_device *src_dev, *dst_dev;
 	sector_t src_lba, dst_lba, end_lba;
 	unsigned int max_sectors;
+	ktime_t start = ktime_get();
 	int rc = 0;
 	unsigned short nolb, cur_nolb, max_nolb, copied_nolb = 0;
 
@@ -758,6 +760,27 @@ static void target_xcopy_do_work(struct work_struct *work)
 			nolb, max_nolb, (unsigned long long)end_lba);
 	pr_debug("target_xcopy_do_work: Starting src_lba: %llu, dst_lba: %llu\n",
 			(unsigned long long)src_lba, (unsigned long long)dst_lba);
+	/*
+	 * Let the backend copy between two of its own devices directly,
+	 * falling back to the READ + WRITE loop below if it can't.
+	 */
+	if (src_dev->transport == dst_dev->transport &&
+	    dst_dev->transport->xcopy_range) {
+		rc = dst_dev->transport->xcopy_range(src_dev, src_lba,
+						     dst_dev, dst_lba, nolb);
+		if (!rc) {
+			atomic_long_inc(&dst_dev->xcopy_offloads);
+			src_lba += nolb;
+			dst_lba += nolb;
+			copied_nolb = nolb;
+			nolb = 0;
+		} else if (rc != -EOPNOTSUPP) {
+			pr_warn_ratelimited("target_xcopy_do_work: %s xcopy_range"
+				" failed: %d\n", dst_dev->transport->name, rc);
+			goto out;
+		}
+		rc = 0;
+	}
 
 	while (src_lba < end_lba) {
 		cur_nolb = min(nolb, max_nolb);
@@ -794,8 +817,14 @@ static void target_xcopy_do_work(struct work_struct *work)
 		xop->dst_pt_cmd->se_cmd.se_cmd_flags &= ~SCF_PASSTHROUGH_SG_TO_MEM_NOALLOC;
 
 		transport_generic_free_cmd(&xop->dst_pt_cmd->se_cmd, 0);
+		atomic_long_inc(&dst_dev->xcopy_chunks);
 	}
 
+	atomic_long_add((unsigned long)copied_nolb *
+			dst_dev->dev_attrib.block_size, &dst_dev->xcopy_bytes);
+	atomic_long_add(ktime_us_delta(ktime_get(), start),
+			&dst_dev->xcopy_usecs);
+
 	xcopy_pt_undepend_remotedev(xop);
 	kfree(xop);
 
@@ -274,20 +274,6 @@ int f2fs_ra_meta_pages(struct f2fs_sb_info *sbi, block_t start, int nrpages,
 	return blkno - start;
 }
 
-void f2fs_ra_meta_pages_cond(struct f2fs_sb_info *sbi, pgoff_t index)
-{
-	struct page *page;
-	bool readahead = false;
-
-	page = find_get_page(META_MAPPING(sbi), index);
-	if (!page || !PageUptodate(page))
-		readahead = true;
-	f2fs_put_page(page, 0);
-
-	if (readahead)
-		f2fs_ra_meta_pages(sbi, index, BIO_MAX_PAGES, META_POR, true);
-}
-
 static int __f2fs_write_meta_page(struct page *page,
 				struct writeback_control *wbc,
 				enum iostat_type io_type)
@@ -7,6 +7,7 @@
  */
 #include <linux/fs.h>
 #include <linux/f2fs_fs.h>
+#include <linux/ktime.h>
 #include "f2fs.h"
 #include "node.h"
 #include "segment.h"
@@ -44,6 +45,35 @@
 
 static struct kmem_cache *fsync_entry_slab;
 
+/* Number of node chain blocks to keep reading ahead of the recovery walk */
+#define RECOVERY_RA_BLOCKS	BIO_MAX_PAGES
+
+struct recovery_ra {
+	block_t start;		/* first block of the readahead window */
+	block_t end;		/* block after the last one read ahead */
+};
+
+/*
+ * The warm node chain is mostly laid out in consecutive blocks. Read ahead
+ * the next window once the walk crosses the middle of the current one,
+ * rather than stalling on a synchronous read whenever it runs out, and
+ * start over wherever the chain jumps out of the window.
+ */
+static void ra_node_chain(struct f2fs_sb_info *sbi, struct recovery_ra *ra,
+							block_t blkaddr)
+{
+	if (blkaddr < ra->start || blkaddr >= ra->end) {
+		ra->start = blkaddr;
+		ra->end = blkaddr;
+	}
+
+	if (ra->end - blkaddr > RECOVERY_RA_BLOCKS / 2)
+		return;
+
+	ra->end += f2fs_ra_meta_pages(sbi, ra->end, RECOVERY_RA_BLOCKS,
+					META_POR, ra->end == blkaddr);
+}
+
 bool f2fs_space_for_roll_forward(struct f2fs_sb_info *sbi)
 {
 	s64 nalloc = percpu_counter_sum_positive(&sbi->alloc_valid_block_count);
@@ -301,6 +331,7 @@ static int find_fsync_dnodes(struct f2fs_sb_info *sbi, struct list_head *head,
 {
 	struct curseg_info *curseg;
 	struct page *page = NULL;
+	struct recovery_ra ra = { 0, 0 };
 	block_t blkaddr;
 	unsigned int loop_cnt = 0;
 	unsigned int free_blocks = MAIN_SEGS(sbi) * sbi->blocks_per_seg -
@@ -317,6 +348,8 @@ static int find_fsync_dnodes(struct f2fs_sb_info *sbi, struct list_head *head,
 		if (!f2fs_is_valid_blkaddr(sbi, blkaddr, META_POR))
 			return 0;
 
+		ra_node_chain(sbi, &ra, blkaddr);
+
 		page = f2fs_get_tmp_page(sbi, blkaddr);
 		if (IS_ERR(page)) {
 			err = PTR_ERR(page);
@@ -365,6 +398,14 @@ static int find_fsync_dnodes(struct f2fs_sb_info *sbi, struct list_head *head,
 
 		if (IS_INODE(page) && is_dent_dnode(page))
 			entry->last_dentry = blkaddr;
+
+		/*
+		 * recover_data() will look up the checkpointed version of this
+		 * dnode, start reading it now so that the reads of all the
+		 * fsynced inodes overlap with the scan.
+		 */
+		if (!check_only && !IS_INODE(page))
+			f2fs_ra_node_page(sbi, nid_of_node(page));
 next:
 		/* sanity check in order to detect looped node chain */
 		if (++loop_cnt >= free_blocks ||
@@ -380,8 +421,6 @@ static int find_fsync_dnodes(struct f2fs_sb_info *sbi, struct list_head *head,
 		/* check next segment */
 		blkaddr = next_blkaddr_of_node(page);
 		f2fs_put_page(page, 1);
-
-		f2fs_ra_meta_pages_cond(sbi, blkaddr);
 	}
 	return err;
 }
@@ -649,6 +688,7 @@ static int recover_data(struct f2fs_sb_info *sbi, struct list_head *inode_list,
 {
 	struct curseg_info *curseg;
 	struct page *page = NULL;
+	struct recovery_ra ra = { 0, 0 };
 	int err = 0;
 	block_t blkaddr;
 
@@ -662,7 +702,7 @@ static int recover_data(struct f2fs_sb_info *sbi, struct list_head *inode_list,
 		if (!f2fs_is_valid_blkaddr(sbi, blkaddr, META_POR))
 			break;
 
-		f2fs_ra_meta_pages_cond(sbi, blkaddr);
+		ra_node_chain(sbi, &ra, blkaddr);
 
 		page = f2fs_get_tmp_page(sbi, blkaddr);
 		if (IS_ERR(page)) {
@@ -723,6 +763,7 @@ int f2fs_recover_fsync_data(struct f2fs_sb_info *sbi, bool check_only)
 	int ret = 0;
 	unsigned long s_flags = sbi->sb->s_flags;
 	bool need_writecp = false;
+	ktime_t start, scanned, recovered;
 #ifdef CONFIG_QUOTA
 	int quota_enabled;
 #endif
@@ -754,7 +795,9 @@ int f2fs_recover_fsync_data(struct f2fs_sb_info *sbi, bool check_only)
 	mutex_lock(&sbi->cp_mutex);
 
 	/* step #1: find fsynced inode numbers */
+	start = ktime_get();
 	err = find_fsync_dnodes(sbi, &inode_list, check_only);
+	scanned = recovered = ktime_get();
 	if (err || list_empty(&inode_list))
 		goto skip;
 
@@ -767,6 +810,7 @@ int f2fs_recover_fsync_data(struct f2fs_sb_info *sbi, bool check_only)
 
 	/* step #2: recover data */
 	err = recover_data(sbi, &inode_list, &tmp_inode_list, &dir_list);
+	recovered = ktime_get();
 	if (!err)
 		f2fs_bug_on(sbi, !list_empty(&inode_list));
 	else {
@@ -801,6 +845,11 @@ int f2fs_recover_fsync_data(struct f2fs_sb_info *sbi, bool check_only)
 			};
 			err = f2fs_write_checkpoint(sbi, &cpc);
 		}
+
+		f2fs_info(sbi, "recover fsync data: scan %lld ms, recovery %lld ms, checkpoint %lld ms, err = %d",
+			  ktime_ms_delta(scanned, start),
+			  ktime_ms_delta(recovered, scanned),
+			  ktime_ms_delta(ktime_get(), recovered), err);
 	}
 
 	kmem_cache_destroy(fsync_entry_slab);
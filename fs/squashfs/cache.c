@@ -10,7 +10,9 @@
 
 /*
  * Blocks in Squashfs are compressed.  To avoid repeatedly decompressing
- * recently accessed data Squashfs uses two small metadata and fragment caches.
+ * recently accessed data Squashfs uses metadata and fragment caches, small by
+ * default, whose sizes can be set with the meta_cache and frag_cache mount
+ * options.
  *
  * This file implements a generic cache implementation used for both caches,
  * plus functions layered ontop of the generic cache implementation to
@@ -39,12 +41,37 @@
 #include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/pagemap.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
 #include "squashfs.h"
 #include "page_actor.h"
 
+static struct hlist_head *squashfs_cache_bucket(struct squashfs_cache *cache,
+	u64 block)
+{
+	return &cache->hash[hash_64(block, cache->hash_bits)];
+}
+
+
+/*
+ * Must be called with the cache lock held.
+ */
+static struct squashfs_cache_entry *squashfs_cache_lookup(
+	struct squashfs_cache *cache, u64 block)
+{
+	struct squashfs_cache_entry *entry;
+
+	hlist_for_each_entry(entry, squashfs_cache_bucket(cache, block), hash)
+		if (entry->block == block)
+			return entry;
+
+	return NULL;
+}
+
+
 /*
  * Look-up block in cache, and increment usage count.  If not in cache, read
  * and decompress it from disk.
@@ -52,21 +79,14 @@
 struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 	struct squashfs_cache *cache, u64 block, int length)
 {
-	int i, n;
 	struct squashfs_cache_entry *entry;
 
 	spin_lock(&cache->lock);
 
 	while (1) {
-		for (i = cache->curr_blk, n = 0; n < cache->entries; n++) {
-			if (cache->entry[i].block == block) {
-				cache->curr_blk = i;
-				break;
-			}
-			i = (i + 1) % cache->entries;
-		}
+		entry = squashfs_cache_lookup(cache, block);
 
-		if (n == cache->entries) {
+		if (entry == NULL) {
 			/*
 			 * Block not in cache, if all cache entries are used
 			 * go to sleep waiting for one to become available.
@@ -81,19 +101,18 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 			}
 
 			/*
-			 * At least one unused cache entry.  A simple
-			 * round-robin strategy is used to choose the entry to
-			 * be evicted from the cache.
+			 * At least one unused cache entry.  The least recently
+			 * used one is evicted from the cache.
 			 */
-			i = cache->next_blk;
-			for (n = 0; n < cache->entries; n++) {
-				if (cache->entry[i].refcount == 0)
+			list_for_each_entry_reverse(entry, &cache->lru, lru)
+				if (entry->refcount == 0)
 					break;
-				i = (i + 1) % cache->entries;
-			}
 
-			cache->next_blk = (i + 1) % cache->entries;
-			entry = &cache->entry[i];
+			list_move(&entry->lru, &cache->lru);
+			hlist_del_init(&entry->hash);
+			hlist_add_head(&entry->hash,
+				squashfs_cache_bucket(cache, block));
+			cache->misses++;
 
 			/*
 			 * Initialise chosen cache entry, and fill it in from
@@ -137,7 +156,8 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 		 * previously unused there's one less cache entry available
 		 * for reuse.
 		 */
-		entry = &cache->entry[i];
+		list_move(&entry->lru, &cache->lru);
+		cache->hits++;
 		if (entry->refcount == 0)
 			cache->unused--;
 		entry->refcount++;
@@ -158,7 +178,8 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 
 out:
 	TRACE("Got %s %d, start block %lld, refcount %d, error %d\n",
-		cache->name, i, entry->block, entry->refcount, entry->error);
+		cache->name, (int)(entry - cache->entry), entry->block,
+		entry->refcount, entry->error);
 
 	if (entry->error)
 		ERROR("Unable to read %s cache entry [%llx]\n", cache->name,
@@ -211,6 +232,7 @@ void squashfs_cache_delete(struct squashfs_cache *cache)
 	}
 
 	kfree(cache->entry);
+	kfree(cache->hash);
 	kfree(cache);
 }
 
@@ -237,8 +259,15 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 		goto cleanup;
 	}
 
-	cache->curr_blk = 0;
-	cache->next_blk = 0;
+	/* About one entry per bucket, as caches can hold thousands of them */
+	cache->hash_bits = ilog2(roundup_pow_of_two(entries));
+	cache->hash = kcalloc(1 << cache->hash_bits, sizeof(*cache->hash),
+		GFP_KERNEL);
+	if (cache->hash == NULL) {
+		ERROR("Failed to allocate %s cache\n", name);
+		goto cleanup;
+	}
+
 	cache->unused = entries;
 	cache->entries = entries;
 	cache->block_size = block_size;
@@ -248,11 +277,14 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 	cache->num_waiters = 0;
 	spin_lock_init(&cache->lock);
 	init_waitqueue_head(&cache->wait_queue);
+	INIT_LIST_HEAD(&cache->lru);
 
 	for (i = 0; i < entries; i++) {
 		struct squashfs_cache_entry *entry = &cache->entry[i];
 
 		init_waitqueue_head(&cache->entry[i].wait_queue);
+		list_add_tail(&entry->lru, &cache->lru);
+		INIT_HLIST_NODE(&entry->hash);
 		entry->cache = cache;
 		entry->block = SQUASHFS_INVALID_BLK;
 		entry->data = kcalloc(cache->pages, sizeof(void *), GFP_KERNEL);
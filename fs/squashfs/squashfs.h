@@ -71,6 +71,12 @@ extern struct inode *squashfs_iget(struct super_block *, long long,
 				unsigned int);
 extern int squashfs_read_inode(struct inode *, long long);
 
+/* sysfs.c */
+extern int squashfs_sysfs_register(struct super_block *);
+extern void squashfs_sysfs_unregister(struct super_block *);
+extern int __init squashfs_sysfs_init(void);
+extern void squashfs_sysfs_exit(void);
+
 /* xattr.c */
 extern ssize_t squashfs_listxattr(struct dentry *, char *, size_t);
 
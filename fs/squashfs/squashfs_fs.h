@@ -203,6 +203,10 @@ static inline int squashfs_block_size(__le32 raw)
 /* cached data constants for filesystem */
 #define SQUASHFS_CACHED_BLKS		8
 
+/* limits of the meta_cache and frag_cache mount options */
+#define SQUASHFS_MAX_CACHED_BLKS	4096
+#define SQUASHFS_MAX_CACHED_FRAGMENTS	256
+
 /* meta index cache */
 #define SQUASHFS_META_INDEXES	(SQUASHFS_METADATA_SIZE / sizeof(unsigned int))
 #define SQUASHFS_META_ENTRIES	127
@@ -10,19 +10,26 @@
  * squashfs_fs_sb.h
  */
 
+#include <linux/kobject.h>
+#include <linux/completion.h>
 #include "squashfs_fs.h"
 
 struct squashfs_cache {
 	char			*name;
 	int			entries;
-	int			curr_blk;
-	int			next_blk;
 	int			num_waiters;
 	int			unused;
 	int			block_size;
 	int			pages;
+	unsigned long		hits;
+	unsigned long		misses;
 	spinlock_t		lock;
 	wait_queue_head_t	wait_queue;
+	/* Entries, most recently used first */
+	struct list_head	lru;
+	/* Entries holding a block, hashed by block */
+	struct hlist_head	*hash;
+	int			hash_bits;
 	struct squashfs_cache_entry *entry;
 };
 
@@ -35,6 +42,8 @@ struct squashfs_cache_entry {
 	int			error;
 	int			num_waiters;
 	wait_queue_head_t	wait_queue;
+	struct list_head	lru;
+	struct hlist_node	hash;
 	struct squashfs_cache	*cache;
 	void			**data;
 	struct squashfs_page_actor	*actor;
@@ -64,5 +73,9 @@ struct squashfs_sb_info {
 	unsigned int				inodes;
 	unsigned int				fragments;
 	int					xattr_ids;
+	unsigned int				meta_cache_entries;
+	unsigned int				frag_cache_entries;
+	struct kobject				kobj;
+	struct completion			kobj_unregister;
 };
 #endif
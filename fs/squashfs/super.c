@@ -25,6 +25,8 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -63,6 +65,63 @@ static const struct squashfs_decompressor *supported_squashfs_filesystem(short
 }
 
 
+enum {
+	Opt_meta_cache, Opt_frag_cache, Opt_err
+};
+
+static const match_table_t tokens = {
+	{Opt_meta_cache, "meta_cache=%u"},
+	{Opt_frag_cache, "frag_cache=%u"},
+	{Opt_err, NULL}
+};
+
+/*
+ * Parse the cache size mount options, leaving the sizes not given unchanged.
+ * Squashfs has historically ignored any mount option, so unknown options are
+ * still ignored.
+ */
+static int squashfs_parse_options(char *options,
+	unsigned int *meta_cache_entries, unsigned int *frag_cache_entries)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+	int n;
+
+	if (!options)
+		return 0;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, tokens, args)) {
+		case Opt_meta_cache:
+			if (match_int(&args[0], &n) ||
+					n < SQUASHFS_CACHED_BLKS ||
+					n > SQUASHFS_MAX_CACHED_BLKS) {
+				ERROR("meta_cache must be between %d and %d\n",
+					SQUASHFS_CACHED_BLKS,
+					SQUASHFS_MAX_CACHED_BLKS);
+				return -EINVAL;
+			}
+			*meta_cache_entries = n;
+			break;
+		case Opt_frag_cache:
+			if (match_int(&args[0], &n) || n < 1 ||
+					n > SQUASHFS_MAX_CACHED_FRAGMENTS) {
+				ERROR("frag_cache must be between 1 and %d\n",
+					SQUASHFS_MAX_CACHED_FRAGMENTS);
+				return -EINVAL;
+			}
+			*frag_cache_entries = n;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
 static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 {
 	struct squashfs_sb_info *msblk;
@@ -88,6 +147,13 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 
 	mutex_init(&msblk->meta_index_mutex);
 
+	msblk->meta_cache_entries = SQUASHFS_CACHED_BLKS;
+	msblk->frag_cache_entries = SQUASHFS_CACHED_FRAGMENTS;
+	err = squashfs_parse_options(data, &msblk->meta_cache_entries,
+		&msblk->frag_cache_entries);
+	if (err)
+		goto failed_mount;
+
 	/*
 	 * msblk->bytes_used is checked in squashfs_read_table to ensure reads
 	 * are not beyond filesystem end.  But as we're using
@@ -189,7 +255,7 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	err = -ENOMEM;
 
 	msblk->block_cache = squashfs_cache_init("metadata",
-			SQUASHFS_CACHED_BLKS, SQUASHFS_METADATA_SIZE);
+			msblk->meta_cache_entries, SQUASHFS_METADATA_SIZE);
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
@@ -265,7 +331,7 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 		goto check_directory_table;
 
 	msblk->fragment_cache = squashfs_cache_init("fragment",
-		SQUASHFS_CACHED_FRAGMENTS, msblk->block_size);
+		msblk->frag_cache_entries, msblk->block_size);
 	if (msblk->fragment_cache == NULL) {
 		err = -ENOMEM;
 		goto failed_mount;
@@ -295,18 +361,22 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 		goto failed_mount;
 	}
 
+	err = squashfs_sysfs_register(sb);
+	if (err)
+		goto failed_mount;
+
 	/* allocate root */
 	root = new_inode(sb);
 	if (!root) {
 		err = -ENOMEM;
-		goto failed_mount;
+		goto failed_sysfs;
 	}
 
 	err = squashfs_read_inode(root, root_inode);
 	if (err) {
 		make_bad_inode(root);
 		iput(root);
-		goto failed_mount;
+		goto failed_sysfs;
 	}
 	insert_inode_hash(root);
 
@@ -314,13 +384,15 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (sb->s_root == NULL) {
 		ERROR("Root inode create failed\n");
 		err = -ENOMEM;
-		goto failed_mount;
+		goto failed_sysfs;
 	}
 
 	TRACE("Leaving squashfs_fill_super\n");
 	kfree(sblk);
 	return 0;
 
+failed_sysfs:
+	squashfs_sysfs_unregister(sb);
 failed_mount:
 	squashfs_cache_delete(msblk->block_cache);
 	squashfs_cache_delete(msblk->fragment_cache);
@@ -360,16 +432,48 @@ static int squashfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 static int squashfs_remount(struct super_block *sb, int *flags, char *data)
 {
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	unsigned int meta_cache_entries = msblk->meta_cache_entries;
+	unsigned int frag_cache_entries = msblk->frag_cache_entries;
+	int err;
+
 	sync_filesystem(sb);
+
+	err = squashfs_parse_options(data, &meta_cache_entries,
+		&frag_cache_entries);
+	if (err)
+		return err;
+
+	/* The caches are only sized at mount time */
+	if (meta_cache_entries != msblk->meta_cache_entries ||
+			frag_cache_entries != msblk->frag_cache_entries) {
+		ERROR("meta_cache and frag_cache can't be changed on remount\n");
+		return -EINVAL;
+	}
+
 	*flags |= SB_RDONLY;
 	return 0;
 }
 
 
+static int squashfs_show_options(struct seq_file *seq, struct dentry *root)
+{
+	struct squashfs_sb_info *msblk = root->d_sb->s_fs_info;
+
+	if (msblk->meta_cache_entries != SQUASHFS_CACHED_BLKS)
+		seq_printf(seq, ",meta_cache=%u", msblk->meta_cache_entries);
+	if (msblk->frag_cache_entries != SQUASHFS_CACHED_FRAGMENTS)
+		seq_printf(seq, ",frag_cache=%u", msblk->frag_cache_entries);
+
+	return 0;
+}
+
+
 static void squashfs_put_super(struct super_block *sb)
 {
 	if (sb->s_fs_info) {
 		struct squashfs_sb_info *sbi = sb->s_fs_info;
+		squashfs_sysfs_unregister(sb);
 		squashfs_cache_delete(sbi->block_cache);
 		squashfs_cache_delete(sbi->fragment_cache);
 		squashfs_cache_delete(sbi->read_page);
@@ -432,8 +536,15 @@ static int __init init_squashfs_fs(void)
 	if (err)
 		return err;
 
+	err = squashfs_sysfs_init();
+	if (err) {
+		destroy_inodecache();
+		return err;
+	}
+
 	err = register_filesystem(&squashfs_fs_type);
 	if (err) {
+		squashfs_sysfs_exit();
 		destroy_inodecache();
 		return err;
 	}
@@ -447,6 +558,7 @@ static int __init init_squashfs_fs(void)
 static void __exit exit_squashfs_fs(void)
 {
 	unregister_filesystem(&squashfs_fs_type);
+	squashfs_sysfs_exit();
 	destroy_inodecache();
 }
 
@@ -478,6 +590,7 @@ static const struct super_operations squashfs_super_ops = {
 	.alloc_inode = squashfs_alloc_inode,
 	.free_inode = squashfs_free_inode,
 	.statfs = squashfs_statfs,
+	.show_options = squashfs_show_options,
 	.put_super = squashfs_put_super,
 	.remount_fs = squashfs_remount
 };
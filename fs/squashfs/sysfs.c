@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@squashfs.org.uk>
+ *
+ * sysfs.c
+ */
+
+/*
+ * This file exports the size and the hit and miss counts of the metadata
+ * and fragment caches of each mounted filesystem, in /sys/fs/squashfs/<dev>.
+ */
+
+#include <linux/fs.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs.h"
+
+enum {
+	CACHE_ENTRIES,
+	CACHE_HITS,
+	CACHE_MISSES,
+};
+
+struct squashfs_attr {
+	struct attribute	attr;
+	/* offset of the cache pointer in struct squashfs_sb_info */
+	size_t			cache;
+	int			stat;
+};
+
+#define SQUASHFS_CACHE_ATTR(_name, _cache, _stat)			\
+static struct squashfs_attr squashfs_attr_##_name = {			\
+	.attr = { .name = __stringify(_name), .mode = 0444 },		\
+	.cache = offsetof(struct squashfs_sb_info, _cache),		\
+	.stat = _stat,							\
+}
+
+SQUASHFS_CACHE_ATTR(meta_cache_entries, block_cache, CACHE_ENTRIES);
+SQUASHFS_CACHE_ATTR(meta_cache_hits, block_cache, CACHE_HITS);
+SQUASHFS_CACHE_ATTR(meta_cache_misses, block_cache, CACHE_MISSES);
+SQUASHFS_CACHE_ATTR(frag_cache_entries, fragment_cache, CACHE_ENTRIES);
+SQUASHFS_CACHE_ATTR(frag_cache_hits, fragment_cache, CACHE_HITS);
+SQUASHFS_CACHE_ATTR(frag_cache_misses, fragment_cache, CACHE_MISSES);
+
+static struct attribute *squashfs_attrs[] = {
+	&squashfs_attr_meta_cache_entries.attr,
+	&squashfs_attr_meta_cache_hits.attr,
+	&squashfs_attr_meta_cache_misses.attr,
+	&squashfs_attr_frag_cache_entries.attr,
+	&squashfs_attr_frag_cache_hits.attr,
+	&squashfs_attr_frag_cache_misses.attr,
+	NULL,
+};
+
+static ssize_t squashfs_attr_show(struct kobject *kobj,
+	struct attribute *attr, char *buf)
+{
+	struct squashfs_sb_info *msblk = container_of(kobj,
+		struct squashfs_sb_info, kobj);
+	struct squashfs_attr *a = container_of(attr, struct squashfs_attr,
+		attr);
+	struct squashfs_cache *cache =
+		*(struct squashfs_cache **)((char *)msblk + a->cache);
+	unsigned long val = 0;
+
+	/* The fragment cache doesn't exist if there are no fragments */
+	if (cache) {
+		spin_lock(&cache->lock);
+		switch (a->stat) {
+		case CACHE_ENTRIES:
+			val = cache->entries;
+			break;
+		case CACHE_HITS:
+			val = cache->hits;
+			break;
+		case CACHE_MISSES:
+			val = cache->misses;
+			break;
+		}
+		spin_unlock(&cache->lock);
+	}
+
+	return sprintf(buf, "%lu\n", val);
+}
+
+static void squashfs_sb_release(struct kobject *kobj)
+{
+	struct squashfs_sb_info *msblk = container_of(kobj,
+		struct squashfs_sb_info, kobj);
+
+	complete(&msblk->kobj_unregister);
+}
+
+static const struct sysfs_ops squashfs_sysfs_ops = {
+	.show	= squashfs_attr_show,
+};
+
+static struct kobj_type squashfs_sb_ktype = {
+	.default_attrs	= squashfs_attrs,
+	.sysfs_ops	= &squashfs_sysfs_ops,
+	.release	= squashfs_sb_release,
+};
+
+static struct kset *squashfs_kset;
+
+
+int squashfs_sysfs_register(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int err;
+
+	msblk->kobj.kset = squashfs_kset;
+	init_completion(&msblk->kobj_unregister);
+	err = kobject_init_and_add(&msblk->kobj, &squashfs_sb_ktype, NULL,
+		"%s", sb->s_id);
+	if (err) {
+		kobject_put(&msblk->kobj);
+		wait_for_completion(&msblk->kobj_unregister);
+	}
+
+	return err;
+}
+
+
+/*
+ * Wait for the last reference to the kobject to go away, as it is embedded
+ * in the squashfs_sb_info about to be freed.
+ */
+void squashfs_sysfs_unregister(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+
+	kobject_del(&msblk->kobj);
+	kobject_put(&msblk->kobj);
+	wait_for_completion(&msblk->kobj_unregister);
+}
+
+
+int __init squashfs_sysfs_init(void)
+{
+	squashfs_kset = kset_create_and_add("squashfs", NULL, fs_kobj);
+
+	return squashfs_kset ? 0 : -ENOMEM;
+}
+
+
+void squashfs_sysfs_exit(void)
+{
+	kset_unregister(squashfs_kset);
+}
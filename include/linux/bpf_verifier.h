@@ -305,6 +305,7 @@ struct bpf_insn_aux_data {
 	bool zext_dst; /* this insn zero extends dst reg */
 	u8 alu_state; /* used in combination with alu_limit */
 	bool prune_point;
+	bool loop_head; /* target of a back-edge found by check_cfg() */
 	unsigned int orig_idx; /* original instruction index */
 };
 
@@ -338,6 +339,13 @@ static inline bool bpf_verifier_log_needed(const struct bpf_verifier_log *log)
 
 #define BPF_MAX_SUBPROGS 256
 
+/* Maximum number of register states that can exist at once */
+#define BPF_ID_MAP_SIZE (MAX_BPF_REG + MAX_BPF_STACK / BPF_REG_SIZE)
+struct bpf_id_pair {
+	u32 old;
+	u32 cur;
+};
+
 struct bpf_subprog_info {
 	u32 start; /* insn idx of function entry point */
 	u32 linfo_idx; /* The idx to the main_prog->aux->linfo */
@@ -373,12 +381,16 @@ struct bpf_verifier_env {
 		int cur_stack;
 	} cfg;
 	u32 subprog_cnt;
+	/* scratch idmap for states_equal(), cleared before each comparison */
+	struct bpf_id_pair idmap_scratch[BPF_ID_MAP_SIZE];
 	/* number of instructions analyzed by the verifier */
 	u32 prev_insn_processed, insn_processed;
 	/* number of jmps, calls, exits analyzed so far */
 	u32 prev_jmps_processed, jmps_processed;
 	/* total verification time */
 	u64 verification_time;
+	/* time spent in check_cfg() and friends, and in do_check() */
+	u64 cfg_time, check_time;
 	/* maximum number of verifier states kept in 'branching' instructions */
 	u32 max_states_per_insn;
 	/* total number of allocated verifier states */
@@ -390,6 +402,11 @@ struct bpf_verifier_env {
 	u32 peak_states;
 	/* longest register parentage chain walked for liveness marking */
 	u32 longest_mark_read_walk;
+	/* explored states compared against the current one, the number of
+	 * those that pruned the search and of those rejected by the cheap
+	 * states_maybe_equal() check before a full states_equal()
+	 */
+	u32 states_checked, states_pruned, states_fast_miss;
 };
 
 __printf(2, 0) void bpf_verifier_vlog(struct bpf_verifier_log *log,
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _IP_SET_NET_TRIE_H
+#define _IP_SET_NET_TRIE_H
+
+#include <linux/rcupdate.h>
+#include <linux/types.h>
+
+/* Path compressed binary trie of the network prefixes stored in a
+ * hash:net* type of set. It is not used to store the elements themselves:
+ * a lookup returns the prefix lengths in the set which cover an address,
+ * so that the hash lookup is tried for those only instead of for every
+ * prefix length in the set.
+ *
+ * Writers are serialized by the set lock, readers are protected by RCU.
+ */
+struct ip_set_net_trie_node;
+
+struct ip_set_net_trie {
+	struct ip_set_net_trie_node __rcu *root;
+	u32 nodes;		/* number of allocated nodes */
+	u8 data_size;		/* address size in bytes: 4 or 16 */
+	bool incomplete;	/* some prefixes could not be added */
+};
+
+extern void ip_set_net_trie_init(struct ip_set_net_trie *trie, u8 data_size);
+extern void ip_set_net_trie_add(struct ip_set_net_trie *trie,
+				const void *data, u8 prefixlen);
+extern void ip_set_net_trie_del(struct ip_set_net_trie *trie,
+				const void *data, u8 prefixlen);
+extern void ip_set_net_trie_match(const struct ip_set_net_trie *trie,
+				  const void *data, unsigned long *prefixes);
+extern void ip_set_net_trie_flush(struct ip_set_net_trie *trie);
+extern void ip_set_net_trie_destroy(struct ip_set_net_trie *trie);
+extern size_t ip_set_net_trie_memsize(const struct ip_set_net_trie *trie);
+
+#endif /* _IP_SET_NET_TRIE_H */
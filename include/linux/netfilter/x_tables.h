@@ -264,6 +264,10 @@ struct xt_table_info {
 	unsigned int stacksize;
 	void ***jumpstack;
 
+	/* Per-cpu verdict cache of ip_tables, used on vcache_hooks only */
+	unsigned int vcache_hooks;
+	void __percpu *vcache;
+
 	unsigned char entries[0] __aligned(8);
 };
 
@@ -56,13 +56,17 @@ struct rw_semaphore {
  */
 #define RWSEM_OWNER_UNKNOWN	(-2L)
 
-/* In all implementations count != 0 means locked */
+#define RWSEM_UNLOCKED_VALUE		0L
+#define RWSEM_READER_BIASED		(1L << 3)
+
+/*
+ * count != 0 means locked, ignoring the static reader-biased flag
+ */
 static inline int rwsem_is_locked(struct rw_semaphore *sem)
 {
-	return atomic_long_read(&sem->count) != 0;
+	return (atomic_long_read(&sem->count) & ~RWSEM_READER_BIASED) != 0;
 }
 
-#define RWSEM_UNLOCKED_VALUE		0L
 #define __RWSEM_INIT_COUNT(name)	.count = ATOMIC_LONG_INIT(RWSEM_UNLOCKED_VALUE)
 
 /* Common initializer macros and functions */
@@ -100,6 +104,20 @@ do {								\
 	__init_rwsem((sem), #sem, &__key);			\
 } while (0)
 
+/*
+ * A reader-biased rwsem lets new readers join an active reader phase even
+ * when writers are queued, until the first waiting writer times out and
+ * requests a handoff. It is meant for read-mostly locks where readers
+ * vastly outnumber writers.
+ */
+extern void rwsem_set_reader_biased(struct rw_semaphore *sem);
+
+#define init_rwsem_reader_biased(sem)				\
+do {								\
+	init_rwsem(sem);					\
+	rwsem_set_reader_biased(sem);				\
+} while (0)
+
 /*
  * This is the same regardless of which rwsem implementation that is being used.
  * It is just a heuristic meant to be called by somebody alreadying holding the
@@ -20,11 +20,19 @@ struct nf_flowtable_type {
 	struct module			*owner;
 };
 
+struct nf_flowtable_stats {
+	u64				hit;
+	u64				miss;
+	u64				offloaded;
+};
+
 struct nf_flowtable {
 	struct list_head		list;
 	struct rhashtable		rhashtable;
 	const struct nf_flowtable_type	*type;
 	struct delayed_work		gc_work;
+	/* Only for flow table types which keep counters */
+	struct nf_flowtable_stats __percpu *stats;
 };
 
 enum flow_offload_tuple_dir {
@@ -33,6 +41,8 @@ enum flow_offload_tuple_dir {
 	FLOW_OFFLOAD_DIR_MAX = IP_CT_DIR_MAX
 };
 
+#define NF_FLOW_TABLE_ENCAP_MAX		2
+
 struct flow_offload_tuple {
 	union {
 		struct in_addr		src_v4;
@@ -51,7 +61,15 @@ struct flow_offload_tuple {
 
 	u8				l3proto;
 	u8				l4proto;
+
+	/* VLAN and PPPoE session headers, outermost first */
+	struct {
+		u16			id;
+		__be16			proto;
+	} encap[NF_FLOW_TABLE_ENCAP_MAX];
+
 	u8				dir;
+	u8				encap_num;
 
 	u16				mtu;
 
@@ -15,6 +15,7 @@
 #include <linux/mm.h>
 #include <linux/bitops.h>
 #include <linux/pm_qos.h>
+#include <linux/hrtimer.h>
 #include <linux/refcount.h>
 
 #define snd_pcm_substream_chip(substream) ((substream)->private_data)
@@ -390,6 +391,9 @@ struct snd_pcm_runtime {
 	wait_queue_head_t sleep;	/* poll sleep */
 	wait_queue_head_t tsleep;	/* transfer sleep */
 	struct fasync_struct *fasync;
+	struct hrtimer wakeup_timer;	/* avail wakeup w/o period IRQs */
+	struct snd_pcm_substream *wakeup_substream;
+	unsigned long wakeup_count;	/* wakeup timer expirations */
 
 	/* -- private section -- */
 	void *private_data;
@@ -51,6 +51,14 @@ struct target_backend_ops {
 	int (*init_prot)(struct se_device *);
 	int (*format_prot)(struct se_device *);
 	void (*free_prot)(struct se_device *);
+	/*
+	 * Copy nolb blocks between two devices of this backend without
+	 * going through the XCOPY bounce buffer. Returns -EOPNOTSUPP to
+	 * make the caller fall back to READ/WRITE pass-through commands.
+	 */
+	int (*xcopy_range)(struct se_device *src_dev, sector_t src_lba,
+			   struct se_device *dst_dev, sector_t dst_lba,
+			   u32 nolb);
 
 	struct configfs_attribute **tb_dev_attrib_attrs;
 	struct configfs_attribute **tb_dev_action_attrs;
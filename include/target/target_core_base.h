@@ -780,6 +780,11 @@ struct se_device {
 	atomic_long_t		num_cmds;
 	atomic_long_t		read_bytes;
 	atomic_long_t		write_bytes;
+	/* EXTENDED COPY statistics, accounted on the destination device */
+	atomic_long_t		xcopy_bytes;
+	atomic_long_t		xcopy_chunks;
+	atomic_long_t		xcopy_offloads;
+	atomic_long_t		xcopy_usecs;
 	/* Active commands on this virtual SE device */
 	atomic_t		simple_cmds;
 	atomic_t		dev_ordered_sync;
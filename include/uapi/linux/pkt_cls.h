@@ -546,6 +546,10 @@ enum {
 	TCA_FLOWER_KEY_CT_LABELS,	/* u128 */
 	TCA_FLOWER_KEY_CT_LABELS_MASK,	/* u128 */
 
+	TCA_FLOWER_MASK_HITS,		/* u64 */
+	TCA_FLOWER_MASK_MISSES,		/* u64 */
+	TCA_FLOWER_PAD,
+
 	__TCA_FLOWER_MAX,
 };
 
@@ -194,6 +194,8 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  *
  * b) global or semaphore sem_lock() for read/write:
  *	sem_array.sems[i].pending_{const,alter}:
+ *	(multi-sop operations that do not sleep may hold the locks of all
+ *	 involved semaphores instead, see sem_lock_multi())
  *
  * c) special:
  *	sem_undo_list.list_proc:
@@ -447,6 +449,79 @@ static inline void sem_unlock(struct sem_array *sma, int locknum)
 	}
 }
 
+#define SEM_MULTI_LOCK		(-2)
+/* Bounded by the number of lockdep subclasses */
+#define SEM_MULTI_LOCK_MAX	8
+
+/*
+ * Collect the distinct semaphores of a multi-sop operation into @locks,
+ * in ascending order. Returns their number, or 0 if the operation touches
+ * too many semaphores for sem_lock_multi().
+ */
+static int sem_multi_lock_order(struct sembuf *sops, int nsops,
+				unsigned short *locks)
+{
+	int i, j, nlocks = 0;
+
+	for (i = 0; i < nsops; i++) {
+		unsigned short num = sops[i].sem_num;
+
+		for (j = nlocks; j > 0 && locks[j - 1] > num; j--)
+			;
+		if (j > 0 && locks[j - 1] == num)
+			continue;
+		if (nlocks == SEM_MULTI_LOCK_MAX)
+			return 0;
+		memmove(&locks[j + 1], &locks[j], (nlocks - j) * sizeof(*locks));
+		locks[j] = num;
+		nlocks++;
+	}
+	return nlocks;
+}
+
+static void sem_unlock_multi(struct sem_array *sma, unsigned short *locks,
+			     int nlocks)
+{
+	while (nlocks--)
+		spin_unlock(&sma->sems[locks[nlocks]].lock);
+}
+
+/*
+ * Lock only the semaphores involved in a multi-sop operation.
+ *
+ * This follows the same rules as the single-sop fast path in sem_lock():
+ * it is only possible if no complex operation is enqueued or processed,
+ * and the per-semaphore locks are taken in ascending order to avoid
+ * deadlocks with other multi-sop lockers. Holding the per-semaphore locks
+ * excludes complexmode_enter(), so nothing outside of the locked
+ * semaphores can change until sem_unlock_multi().
+ *
+ * The caller must fall back to sem_lock() if this fails, and also if the
+ * operation has to sleep, as that requires the global queues.
+ */
+static bool sem_lock_multi(struct sem_array *sma, unsigned short *locks,
+			   int nlocks)
+{
+	int i;
+
+	/* Initial check, just an optimization. */
+	if (READ_ONCE(sma->use_global_lock))
+		return false;
+
+	for (i = 0; i < nlocks; i++) {
+		int idx = array_index_nospec(locks[i], sma->sem_nsems);
+
+		spin_lock_nested(&sma->sems[idx].lock, i);
+	}
+
+	/* pairs with smp_store_release() */
+	if (!smp_load_acquire(&sma->use_global_lock))
+		return true;
+
+	sem_unlock_multi(sma, locks, nlocks);
+	return false;
+}
+
 /*
  * sem_lock_(check_) routines are called in the paths where the rwsem
  * is not held.
@@ -1970,7 +2045,8 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	struct sembuf fast_sops[SEMOPM_FAST];
 	struct sembuf *sops = fast_sops, *sop;
 	struct sem_undo *un;
-	int max, locknum;
+	int max, locknum, nlocks = 0;
+	unsigned short multi_locks[SEM_MULTI_LOCK_MAX];
 	bool undos = false, alter = false, dupsop = false;
 	struct sem_queue queue;
 	unsigned long dup = 0, jiffies_left = 0;
@@ -2063,12 +2139,18 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	}
 
 	error = -EIDRM;
-	locknum = sem_lock(sma, sops, nsops);
+	if (nsops > 1)
+		nlocks = sem_multi_lock_order(sops, nsops, multi_locks);
+	if (nlocks && sem_lock_multi(sma, multi_locks, nlocks))
+		locknum = SEM_MULTI_LOCK;
+	else
+		locknum = sem_lock(sma, sops, nsops);
+retry_global:
 	/*
 	 * We eventually might perform the following check in a lockless
 	 * fashion, considering ipc_valid_object() locking constraints.
-	 * If nsops == 1 and there is no contention for sem_perm.lock, then
-	 * only a per-semaphore lock is held and it's OK to proceed with the
+	 * If there is no contention for sem_perm.lock, then only the
+	 * per-semaphore locks are held and it's OK to proceed with the
 	 * check below. More details on the fine grained locking scheme
 	 * entangled here and why it's RMID race safe on comments at sem_lock()
 	 */
@@ -2097,14 +2179,20 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 
 		/*
 		 * If the operation was successful, then do
-		 * the required updates.
+		 * the required updates. With only the per-semaphore
+		 * locks held, no complex operation is pending, so this
+		 * only looks at the queues of the locked semaphores.
+		 * All wakeups are batched and done after unlocking.
 		 */
 		if (alter)
 			do_smart_update(sma, sops, nsops, 1, &wake_q);
 		else
 			set_semotime(sma, sops);
 
-		sem_unlock(sma, locknum);
+		if (locknum == SEM_MULTI_LOCK)
+			sem_unlock_multi(sma, multi_locks, nlocks);
+		else
+			sem_unlock(sma, locknum);
 		rcu_read_unlock();
 		wake_up_q(&wake_q);
 
@@ -2113,6 +2201,17 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	if (error < 0) /* non-blocking error path */
 		goto out_unlock_free;
 
+	if (locknum == SEM_MULTI_LOCK) {
+		/*
+		 * Sleeping requires the global queues, retry the whole
+		 * operation with the array lock.
+		 */
+		sem_unlock_multi(sma, multi_locks, nlocks);
+		locknum = sem_lock(sma, sops, nsops);
+		error = -EIDRM;
+		goto retry_global;
+	}
+
 	/*
 	 * We need to sleep on this operation, so we put the current
 	 * task into the pending queue and go to sleep.
@@ -2207,7 +2306,10 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	unlink_queue(sma, &queue);
 
 out_unlock_free:
-	sem_unlock(sma, locknum);
+	if (locknum == SEM_MULTI_LOCK)
+		sem_unlock_multi(sma, multi_locks, nlocks);
+	else
+		sem_unlock(sma, locknum);
 	rcu_read_unlock();
 out_free:
 	if (sops != fast_sops)
@@ -6250,8 +6250,10 @@ static int push_insn(int t, int w, int e, struct bpf_verifier_env *env,
 		insn_stack[env->cfg.cur_stack++] = w;
 		return 1;
 	} else if ((insn_state[w] & 0xF0) == DISCOVERED) {
-		if (loop_ok && env->allow_ptr_leaks)
+		if (loop_ok && env->allow_ptr_leaks) {
+			env->insn_aux_data[w].loop_head = true;
 			return 0;
+		}
 		verbose_linfo(env, t, "%d: ", t);
 		verbose_linfo(env, w, "%d: ", w);
 		verbose(env, "back-edge from insn %d to %d\n", t, w);
@@ -6675,13 +6677,6 @@ static bool range_within(struct bpf_reg_state *old,
 	       old->smax_value >= cur->smax_value;
 }
 
-/* Maximum number of register states that can exist at once */
-#define ID_MAP_SIZE	(MAX_BPF_REG + MAX_BPF_STACK / BPF_REG_SIZE)
-struct idpair {
-	u32 old;
-	u32 cur;
-};
-
 /* If in the old state two registers had the same id, then they need to have
  * the same id in the new state as well.  But that id could be different from
  * the old state, so we need to track the mapping from old to new ids.
@@ -6692,11 +6687,11 @@ struct idpair {
  * So we look through our idmap to see if this old id has been seen before.  If
  * so, we require the new id to match; otherwise, we add the id pair to the map.
  */
-static bool check_ids(u32 old_id, u32 cur_id, struct idpair *idmap)
+static bool check_ids(u32 old_id, u32 cur_id, struct bpf_id_pair *idmap)
 {
 	unsigned int i;
 
-	for (i = 0; i < ID_MAP_SIZE; i++) {
+	for (i = 0; i < BPF_ID_MAP_SIZE; i++) {
 		if (!idmap[i].old) {
 			/* Reached an empty slot; haven't seen this id before */
 			idmap[i].old = old_id;
@@ -6809,7 +6804,7 @@ static void clean_live_states(struct bpf_verifier_env *env, int insn,
 
 /* Returns true if (rold safe implies rcur safe) */
 static bool regsafe(struct bpf_reg_state *rold, struct bpf_reg_state *rcur,
-		    struct idpair *idmap)
+		    struct bpf_id_pair *idmap)
 {
 	bool equal;
 
@@ -6926,7 +6921,7 @@ static bool regsafe(struct bpf_reg_state *rold, struct bpf_reg_state *rcur,
 
 static bool stacksafe(struct bpf_func_state *old,
 		      struct bpf_func_state *cur,
-		      struct idpair *idmap)
+		      struct bpf_id_pair *idmap)
 {
 	int i, spi;
 
@@ -7023,32 +7018,69 @@ static bool refsafe(struct bpf_func_state *old, struct bpf_func_state *cur)
  * whereas register type in current state is meaningful, it means that
  * the current state will reach 'bpf_exit' instruction safely
  */
-static bool func_states_equal(struct bpf_func_state *old,
+static bool func_states_equal(struct bpf_verifier_env *env,
+			      struct bpf_func_state *old,
 			      struct bpf_func_state *cur)
 {
-	struct idpair *idmap;
-	bool ret = false;
+	struct bpf_id_pair *idmap = env->idmap_scratch;
 	int i;
 
-	idmap = kcalloc(ID_MAP_SIZE, sizeof(struct idpair), GFP_KERNEL);
-	/* If we failed to allocate the idmap, just say it's not safe */
-	if (!idmap)
-		return false;
-
+	memset(idmap, 0, sizeof(env->idmap_scratch));
 	for (i = 0; i < MAX_BPF_REG; i++) {
 		if (!regsafe(&old->regs[i], &cur->regs[i], idmap))
-			goto out_free;
+			return false;
 	}
 
 	if (!stacksafe(old, cur, idmap))
-		goto out_free;
+		return false;
 
 	if (!refsafe(old, cur))
-		goto out_free;
-	ret = true;
-out_free:
-	kfree(idmap);
-	return ret;
+		return false;
+	return true;
+}
+
+/* Cheap necessary condition for func_states_equal(), looking only at
+ * register types and at precise constants.  Every register the explored
+ * state has read must have the same type in the current one, since
+ * regsafe() never accepts a type change other than from NOT_INIT, and a
+ * precise constant scalar only accepts the very same constant.
+ */
+static bool func_states_maybe_equal(struct bpf_func_state *old,
+				    struct bpf_func_state *cur)
+{
+	struct bpf_reg_state *rold, *rcur;
+	int i;
+
+	for (i = 0; i < MAX_BPF_REG; i++) {
+		rold = &old->regs[i];
+		rcur = &cur->regs[i];
+		if (!(rold->live & REG_LIVE_READ) || rold->type == NOT_INIT)
+			continue;
+		if (rold->type != rcur->type)
+			return false;
+		if (rold->type == SCALAR_VALUE && rold->precise &&
+		    tnum_is_const(rold->var_off) &&
+		    !tnum_equals_const(rcur->var_off, rold->var_off.value))
+			return false;
+	}
+	return true;
+}
+
+static bool states_maybe_equal(struct bpf_verifier_state *old,
+			       struct bpf_verifier_state *cur)
+{
+	int i;
+
+	if (old->curframe != cur->curframe)
+		return false;
+
+	for (i = 0; i <= old->curframe; i++) {
+		if (old->frame[i]->callsite != cur->frame[i]->callsite)
+			return false;
+		if (!func_states_maybe_equal(old->frame[i], cur->frame[i]))
+			return false;
+	}
+	return true;
 }
 
 static bool states_equal(struct bpf_verifier_env *env,
@@ -7075,7 +7107,7 @@ static bool states_equal(struct bpf_verifier_env *env,
 	for (i = 0; i <= old->curframe; i++) {
 		if (old->frame[i]->callsite != cur->frame[i]->callsite)
 			return false;
-		if (!func_states_equal(old->frame[i], cur->frame[i]))
+		if (!func_states_equal(env, old->frame[i], cur->frame[i]))
 			return false;
 	}
 	return true;
@@ -7246,6 +7278,14 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 	if (env->jmps_processed - env->prev_jmps_processed >= 2 &&
 	    env->insn_processed - env->prev_insn_processed >= 8)
 		add_new_state = true;
+	/* Loop heads are where the next iteration, or the next path entering
+	 * the loop, can be pruned.  Remember a state there as soon as a jump
+	 * was taken to get here, so that a converging path doesn't have to
+	 * walk the whole loop body once more before it meets a stored state.
+	 */
+	else if (env->insn_aux_data[insn_idx].loop_head &&
+		 env->jmps_processed != env->prev_jmps_processed)
+		add_new_state = true;
 
 	pprev = explored_state(env, insn_idx);
 	sl = *pprev;
@@ -7280,8 +7320,14 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 				add_new_state = false;
 			goto miss;
 		}
+		env->states_checked++;
+		if (!states_maybe_equal(&sl->state, cur)) {
+			env->states_fast_miss++;
+			goto miss;
+		}
 		if (states_equal(env, &sl->state, cur)) {
 			sl->hit_cnt++;
+			env->states_pruned++;
 			/* reached equivalent register/stack state,
 			 * prune the search.
 			 * Registers read by the continuation are read by us.
@@ -9187,8 +9233,20 @@ static void print_verification_stats(struct bpf_verifier_env *env)
 	int i;
 
 	if (env->log.level & BPF_LOG_STATS) {
+		u32 pct = env->states_checked ?
+			  div_u64(env->states_pruned * 100ULL,
+				  env->states_checked) : 0;
+
 		verbose(env, "verification time %lld usec\n",
 			div_u64(env->verification_time, 1000));
+		verbose(env, "phase time cfg %lld do_check %lld fixup %lld usec\n",
+			div_u64(env->cfg_time, 1000),
+			div_u64(env->check_time, 1000),
+			div_u64(env->verification_time - env->cfg_time -
+				env->check_time, 1000));
+		verbose(env, "states checked %u pruned %u (%u%%) fast_miss %u\n",
+			env->states_checked, env->states_pruned, pct,
+			env->states_fast_miss);
 		verbose(env, "stack depth ");
 		for (i = 0; i < env->subprog_cnt; i++) {
 			u32 depth = env->subprog_info[i].stack_depth;
@@ -9209,7 +9267,7 @@ static void print_verification_stats(struct bpf_verifier_env *env)
 int bpf_check(struct bpf_prog **prog, union bpf_attr *attr,
 	      union bpf_attr __user *uattr)
 {
-	u64 start_time = ktime_get_ns();
+	u64 start_time = ktime_get_ns(), phase_time;
 	struct bpf_verifier_env *env;
 	struct bpf_verifier_log *log;
 	int i, len, ret = -EINVAL;
@@ -9295,7 +9353,10 @@ int bpf_check(struct bpf_prog **prog, union bpf_attr *attr,
 	if (ret < 0)
 		goto skip_full_check;
 
+	phase_time = ktime_get_ns();
+	env->cfg_time = phase_time - start_time;
 	ret = do_check(env);
+	env->check_time = ktime_get_ns() - phase_time;
 	if (env->cur_state) {
 		free_verifier_state(env->cur_state, true);
 		env->cur_state = NULL;
@@ -570,6 +570,47 @@ static struct lock_torture_ops rwsem_lock_ops = {
 	.name		= "rwsem_lock"
 };
 
+static struct rw_semaphore torture_rwsem_rbias;
+
+static void torture_rwsem_rbias_init(void)
+{
+	init_rwsem_reader_biased(&torture_rwsem_rbias);
+}
+
+static int torture_rwsem_rbias_down_write(void) __acquires(torture_rwsem_rbias)
+{
+	down_write(&torture_rwsem_rbias);
+	return 0;
+}
+
+static void torture_rwsem_rbias_up_write(void) __releases(torture_rwsem_rbias)
+{
+	up_write(&torture_rwsem_rbias);
+}
+
+static int torture_rwsem_rbias_down_read(void) __acquires(torture_rwsem_rbias)
+{
+	down_read(&torture_rwsem_rbias);
+	return 0;
+}
+
+static void torture_rwsem_rbias_up_read(void) __releases(torture_rwsem_rbias)
+{
+	up_read(&torture_rwsem_rbias);
+}
+
+static struct lock_torture_ops rwsem_rbias_lock_ops = {
+	.init		= torture_rwsem_rbias_init,
+	.writelock	= torture_rwsem_rbias_down_write,
+	.write_delay	= torture_rwsem_write_delay,
+	.task_boost     = torture_boost_dummy,
+	.writeunlock	= torture_rwsem_rbias_up_write,
+	.readlock       = torture_rwsem_rbias_down_read,
+	.read_delay     = torture_rwsem_read_delay,
+	.readunlock     = torture_rwsem_rbias_up_read,
+	.name		= "rwsem_rbias_lock"
+};
+
 #include <linux/percpu-rwsem.h>
 static struct percpu_rw_semaphore pcpu_rwsem;
 
@@ -851,6 +892,7 @@ static int __init lock_torture_init(void)
 		&rtmutex_lock_ops,
 #endif
 		&rwsem_lock_ops,
+		&rwsem_rbias_lock_ops,
 		&percpu_rwsem_lock_ops,
 	};
 
@@ -121,7 +121,8 @@
  * Bit  0    - writer locked bit
  * Bit  1    - waiters present bit
  * Bit  2    - lock handoff bit
- * Bits 3-7  - reserved
+ * Bit  3    - reader-biased bit
+ * Bits 4-7  - reserved
  * Bits 8-62 - 55-bit reader count
  * Bit  63   - read fail bit
  *
@@ -130,7 +131,8 @@
  * Bit  0    - writer locked bit
  * Bit  1    - waiters present bit
  * Bit  2    - lock handoff bit
- * Bits 3-7  - reserved
+ * Bit  3    - reader-biased bit
+ * Bits 4-7  - reserved
  * Bits 8-30 - 23-bit reader count
  * Bit  31   - read fail bit
  *
@@ -150,10 +152,20 @@
  * For all the above cases, wait_lock will be held. A writer must also
  * be the first one in the wait_list to be eligible for setting the handoff
  * bit. So concurrent setting/clearing of handoff bit is not possible.
+ *
+ * The reader-biased bit is set once before the rwsem is used and never
+ * changes afterwards. It is the only bit that may be set in the count of
+ * a free rwsem. When it is set, the down_read() fastpath ignores the
+ * waiters bit so that new readers keep joining the current reader phase
+ * instead of queueing behind writers. Writers are not starved as the
+ * first waiting writer will set the handoff bit after RWSEM_WAIT_TIMEOUT,
+ * which blocks all new readers again. As overlapping readers may keep the
+ * lock busy forever, that writer sleeps no longer than its timeout.
  */
 #define RWSEM_WRITER_LOCKED	(1UL << 0)
 #define RWSEM_FLAG_WAITERS	(1UL << 1)
 #define RWSEM_FLAG_HANDOFF	(1UL << 2)
+#define RWSEM_FLAG_RBIASED	RWSEM_READER_BIASED
 #define RWSEM_FLAG_READFAIL	(1UL << (BITS_PER_LONG - 1))
 
 #define RWSEM_READER_SHIFT	8
@@ -163,6 +175,8 @@
 #define RWSEM_LOCK_MASK		(RWSEM_WRITER_MASK|RWSEM_READER_MASK)
 #define RWSEM_READ_FAILED_MASK	(RWSEM_WRITER_MASK|RWSEM_FLAG_WAITERS|\
 				 RWSEM_FLAG_HANDOFF|RWSEM_FLAG_READFAIL)
+#define RWSEM_RBIAS_FAILED_MASK	(RWSEM_WRITER_MASK|RWSEM_FLAG_HANDOFF|\
+				 RWSEM_FLAG_READFAIL)
 
 /*
  * All writes to owner are protected by WRITE_ONCE() to make sure that
@@ -275,7 +289,35 @@ static inline bool rwsem_read_trylock(struct rw_semaphore *sem)
 	long cnt = atomic_long_add_return_acquire(RWSEM_READER_BIAS, &sem->count);
 	if (WARN_ON_ONCE(cnt < 0))
 		rwsem_set_nonspinnable(sem);
-	return !(cnt & RWSEM_READ_FAILED_MASK);
+	if (likely(!(cnt & RWSEM_READ_FAILED_MASK)))
+		return true;
+
+	/*
+	 * A reader-biased rwsem can still be read-locked with waiters
+	 * queued as long as no writer owns it and no handoff is pending.
+	 */
+	if ((cnt & RWSEM_FLAG_RBIASED) && !(cnt & RWSEM_RBIAS_FAILED_MASK)) {
+		lockevent_inc(rwsem_rlock_biased);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Try to acquire the write lock of a free rwsem. The reader-biased bit,
+ * if set, has to be carried over.
+ */
+static inline bool rwsem_write_trylock(struct rw_semaphore *sem)
+{
+	long tmp = RWSEM_UNLOCKED_VALUE;
+
+	if (likely(atomic_long_try_cmpxchg_acquire(&sem->count, &tmp,
+						   RWSEM_WRITER_LOCKED)))
+		return true;
+
+	return (tmp == RWSEM_FLAG_RBIASED) &&
+		atomic_long_try_cmpxchg_acquire(&sem->count, &tmp,
+				RWSEM_FLAG_RBIASED | RWSEM_WRITER_LOCKED);
 }
 
 /*
@@ -340,6 +382,18 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 }
 EXPORT_SYMBOL(__init_rwsem);
 
+/*
+ * Turn a freshly initialized rwsem into a reader-biased one. This must be
+ * done before the rwsem is used.
+ */
+void rwsem_set_reader_biased(struct rw_semaphore *sem)
+{
+	DEBUG_RWSEMS_WARN_ON(atomic_long_read(&sem->count) !=
+			     RWSEM_UNLOCKED_VALUE, sem);
+	atomic_long_or(RWSEM_FLAG_RBIASED, &sem->count);
+}
+EXPORT_SYMBOL(rwsem_set_reader_biased);
+
 enum rwsem_waiter_type {
 	RWSEM_WAITING_FOR_WRITE,
 	RWSEM_WAITING_FOR_READ
@@ -1211,7 +1265,17 @@ rwsem_down_write_slowpath(struct rw_semaphore *sem, int state)
 			if (signal_pending_state(state, current))
 				goto out_nolock;
 
-			schedule();
+			/*
+			 * Nobody may wake us up while readers keep entering
+			 * a reader-biased rwsem, so wake up in time to set
+			 * the handoff bit.
+			 */
+			if (wstate == WRITER_FIRST &&
+			    (atomic_long_read(&sem->count) & RWSEM_FLAG_RBIASED))
+				schedule_timeout(max_t(long, waiter.timeout -
+							     jiffies + 1, 1));
+			else
+				schedule();
 			lockevent_inc(rwsem_sleep_writer);
 			set_current_state(state);
 			/*
@@ -1358,10 +1422,7 @@ static inline int __down_read_trylock(struct rw_semaphore *sem)
  */
 static inline void __down_write(struct rw_semaphore *sem)
 {
-	long tmp = RWSEM_UNLOCKED_VALUE;
-
-	if (unlikely(!atomic_long_try_cmpxchg_acquire(&sem->count, &tmp,
-						      RWSEM_WRITER_LOCKED)))
+	if (unlikely(!rwsem_write_trylock(sem)))
 		rwsem_down_write_slowpath(sem, TASK_UNINTERRUPTIBLE);
 	else
 		rwsem_set_owner(sem);
@@ -1369,10 +1430,7 @@ static inline void __down_write(struct rw_semaphore *sem)
 
 static inline int __down_write_killable(struct rw_semaphore *sem)
 {
-	long tmp = RWSEM_UNLOCKED_VALUE;
-
-	if (unlikely(!atomic_long_try_cmpxchg_acquire(&sem->count, &tmp,
-						      RWSEM_WRITER_LOCKED))) {
+	if (unlikely(!rwsem_write_trylock(sem))) {
 		if (IS_ERR(rwsem_down_write_slowpath(sem, TASK_KILLABLE)))
 			return -EINTR;
 	} else {
@@ -1383,10 +1441,7 @@ static inline int __down_write_killable(struct rw_semaphore *sem)
 
 static inline int __down_write_trylock(struct rw_semaphore *sem)
 {
-	long tmp = RWSEM_UNLOCKED_VALUE;
-
-	if (atomic_long_try_cmpxchg_acquire(&sem->count, &tmp,
-					    RWSEM_WRITER_LOCKED)) {
+	if (rwsem_write_trylock(sem)) {
 		rwsem_set_owner(sem);
 		return true;
 	}
@@ -0,0 +1,775 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/* Software flow table for bridged traffic.
+ *
+ * Flows are keyed on the input port, the VLAN and PPPoE session headers and
+ * the IPv4/IPv6 TCP/UDP tuple. Established connections forwarded between two
+ * ports of a bridge family flowtable are added to it from the bridge forward
+ * hook, that is, once the ruleset has accepted them. From then on, the
+ * ingress hook of the port sends their packets straight to the egress port,
+ * tagged as the bridge would have done it.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_bridge.h>
+#include <linux/if_vlan.h>
+#include <linux/if_pppox.h>
+#include <linux/ppp_defs.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/ip.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+#include <net/netfilter/nf_flow_table.h>
+#include <net/netfilter/nf_tables.h>
+
+#include "../br_private.h"
+
+/* PPPoE session header followed by the PPP protocol */
+#define NF_FLOW_BRIDGE_PPPOE_HLEN	(sizeof(struct pppoe_hdr) + 2)
+
+#define NF_FLOW_BRIDGE_TCP_PICKUP_TIMEOUT	(120 * HZ)
+#define NF_FLOW_BRIDGE_UDP_PICKUP_TIMEOUT	(30 * HZ)
+
+struct nf_flow_bridge {
+	struct flow_offload	flow;
+	struct nf_conn		*ct;
+	/* VLAN of the forwarding database entries, zero without filtering */
+	u16			vid;
+	struct rcu_head		rcu_head;
+};
+
+static const struct rhashtable_params nf_flow_bridge_rhash_params = {
+	.head_offset		= offsetof(struct flow_offload_tuple_rhash, node),
+	.key_offset		= offsetof(struct flow_offload_tuple_rhash, tuple),
+	.key_len		= offsetof(struct flow_offload_tuple, dir),
+	.automatic_shrinking	= true,
+};
+
+static struct nf_flowtable_type flowtable_bridge;
+
+/* Walks the active bridge flowtables of @net, under rcu_read_lock(). */
+#define nf_flow_bridge_for_each(__net, __table, __ft)			\
+	list_for_each_entry_rcu(__table, &(__net)->nft.tables, list)	\
+		if (__table->family != NFPROTO_BRIDGE) {} else		\
+		list_for_each_entry_rcu(__ft, &__table->flowtables, list) \
+			if (!nft_is_active(__net, __ft) ||		\
+			    __ft->data.type != &flowtable_bridge) {} else
+
+static bool nf_flow_bridge_push_encap(struct flow_offload_tuple *tuple,
+				      u16 id, __be16 proto)
+{
+	if (tuple->encap_num == NF_FLOW_TABLE_ENCAP_MAX)
+		return false;
+
+	tuple->encap[tuple->encap_num].id = id;
+	tuple->encap[tuple->encap_num].proto = proto;
+	tuple->encap_num++;
+
+	return true;
+}
+
+/* Parses the VLAN and PPPoE session headers in front of the IP header. An
+ * outer VLAN tag has already been taken out of the packet data by the
+ * receive path, the caller accounts for it.
+ */
+static int nf_flow_bridge_parse_encap(struct sk_buff *skb,
+				      struct flow_offload_tuple *tuple,
+				      __be16 *proto, unsigned int *nhoff)
+{
+	__be16 type = skb->protocol;
+	unsigned int off = 0;
+
+	if (eth_type_vlan(type)) {
+		struct vlan_hdr *vhdr;
+
+		if (!pskb_may_pull(skb, off + VLAN_HLEN))
+			return -1;
+
+		vhdr = (struct vlan_hdr *)(skb->data + off);
+		if (!nf_flow_bridge_push_encap(tuple,
+					       ntohs(vhdr->h_vlan_TCI) & VLAN_VID_MASK,
+					       type))
+			return -1;
+
+		type = vhdr->h_vlan_encapsulated_proto;
+		off += VLAN_HLEN;
+	}
+
+	if (type == htons(ETH_P_PPP_SES)) {
+		struct pppoe_hdr *ph;
+
+		if (!pskb_may_pull(skb, off + NF_FLOW_BRIDGE_PPPOE_HLEN))
+			return -1;
+
+		ph = (struct pppoe_hdr *)(skb->data + off);
+		if (ph->ver != 1 || ph->type != 1 || ph->code)
+			return -1;
+
+		switch (*(__be16 *)(ph + 1)) {
+		case htons(PPP_IP):
+			type = htons(ETH_P_IP);
+			break;
+		case htons(PPP_IPV6):
+			type = htons(ETH_P_IPV6);
+			break;
+		default:
+			return -1;
+		}
+
+		if (!nf_flow_bridge_push_encap(tuple, ntohs(ph->sid),
+					       htons(ETH_P_PPP_SES)))
+			return -1;
+
+		off += NF_FLOW_BRIDGE_PPPOE_HLEN;
+	}
+
+	*proto = type;
+	*nhoff = off;
+
+	return 0;
+}
+
+static int nf_flow_bridge_parse(struct sk_buff *skb,
+				struct flow_offload_tuple *tuple,
+				unsigned int *thoffp)
+{
+	unsigned int nhoff, thoff, hdrsize;
+	struct flow_ports *ports;
+	__be16 proto;
+	u8 l4proto;
+
+	if (nf_flow_bridge_parse_encap(skb, tuple, &proto, &nhoff) < 0)
+		return -1;
+
+	switch (proto) {
+	case htons(ETH_P_IP): {
+		struct iphdr *iph;
+
+		if (!pskb_may_pull(skb, nhoff + sizeof(*iph)))
+			return -1;
+
+		iph = (struct iphdr *)(skb->data + nhoff);
+		if (iph->ihl != 5 || ip_is_fragment(iph))
+			return -1;
+
+		tuple->src_v4.s_addr	= iph->saddr;
+		tuple->dst_v4.s_addr	= iph->daddr;
+		tuple->l3proto		= AF_INET;
+		l4proto			= iph->protocol;
+		thoff			= nhoff + sizeof(*iph);
+		break;
+	}
+	case htons(ETH_P_IPV6): {
+		struct ipv6hdr *ip6h;
+
+		if (!pskb_may_pull(skb, nhoff + sizeof(*ip6h)))
+			return -1;
+
+		ip6h = (struct ipv6hdr *)(skb->data + nhoff);
+		tuple->src_v6		= ip6h->saddr;
+		tuple->dst_v6		= ip6h->daddr;
+		tuple->l3proto		= AF_INET6;
+		l4proto			= ip6h->nexthdr;
+		thoff			= nhoff + sizeof(*ip6h);
+		break;
+	}
+	default:
+		return -1;
+	}
+
+	switch (l4proto) {
+	case IPPROTO_TCP:
+		hdrsize = sizeof(struct tcphdr);
+		break;
+	case IPPROTO_UDP:
+		hdrsize = sizeof(struct udphdr);
+		break;
+	default:
+		return -1;
+	}
+
+	if (!pskb_may_pull(skb, thoff + hdrsize))
+		return -1;
+
+	ports = (struct flow_ports *)(skb->data + thoff);
+	tuple->src_port		= ports->source;
+	tuple->dst_port		= ports->dest;
+	tuple->l4proto		= l4proto;
+	*thoffp			= thoff;
+
+	return 0;
+}
+
+static bool nf_flow_bridge_tcp_fin(struct sk_buff *skb, unsigned int thoff)
+{
+	struct tcphdr *tcph = (struct tcphdr *)(skb->data + thoff);
+
+	return tcph->fin || tcph->rst;
+}
+
+static void nf_flow_bridge_teardown(struct flow_offload *flow)
+{
+	flow->flags |= FLOW_OFFLOAD_TEARDOWN;
+}
+
+static unsigned int
+nf_flow_offload_bridge_hook(void *priv, struct sk_buff *skb,
+			    const struct nf_hook_state *state)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct nf_flowtable *flow_table = priv;
+	struct flow_offload_tuple tuple = {};
+	const struct flow_offload_tuple *reply;
+	struct net_bridge_port *in, *out;
+	struct net_bridge_fdb_entry *fdb;
+	enum flow_offload_tuple_dir dir;
+	struct nf_flow_bridge *entry;
+	unsigned int thoff;
+	u16 prio = 0;
+	int inner;
+
+	if (!is_unicast_ether_addr(eth_hdr(skb)->h_dest) ||
+	    !netif_is_bridge_port(state->in))
+		return NF_ACCEPT;
+
+	in = br_port_get_rcu(state->in);
+	if (!in || in->state != BR_STATE_FORWARDING)
+		return NF_ACCEPT;
+
+	if (skb_vlan_tag_present(skb)) {
+		prio = skb_vlan_tag_get_prio(skb) << VLAN_PRIO_SHIFT;
+		nf_flow_bridge_push_encap(&tuple, skb_vlan_tag_get_id(skb),
+					  skb->vlan_proto);
+	}
+
+	if (nf_flow_bridge_parse(skb, &tuple, &thoff) < 0)
+		return NF_ACCEPT;
+
+	tuple.iifidx = state->in->ifindex;
+	tuplehash = rhashtable_lookup(&flow_table->rhashtable, &tuple,
+				      nf_flow_bridge_rhash_params);
+	if (!tuplehash) {
+		this_cpu_inc(flow_table->stats->miss);
+		return NF_ACCEPT;
+	}
+
+	dir = tuplehash->tuple.dir;
+	entry = container_of(tuplehash, struct nf_flow_bridge,
+			     flow.tuplehash[dir]);
+	reply = &entry->flow.tuplehash[!dir].tuple;
+
+	if (unlikely(entry->flow.flags & FLOW_OFFLOAD_TEARDOWN))
+		return NF_ACCEPT;
+
+	if (tuple.l4proto == IPPROTO_TCP && nf_flow_bridge_tcp_fin(skb, thoff)) {
+		nf_flow_bridge_teardown(&entry->flow);
+		return NF_ACCEPT;
+	}
+
+	/* The station may have moved since the flow was added. */
+	fdb = br_fdb_find_rcu(in->br, eth_hdr(skb)->h_dest, entry->vid);
+	out = fdb ? READ_ONCE(fdb->dst) : NULL;
+	if (!out || fdb->is_local || out->dev->ifindex != reply->iifidx ||
+	    out->state != BR_STATE_FORWARDING) {
+		nf_flow_bridge_teardown(&entry->flow);
+		return NF_ACCEPT;
+	}
+
+	skb_push(skb, ETH_HLEN);
+	if (unlikely(!is_skb_forwardable(out->dev, skb))) {
+		skb_pull(skb, ETH_HLEN);
+		return NF_ACCEPT;
+	}
+
+	entry->flow.timeout = (u32)jiffies + NF_FLOW_TIMEOUT;
+
+	/* The headers left in the packet data are the same on both ports, the
+	 * egress port only differs in the outer VLAN tag, if any.
+	 */
+	inner = tuple.encap_num - skb_vlan_tag_present(skb);
+	if (reply->encap_num > inner)
+		__vlan_hwaccel_put_tag(skb, reply->encap[0].proto,
+				       reply->encap[0].id | prio);
+	else
+		__vlan_hwaccel_clear_tag(skb);
+
+	this_cpu_inc(flow_table->stats->hit);
+
+	skb_forward_csum(skb);
+	skb->dev = out->dev;
+	dev_queue_xmit(skb);
+
+	return NF_STOLEN;
+}
+
+static void nf_flow_bridge_tuple(struct flow_offload_tuple *tuple,
+				 const struct nf_conntrack_tuple *ctt,
+				 int iifidx, enum flow_offload_tuple_dir dir)
+{
+	switch (ctt->src.l3num) {
+	case NFPROTO_IPV4:
+		tuple->src_v4 = ctt->src.u3.in;
+		tuple->dst_v4 = ctt->dst.u3.in;
+		break;
+	case NFPROTO_IPV6:
+		tuple->src_v6 = ctt->src.u3.in6;
+		tuple->dst_v6 = ctt->dst.u3.in6;
+		break;
+	}
+
+	tuple->l3proto		= ctt->src.l3num;
+	tuple->l4proto		= ctt->dst.protonum;
+	tuple->src_port		= ctt->src.u.tcp.port;
+	tuple->dst_port		= ctt->dst.u.tcp.port;
+	tuple->iifidx		= iifidx;
+	tuple->dir		= dir;
+}
+
+static bool nf_flow_bridge_ct_ok(const struct nf_conn *ct,
+				 enum ip_conntrack_info ctinfo)
+{
+	if (ctinfo != IP_CT_ESTABLISHED && ctinfo != IP_CT_ESTABLISHED_REPLY)
+		return false;
+
+	if (!nf_ct_is_confirmed(ct) || nf_ct_is_dying(ct) || nfct_help(ct) ||
+	    ct->status & (IPS_NAT_MASK | IPS_SEQ_ADJUST))
+		return false;
+
+	switch (nf_ct_protonum(ct)) {
+	case IPPROTO_TCP:
+		return ct->proto.tcp.state == TCP_CONNTRACK_ESTABLISHED;
+	case IPPROTO_UDP:
+		return true;
+	}
+
+	return false;
+}
+
+static bool nf_flow_bridge_has_dev(const struct nft_flowtable *flowtable,
+				   const struct net_device *dev)
+{
+	int i;
+
+	for (i = 0; i < flowtable->ops_len; i++) {
+		if (flowtable->ops[i].dev == dev)
+			return true;
+	}
+
+	return false;
+}
+
+static struct nf_flowtable *nf_flow_bridge_find(struct net *net,
+						const struct net_device *in,
+						const struct net_device *out)
+{
+	struct nft_flowtable *flowtable;
+	struct nft_table *table;
+
+	nf_flow_bridge_for_each(net, table, flowtable) {
+		if (nf_flow_bridge_has_dev(flowtable, in) &&
+		    nf_flow_bridge_has_dev(flowtable, out))
+			return &flowtable->data;
+	}
+
+	return NULL;
+}
+
+/* Outer VLAN tag of the packets received on @p, which are assumed to be
+ * tagged as the bridge sends them to @p.
+ */
+static int nf_flow_bridge_port_vlan(const struct net_bridge_port *p,
+				    struct flow_offload_tuple *tuple, u16 vid)
+{
+	struct net_bridge_vlan *v;
+
+	v = br_vlan_find(nbp_vlan_group_rcu(p), vid);
+	if (!v)
+		return -1;
+
+	if (!(v->flags & BRIDGE_VLAN_INFO_UNTAGGED))
+		nf_flow_bridge_push_encap(tuple, vid, p->br->vlan_proto);
+
+	return 0;
+}
+
+static void nf_flow_bridge_add(struct nf_flowtable *flow_table,
+			       struct sk_buff *skb, struct nf_conn *ct,
+			       enum ip_conntrack_info ctinfo,
+			       const struct nf_hook_state *state)
+{
+	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
+	struct flow_offload_tuple *tuple, *reply;
+	struct net_bridge_port *in, *out;
+	struct nf_flow_bridge *entry;
+	unsigned int nhoff;
+	__be16 proto;
+	int err;
+
+	in = br_port_get_rcu(state->in);
+	out = br_port_get_rcu(state->out);
+	if (!in || !out || (in->flags | out->flags) & BR_VLAN_TUNNEL)
+		return;
+
+	if (test_and_set_bit(IPS_OFFLOAD_BIT, &ct->status))
+		return;
+
+	entry = kzalloc(sizeof(*entry), GFP_ATOMIC);
+	if (!entry)
+		goto err_clear;
+
+	tuple = &entry->flow.tuplehash[dir].tuple;
+	reply = &entry->flow.tuplehash[!dir].tuple;
+
+#ifdef CONFIG_BRIDGE_VLAN_FILTERING
+	if (BR_INPUT_SKB_CB(skb)->vlan_filtered) {
+		/* br_handle_vlan() only marks the tag as absent when the
+		 * packet leaves untagged, vlan_tci is still its VLAN.
+		 */
+		entry->vid = skb->vlan_tci & VLAN_VID_MASK;
+		if (nf_flow_bridge_port_vlan(in, tuple, entry->vid) < 0)
+			goto err_free;
+	} else
+#endif
+	if (skb_vlan_tag_present(skb)) {
+		nf_flow_bridge_push_encap(tuple, skb_vlan_tag_get_id(skb),
+					  skb->vlan_proto);
+	}
+
+	if (skb_vlan_tag_present(skb))
+		nf_flow_bridge_push_encap(reply, skb_vlan_tag_get_id(skb),
+					  skb->vlan_proto);
+
+	if (nf_flow_bridge_parse_encap(skb, tuple, &proto, &nhoff) < 0 ||
+	    nf_flow_bridge_parse_encap(skb, reply, &proto, &nhoff) < 0)
+		goto err_free;
+
+	nf_flow_bridge_tuple(tuple, &ct->tuplehash[dir].tuple,
+			     state->in->ifindex, dir);
+	nf_flow_bridge_tuple(reply, &ct->tuplehash[!dir].tuple,
+			     state->out->ifindex, !dir);
+
+	if (!atomic_inc_not_zero(&ct->ct_general.use))
+		goto err_free;
+
+	entry->ct = ct;
+	entry->flow.timeout = (u32)jiffies + NF_FLOW_TIMEOUT;
+
+	err = rhashtable_insert_fast(&flow_table->rhashtable,
+				     &entry->flow.tuplehash[0].node,
+				     nf_flow_bridge_rhash_params);
+	if (err < 0)
+		goto err_put;
+
+	err = rhashtable_insert_fast(&flow_table->rhashtable,
+				     &entry->flow.tuplehash[1].node,
+				     nf_flow_bridge_rhash_params);
+	if (err < 0) {
+		rhashtable_remove_fast(&flow_table->rhashtable,
+				       &entry->flow.tuplehash[0].node,
+				       nf_flow_bridge_rhash_params);
+		goto err_put;
+	}
+
+	this_cpu_inc(flow_table->stats->offloaded);
+
+	return;
+
+err_put:
+	nf_ct_put(ct);
+err_free:
+	kfree_rcu(entry, rcu_head);
+err_clear:
+	clear_bit(IPS_OFFLOAD_BIT, &ct->status);
+}
+
+static unsigned int nf_flow_bridge_forward(void *priv, struct sk_buff *skb,
+					   const struct nf_hook_state *state)
+{
+	struct nf_flowtable *flow_table;
+	enum ip_conntrack_info ctinfo;
+	struct nf_conn *ct;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct || test_bit(IPS_OFFLOAD_BIT, &ct->status) ||
+	    !nf_flow_bridge_ct_ok(ct, ctinfo))
+		return NF_ACCEPT;
+
+	flow_table = nf_flow_bridge_find(state->net, state->in, state->out);
+	if (flow_table)
+		nf_flow_bridge_add(flow_table, skb, ct, ctinfo, state);
+
+	return NF_ACCEPT;
+}
+
+static const struct nf_hook_ops nf_flow_bridge_ops[] = {
+	{
+		.hook		= nf_flow_bridge_forward,
+		.pf		= NFPROTO_BRIDGE,
+		.hooknum	= NF_BR_FORWARD,
+		.priority	= NF_BR_PRI_LAST,
+	},
+};
+
+/* Let conntrack pick up the connection again, as upon flow offload teardown. */
+static void nf_flow_bridge_fixup_ct(struct nf_conn *ct)
+{
+	switch (nf_ct_protonum(ct)) {
+	case IPPROTO_TCP:
+		ct->proto.tcp.seen[0].td_maxwin = 0;
+		ct->proto.tcp.seen[1].td_maxwin = 0;
+		if (ct->proto.tcp.state == TCP_CONNTRACK_ESTABLISHED)
+			ct->timeout = nfct_time_stamp +
+				      NF_FLOW_BRIDGE_TCP_PICKUP_TIMEOUT;
+		break;
+	case IPPROTO_UDP:
+		ct->timeout = nfct_time_stamp + NF_FLOW_BRIDGE_UDP_PICKUP_TIMEOUT;
+		break;
+	}
+}
+
+static void nf_flow_bridge_del(struct nf_flowtable *flow_table,
+			       struct nf_flow_bridge *entry)
+{
+	struct nf_conn *ct = entry->ct;
+
+	rhashtable_remove_fast(&flow_table->rhashtable,
+			       &entry->flow.tuplehash[0].node,
+			       nf_flow_bridge_rhash_params);
+	rhashtable_remove_fast(&flow_table->rhashtable,
+			       &entry->flow.tuplehash[1].node,
+			       nf_flow_bridge_rhash_params);
+
+	if (!nf_ct_is_dying(ct))
+		nf_flow_bridge_fixup_ct(ct);
+	clear_bit(IPS_OFFLOAD_BIT, &ct->status);
+	nf_ct_put(ct);
+
+	kfree_rcu(entry, rcu_head);
+}
+
+static void nf_flow_bridge_iterate(struct nf_flowtable *flow_table,
+				   void (*iter)(struct nf_flowtable *flow_table,
+						struct nf_flow_bridge *entry,
+						void *data),
+				   void *data)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct rhashtable_iter hti;
+
+	rhashtable_walk_enter(&flow_table->rhashtable, &hti);
+	rhashtable_walk_start(&hti);
+
+	while ((tuplehash = rhashtable_walk_next(&hti))) {
+		if (IS_ERR(tuplehash)) {
+			if (PTR_ERR(tuplehash) != -EAGAIN)
+				break;
+			continue;
+		}
+		if (tuplehash->tuple.dir)
+			continue;
+
+		iter(flow_table, container_of(tuplehash, struct nf_flow_bridge,
+					      flow.tuplehash[0]), data);
+	}
+
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+}
+
+static void nf_flow_bridge_gc_step(struct nf_flowtable *flow_table,
+				   struct nf_flow_bridge *entry, void *data)
+{
+	if ((__s32)(entry->flow.timeout - (u32)jiffies) <= 0 ||
+	    entry->flow.flags & FLOW_OFFLOAD_TEARDOWN ||
+	    nf_ct_is_dying(entry->ct))
+		nf_flow_bridge_del(flow_table, entry);
+}
+
+static void nf_flow_bridge_gc_work(struct work_struct *work)
+{
+	struct nf_flowtable *flow_table;
+
+	flow_table = container_of(work, struct nf_flowtable, gc_work.work);
+	nf_flow_bridge_iterate(flow_table, nf_flow_bridge_gc_step, NULL);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work, HZ);
+}
+
+static int nf_flow_bridge_init(struct nf_flowtable *flow_table)
+{
+	int err;
+
+	flow_table->stats = alloc_percpu(struct nf_flowtable_stats);
+	if (!flow_table->stats)
+		return -ENOMEM;
+
+	err = rhashtable_init(&flow_table->rhashtable,
+			      &nf_flow_bridge_rhash_params);
+	if (err < 0) {
+		free_percpu(flow_table->stats);
+		return err;
+	}
+
+	INIT_DEFERRABLE_WORK(&flow_table->gc_work, nf_flow_bridge_gc_work);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work, HZ);
+
+	return 0;
+}
+
+static void nf_flow_bridge_flush(struct nf_flowtable *flow_table,
+				 struct nf_flow_bridge *entry, void *data)
+{
+	nf_flow_bridge_del(flow_table, entry);
+}
+
+static void nf_flow_bridge_free(struct nf_flowtable *flow_table)
+{
+	cancel_delayed_work_sync(&flow_table->gc_work);
+	nf_flow_bridge_iterate(flow_table, nf_flow_bridge_flush, NULL);
+	rhashtable_destroy(&flow_table->rhashtable);
+	free_percpu(flow_table->stats);
+}
+
+static struct nf_flowtable_type flowtable_bridge = {
+	.family		= NFPROTO_BRIDGE,
+	.init		= nf_flow_bridge_init,
+	.free		= nf_flow_bridge_free,
+	.hook		= nf_flow_offload_bridge_hook,
+	.owner		= THIS_MODULE,
+};
+
+static void nf_flow_bridge_cleanup_dev(struct nf_flowtable *flow_table,
+				       struct nf_flow_bridge *entry, void *data)
+{
+	const struct net_device *dev = data;
+
+	if (entry->flow.tuplehash[0].tuple.iifidx == dev->ifindex ||
+	    entry->flow.tuplehash[1].tuple.iifidx == dev->ifindex)
+		nf_flow_bridge_teardown(&entry->flow);
+}
+
+static int nf_flow_bridge_netdev_event(struct notifier_block *this,
+				       unsigned long event, void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+	struct nft_flowtable *flowtable;
+	struct nft_table *table;
+	struct net *net;
+
+	if (event != NETDEV_DOWN && event != NETDEV_CHANGEUPPER)
+		return NOTIFY_DONE;
+
+	net = dev_net(dev);
+	rcu_read_lock();
+	nf_flow_bridge_for_each(net, table, flowtable) {
+		nf_flow_bridge_iterate(&flowtable->data,
+				       nf_flow_bridge_cleanup_dev, dev);
+		mod_delayed_work(system_power_efficient_wq,
+				 &flowtable->data.gc_work, 0);
+	}
+	rcu_read_unlock();
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block nf_flow_bridge_netdev_notifier = {
+	.notifier_call	= nf_flow_bridge_netdev_event,
+};
+
+static int nf_flow_bridge_stats_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq_file_net(seq);
+	struct nft_flowtable *flowtable;
+	struct nft_table *table;
+	int cpu;
+
+	rcu_read_lock();
+	nf_flow_bridge_for_each(net, table, flowtable) {
+		struct nf_flowtable *flow_table = &flowtable->data;
+		struct nf_flowtable_stats sum = {};
+
+		for_each_possible_cpu(cpu) {
+			const struct nf_flowtable_stats *stats;
+
+			stats = per_cpu_ptr(flow_table->stats, cpu);
+			sum.hit += stats->hit;
+			sum.miss += stats->miss;
+			sum.offloaded += stats->offloaded;
+		}
+
+		seq_printf(seq, "%s %s flows %u hit %llu miss %llu offloaded %llu\n",
+			   table->name, flowtable->name,
+			   atomic_read(&flow_table->rhashtable.nelems) / 2,
+			   sum.hit, sum.miss, sum.offloaded);
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int __net_init nf_flow_bridge_net_init(struct net *net)
+{
+	int err;
+
+	if (!proc_create_net_single("nf_flowtable_bridge", 0444, net->proc_net,
+				    nf_flow_bridge_stats_show, NULL))
+		return -ENOMEM;
+
+	err = nf_register_net_hooks(net, nf_flow_bridge_ops,
+				    ARRAY_SIZE(nf_flow_bridge_ops));
+	if (err < 0)
+		remove_proc_entry("nf_flowtable_bridge", net->proc_net);
+
+	return err;
+}
+
+static void __net_exit nf_flow_bridge_net_exit(struct net *net)
+{
+	nf_unregister_net_hooks(net, nf_flow_bridge_ops,
+				ARRAY_SIZE(nf_flow_bridge_ops));
+	remove_proc_entry("nf_flowtable_bridge", net->proc_net);
+}
+
+static struct pernet_operations nf_flow_bridge_net_ops = {
+	.init	= nf_flow_bridge_net_init,
+	.exit	= nf_flow_bridge_net_exit,
+};
+
+static int __init nf_flow_bridge_module_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&nf_flow_bridge_net_ops);
+	if (err < 0)
+		return err;
+
+	err = register_netdevice_notifier(&nf_flow_bridge_netdev_notifier);
+	if (err < 0) {
+		unregister_pernet_subsys(&nf_flow_bridge_net_ops);
+		return err;
+	}
+
+	nft_register_flowtable_type(&flowtable_bridge);
+
+	return 0;
+}
+
+static void __exit nf_flow_bridge_module_exit(void)
+{
+	nft_unregister_flowtable_type(&flowtable_bridge);
+	unregister_netdevice_notifier(&nf_flow_bridge_netdev_notifier);
+	unregister_pernet_subsys(&nf_flow_bridge_net_ops);
+	rcu_barrier();
+}
+
+module_init(nf_flow_bridge_module_init);
+module_exit(nf_flow_bridge_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Bridge flow table software fast path");
+MODULE_ALIAS_NF_FLOWTABLE(AF_BRIDGE);
@@ -15,6 +15,9 @@
 #include <linux/netdevice.h>
 #include <linux/module.h>
 #include <linux/icmp.h>
+#include <linux/jhash.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 #include <net/ip.h>
 #include <net/compat.h>
 #include <linux/uaccess.h>
@@ -25,6 +28,7 @@
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
 
@@ -33,6 +37,10 @@ MODULE_AUTHOR("Netfilter Core Team <coreteam@netfilter.org>");
 MODULE_DESCRIPTION("IPv4 packet filter");
 MODULE_ALIAS("ipt_icmp");
 
+static bool vcache __read_mostly;
+module_param(vcache, bool, 0644);
+MODULE_PARM_DESC(vcache, "Cache verdicts of stateless chains (tables loaded afterwards, default off)");
+
 void *ipt_alloc_initial_table(const struct xt_table *info)
 {
 	return xt_alloc_initial_table(ipt, IPT);
@@ -220,6 +228,148 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+/* Verdict cache
+ *
+ * When no rule reachable from a hook looks at more than the addresses,
+ * protocol, ports and interfaces of a packet, and every target on the way
+ * is a verdict or a jump, the verdict of the hook is a function of those
+ * fields. It is then cached per cpu, together with the rules whose
+ * counters were updated, so that the next packets of a flow skip the rule
+ * traversal. The cache belongs to the table info, thus it is dropped on
+ * every table replace.
+ */
+#define IPT_VCACHE_BITS		7
+#define IPT_VCACHE_SIZE		(1 << IPT_VCACHE_BITS)
+/* Max. number of matching rules on the way to a cacheable verdict */
+#define IPT_VCACHE_PATH		4
+
+struct ipt_vcache_key {
+	__be32 saddr;
+	__be32 daddr;
+	__be16 sport;
+	__be16 dport;
+	u8 protocol;
+	u8 hook;
+};
+
+struct ipt_vcache_entry {
+	struct ipt_vcache_key key;
+	bool valid;
+	u8 npath;
+	unsigned int verdict;
+	unsigned int path[IPT_VCACHE_PATH];	/* offsets of the rules */
+	char indev[IFNAMSIZ] __aligned(sizeof(long));
+	char outdev[IFNAMSIZ] __aligned(sizeof(long));
+};
+
+struct ipt_vcache {
+	struct ipt_vcache_entry slot[IPT_VCACHE_SIZE];
+};
+
+/* Fill out the cache key; returns false if the packet can't be cached */
+static inline bool
+ipt_vcache_key(const struct sk_buff *skb, const struct iphdr *ip,
+	       const struct xt_action_param *par, unsigned int hook,
+	       struct ipt_vcache_key *key)
+{
+	union {
+		struct tcphdr tcp;
+		struct udphdr udp;
+	} _hdr;
+	const __be16 *ports;
+
+	/* The port matches don't match non-first fragments */
+	if (par->fragoff)
+		return false;
+
+	key->saddr = ip->saddr;
+	key->daddr = ip->daddr;
+	key->protocol = ip->protocol;
+	key->hook = hook;
+
+	/* Read as much as the port matches would, which hotdrop otherwise */
+	switch (ip->protocol) {
+	case IPPROTO_TCP:
+		ports = skb_header_pointer(skb, par->thoff,
+					   sizeof(struct tcphdr), &_hdr);
+		break;
+	case IPPROTO_UDP:
+		ports = skb_header_pointer(skb, par->thoff,
+					   sizeof(struct udphdr), &_hdr);
+		break;
+	default:
+		key->sport = key->dport = 0;
+		return true;
+	}
+	if (!ports)
+		return false;
+	key->sport = ports[0];
+	key->dport = ports[1];
+	return true;
+}
+
+static inline struct ipt_vcache_entry *
+ipt_vcache_slot(const struct xt_table_info *private,
+		const struct ipt_vcache_key *key)
+{
+	struct ipt_vcache *vc = this_cpu_ptr(private->vcache);
+	u32 hash;
+
+	hash = jhash_3words((__force u32)key->saddr, (__force u32)key->daddr,
+			    (__force u32)key->sport << 16 |
+			    (__force u32)key->dport,
+			    key->protocol | key->hook << 8);
+
+	return &vc->slot[hash >> (32 - IPT_VCACHE_BITS)];
+}
+
+static inline bool
+ipt_vcache_hit(const struct ipt_vcache_entry *ve,
+	       const struct ipt_vcache_key *key,
+	       const char *indev, const char *outdev)
+{
+	return ve->valid &&
+	       ve->key.saddr == key->saddr &&
+	       ve->key.daddr == key->daddr &&
+	       ve->key.sport == key->sport &&
+	       ve->key.dport == key->dport &&
+	       ve->key.protocol == key->protocol &&
+	       ve->key.hook == key->hook &&
+	       memcmp(ve->indev, indev, IFNAMSIZ) == 0 &&
+	       memcmp(ve->outdev, outdev, IFNAMSIZ) == 0;
+}
+
+static void
+ipt_vcache_fill(struct ipt_vcache_entry *ve,
+		const struct ipt_vcache_key *key,
+		const char *indev, const char *outdev, unsigned int verdict,
+		const unsigned int *path, unsigned int npath)
+{
+	ve->key = *key;
+	memcpy(ve->indev, indev, IFNAMSIZ);
+	memcpy(ve->outdev, outdev, IFNAMSIZ);
+	ve->verdict = verdict;
+	memcpy(ve->path, path, npath * sizeof(path[0]));
+	ve->npath = npath;
+	ve->valid = true;
+}
+
+/* Account the packet to the rules it would have matched */
+static unsigned int
+ipt_vcache_apply(const struct ipt_vcache_entry *ve,
+		 const struct sk_buff *skb, const void *table_base)
+{
+	struct xt_counters *counter;
+	unsigned int i;
+
+	for (i = 0; i < ve->npath; i++) {
+		counter = xt_get_this_cpu_counter(
+			&get_entry(table_base, ve->path[i])->counters);
+		ADD_COUNTER(*counter, skb->len, 1);
+	}
+	return ve->verdict;
+}
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -238,6 +388,10 @@ ipt_do_table(struct sk_buff *skb,
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
 	unsigned int addend;
+	struct ipt_vcache_entry *ve = NULL;
+	struct ipt_vcache_key vkey;
+	unsigned int vpath[IPT_VCACHE_PATH];
+	unsigned int npath = 0;
 
 	/* Initialization */
 	stackidx = 0;
@@ -273,6 +427,18 @@ ipt_do_table(struct sk_buff *skb,
 	if (static_key_false(&xt_tee_enabled))
 		jumpstack += private->stacksize * __this_cpu_read(nf_skb_duplicated);
 
+	if (private->vcache_hooks & (1 << hook) &&
+#if IS_ENABLED(CONFIG_NETFILTER_XT_TARGET_TRACE)
+	    !skb->nf_trace &&
+#endif
+	    ipt_vcache_key(skb, ip, &acpar, hook, &vkey)) {
+		ve = ipt_vcache_slot(private, &vkey);
+		if (ipt_vcache_hit(ve, &vkey, indev, outdev)) {
+			verdict = ipt_vcache_apply(ve, skb, table_base);
+			goto out;
+		}
+	}
+
 	e = get_entry(table_base, private->hook_entry[hook]);
 
 	do {
@@ -297,6 +463,11 @@ ipt_do_table(struct sk_buff *skb,
 
 		counter = xt_get_this_cpu_counter(&e->counters);
 		ADD_COUNTER(*counter, skb->len, 1);
+		if (ve) {
+			if (npath < IPT_VCACHE_PATH)
+				vpath[npath] = (void *)e - table_base;
+			npath++;
+		}
 
 		t = ipt_get_target_c(e);
 		WARN_ON(!t->u.kernel.target);
@@ -342,6 +513,8 @@ ipt_do_table(struct sk_buff *skb,
 
 		acpar.target   = t->u.kernel.target;
 		acpar.targinfo = t->data;
+		/* Only the ERROR target gets here in a cacheable hook */
+		ve = NULL;
 
 		verdict = t->u.kernel.target->target(skb, &acpar);
 		if (verdict == XT_CONTINUE) {
@@ -354,6 +527,10 @@ ipt_do_table(struct sk_buff *skb,
 		}
 	} while (!acpar.hotdrop);
 
+	if (ve && !acpar.hotdrop && npath <= IPT_VCACHE_PATH)
+		ipt_vcache_fill(ve, &vkey, indev, outdev, verdict,
+				vpath, npath);
+out:
 	xt_write_recseq_end(addend);
 	local_bh_enable();
 
@@ -657,6 +834,65 @@ cleanup_entry(struct ipt_entry *e, struct net *net)
 
 /* Checks and translates the user-supplied table segment (held in
    newinfo) */
+/* Whether the verdict of the rule depends on the verdict cache key only */
+static bool ipt_vcache_entry_ok(const struct ipt_entry *e)
+{
+	const struct xt_entry_match *ematch;
+	const struct xt_entry_target *t;
+
+	xt_ematch_foreach(ematch, e) {
+		const char *name = ematch->u.kernel.match->name;
+
+		if (strcmp(name, "udp") == 0)
+			continue;
+		if (strcmp(name, "tcp") == 0) {
+			const struct xt_tcp *tcpinfo = (const void *)ematch->data;
+
+			if (!tcpinfo->option && !tcpinfo->flg_mask)
+				continue;
+		}
+		return false;
+	}
+
+	/* ERROR targets head the user chains and are never reached */
+	t = ipt_get_target_c(e);
+	return !t->u.kernel.target->target ||
+	       strcmp(t->u.kernel.target->name, XT_ERROR_TARGET) == 0;
+}
+
+/* Enable the verdict cache on the hooks which reach cacheable rules only.
+ * comefrom holds the hooks from which the rule can be reached.
+ */
+static void
+ipt_vcache_setup(struct xt_table_info *newinfo, void *entry0,
+		 unsigned int valid_hooks)
+{
+	const struct ipt_entry *iter;
+	unsigned int hooks = valid_hooks;
+
+	if (!vcache)
+		return;
+
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		if (!ipt_vcache_entry_ok(iter))
+			hooks &= ~iter->comefrom;
+	}
+	if (!hooks)
+		return;
+
+	/* The cache is optional: go without it on allocation failure */
+	newinfo->vcache = alloc_percpu(struct ipt_vcache);
+	if (newinfo->vcache)
+		newinfo->vcache_hooks = hooks;
+}
+
+static void
+ipt_free_table_info(struct xt_table_info *info)
+{
+	free_percpu(info->vcache);
+	xt_free_table_info(info);
+}
+
 static int
 translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 		const struct ipt_replace *repl)
@@ -730,6 +966,7 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 		return ret;
 	}
 
+	ipt_vcache_setup(newinfo, entry0, repl->valid_hooks);
 	return ret;
  out_free:
 	kvfree(offsets);
@@ -1084,7 +1321,7 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	xt_entry_foreach(iter, oldinfo->entries, oldinfo->size)
 		cleanup_entry(iter, net);
 
-	xt_free_table_info(oldinfo);
+	ipt_free_table_info(oldinfo);
 	if (copy_to_user(counters_ptr, counters,
 			 sizeof(struct xt_counters) * num_counters) != 0) {
 		/* Silent error, can't fail, new table is already in place */
@@ -1147,7 +1384,7 @@ do_replace(struct net *net, const void __user *user, unsigned int len)
 	xt_entry_foreach(iter, loc_cpu_entry, newinfo->size)
 		cleanup_entry(iter, net);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -1468,11 +1705,11 @@ translate_compat_table(struct net *net,
 
 	*pinfo = newinfo;
 	*pentry0 = entry1;
-	xt_free_table_info(info);
+	ipt_free_table_info(info);
 	return 0;
 
 free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 out_unlock:
 	xt_compat_flush_offsets(AF_INET);
@@ -1530,7 +1767,7 @@ compat_do_replace(struct net *net, void __user *user, unsigned int len)
 	xt_entry_foreach(iter, loc_cpu_entry, newinfo->size)
 		cleanup_entry(iter, net);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -1749,7 +1986,7 @@ static void __ipt_unregister_table(struct net *net, struct xt_table *table)
 		cleanup_entry(iter, net);
 	if (private->number > private->initial_entries)
 		module_put(table_owner);
-	xt_free_table_info(private);
+	ipt_free_table_info(private);
 }
 
 int ipt_register_table(struct net *net, const struct xt_table *table,
@@ -1793,7 +2030,7 @@ int ipt_register_table(struct net *net, const struct xt_table *table,
 	return ret;
 
 out_free:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
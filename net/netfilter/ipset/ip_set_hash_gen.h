@@ -8,6 +8,7 @@
 #include <linux/jhash.h>
 #include <linux/types.h>
 #include <linux/netfilter/ipset/ip_set_timeout.h>
+#include <linux/netfilter/ipset/ip_set_net_trie.h>
 
 #define __ipset_dereference_protected(p, c)	rcu_dereference_protected(p, c)
 #define ipset_dereference_protected(p, set) \
@@ -162,6 +163,10 @@ htable_bits(u32 hashsize)
 #define NLEN			0
 #endif /* IP_SET_HASH_WITH_NETS */
 
+#if defined(IP_SET_HASH_WITH_NET_TRIE) && IPSET_NET_COUNT > 1
+#error "IP_SET_HASH_WITH_NET_TRIE supports single network types only"
+#endif
+
 #endif /* _IP_SET_HASH_GEN_H */
 
 #ifndef MTYPE
@@ -193,6 +198,8 @@ htable_bits(u32 hashsize)
 #undef mtype_ext_cleanup
 #undef mtype_add_cidr
 #undef mtype_del_cidr
+#undef mtype_trie_add
+#undef mtype_trie_del
 #undef mtype_ahash_memsize
 #undef mtype_flush
 #undef mtype_destroy
@@ -235,6 +242,15 @@ htable_bits(u32 hashsize)
 #define mtype_ext_cleanup	IPSET_TOKEN(MTYPE, _ext_cleanup)
 #define mtype_add_cidr		IPSET_TOKEN(MTYPE, _add_cidr)
 #define mtype_del_cidr		IPSET_TOKEN(MTYPE, _del_cidr)
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+#define mtype_trie_add(h, d)	\
+	ip_set_net_trie_add(&(h)->trie, &(d)->ip, DCIDR_GET((d)->cidr, 0))
+#define mtype_trie_del(h, d)	\
+	ip_set_net_trie_del(&(h)->trie, &(d)->ip, DCIDR_GET((d)->cidr, 0))
+#else
+#define mtype_trie_add(h, d)
+#define mtype_trie_del(h, d)
+#endif
 #define mtype_ahash_memsize	IPSET_TOKEN(MTYPE, _ahash_memsize)
 #define mtype_flush		IPSET_TOKEN(MTYPE, _flush)
 #define mtype_destroy		IPSET_TOKEN(MTYPE, _destroy)
@@ -287,6 +303,9 @@ struct htype {
 #endif
 #ifdef IP_SET_HASH_WITH_NETMASK
 	u8 netmask;		/* netmask value for subnets to store */
+#endif
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+	struct ip_set_net_trie trie; /* prefixes to try at lookups */
 #endif
 	struct mtype_elem next; /* temporary storage for uadd */
 #ifdef IP_SET_HASH_WITH_NETS
@@ -345,7 +364,11 @@ mtype_del_cidr(struct htype *h, u8 cidr, u8 n)
 static size_t
 mtype_ahash_memsize(const struct htype *h, const struct htable *t)
 {
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+	return sizeof(*h) + sizeof(*t) + ip_set_net_trie_memsize(&h->trie);
+#else
 	return sizeof(*h) + sizeof(*t);
+#endif
 }
 
 /* Get the ith element from the array block n */
@@ -384,6 +407,9 @@ mtype_flush(struct ip_set *set)
 	}
 #ifdef IP_SET_HASH_WITH_NETS
 	memset(h->nets, 0, sizeof(h->nets));
+#endif
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+	ip_set_net_trie_flush(&h->trie);
 #endif
 	set->elements = 0;
 	set->ext_size = 0;
@@ -420,6 +446,9 @@ mtype_destroy(struct ip_set *set)
 
 	mtype_ahash_destroy(set,
 			    __ipset_dereference_protected(h->table, 1), true);
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+	ip_set_net_trie_destroy(&h->trie);
+#endif
 	kfree(h);
 
 	set->data = NULL;
@@ -488,6 +517,7 @@ mtype_expire(struct ip_set *set, struct htype *h)
 				mtype_del_cidr(h,
 					NCIDR_PUT(DCIDR_GET(data->cidr, k)),
 					k);
+			mtype_trie_del(h, data);
 #endif
 			ip_set_ext_destroy(set, data);
 			set->elements--;
@@ -762,6 +792,7 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 				mtype_del_cidr(h,
 					NCIDR_PUT(DCIDR_GET(data->cidr, i)),
 					i);
+			mtype_trie_del(h, data);
 #endif
 			ip_set_ext_destroy(set, data);
 			set->elements--;
@@ -798,6 +829,8 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 #ifdef IP_SET_HASH_WITH_NETS
 	for (i = 0; i < IPSET_NET_COUNT; i++)
 		mtype_add_cidr(h, NCIDR_PUT(DCIDR_GET(d->cidr, i)), i);
+	/* Before the element becomes visible to the readers */
+	mtype_trie_add(h, d);
 #endif
 	memcpy(data, d, sizeof(struct mtype_elem));
 overwrite_extensions:
@@ -871,6 +904,7 @@ mtype_del(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 		for (j = 0; j < IPSET_NET_COUNT; j++)
 			mtype_del_cidr(h, NCIDR_PUT(DCIDR_GET(d->cidr, j)),
 				       j);
+		mtype_trie_del(h, d);
 #endif
 		ip_set_ext_destroy(set, data);
 
@@ -939,6 +973,18 @@ mtype_test_cidrs(struct ip_set *set, struct mtype_elem *d,
 	int ret, i, j = 0;
 #endif
 	u32 key, multi = 0;
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+	DECLARE_BITMAP(prefixes, HOST_MASK + 1);
+	bool use_trie = !READ_ONCE(h->trie.incomplete);
+
+	/* Only the prefix lengths covering the address can match */
+	if (use_trie) {
+		bitmap_zero(prefixes, HOST_MASK + 1);
+		ip_set_net_trie_match(&h->trie, &d->ip, prefixes);
+		if (bitmap_empty(prefixes, HOST_MASK + 1))
+			return 0;
+	}
+#endif
 
 	pr_debug("test by nets\n");
 	for (; j < NLEN && h->nets[j].cidr[0] && !multi; j++) {
@@ -950,6 +996,11 @@ mtype_test_cidrs(struct ip_set *set, struct mtype_elem *d,
 			mtype_data_netmask(d, NCIDR_GET(h->nets[k].cidr[1]),
 					   true);
 #else
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+		if (use_trie &&
+		    !test_bit(NCIDR_GET(h->nets[j].cidr[0]), prefixes))
+			continue;
+#endif
 		mtype_data_netmask(d, NCIDR_GET(h->nets[j].cidr[0]));
 #endif
 		key = HKEY(d, h->initval, t->htable_bits);
@@ -1300,6 +1351,10 @@ IPSET_TOKEN(HTYPE, _create)(struct net *net, struct ip_set *set,
 #endif
 #ifdef IP_SET_HASH_WITH_MARKMASK
 	h->markmask = markmask;
+#endif
+#ifdef IP_SET_HASH_WITH_NET_TRIE
+	ip_set_net_trie_init(&h->trie, set->family == NFPROTO_IPV4 ?
+			     sizeof(struct in_addr) : sizeof(struct in6_addr));
 #endif
 	get_random_bytes(&h->initval, sizeof(h->initval));
 
@@ -34,6 +34,7 @@ MODULE_ALIAS("ip_set_hash:net");
 /* Type specific function prefix */
 #define HTYPE		hash_net
 #define IP_SET_HASH_WITH_NETS
+#define IP_SET_HASH_WITH_NET_TRIE
 
 /* IPv4 variant */
 
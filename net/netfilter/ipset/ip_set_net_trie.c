@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/* Prefix trie for the hash:net* types, based on the BPF LPM trie */
+
+#include <linux/bitops.h>
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/netfilter/ipset/ip_set_net_trie.h>
+
+/* The trie stores every distinct prefix of the set once, with the number
+ * of set elements using it in @refcnt. Nodes with zero @refcnt are
+ * intermediate nodes, which are created when two prefixes diverge and are
+ * not reported by lookups. Addresses are in network order, so data[0] is
+ * the most significant byte.
+ */
+struct ip_set_net_trie_node {
+	struct rcu_head rcu;
+	struct ip_set_net_trie_node __rcu *child[2];
+	u32 refcnt;
+	u8 prefixlen;
+	u8 data[0];
+};
+
+#define trie_dereference(p)	rcu_dereference_protected(p, 1)
+
+static inline int
+extract_bit(const u8 *data, u8 index)
+{
+	return !!(data[index / 8] & (1 << (7 - (index % 8))));
+}
+
+/* Number of leading bits, at most @limit, in which @node and @data agree */
+static u8
+match_len(const struct ip_set_net_trie_node *node, const u8 *data, u8 limit)
+{
+	u8 i, len = 0, diff;
+
+	for (i = 0; len < limit; i++) {
+		diff = node->data[i] ^ data[i];
+		if (diff) {
+			len += 8 - fls(diff);
+			break;
+		}
+		len += 8;
+	}
+	return min(len, limit);
+}
+
+static struct ip_set_net_trie_node *
+node_alloc(struct ip_set_net_trie *trie, const u8 *data, u8 prefixlen,
+	   u32 refcnt)
+{
+	struct ip_set_net_trie_node *node;
+
+	node = kmalloc(sizeof(*node) + trie->data_size, GFP_ATOMIC);
+	if (!node)
+		return NULL;
+	RCU_INIT_POINTER(node->child[0], NULL);
+	RCU_INIT_POINTER(node->child[1], NULL);
+	node->refcnt = refcnt;
+	node->prefixlen = prefixlen;
+	memcpy(node->data, data, trie->data_size);
+	trie->nodes++;
+
+	return node;
+}
+
+static void
+node_free(struct ip_set_net_trie *trie, struct ip_set_net_trie_node *node)
+{
+	trie->nodes--;
+	kfree_rcu(node, rcu);
+}
+
+void
+ip_set_net_trie_init(struct ip_set_net_trie *trie, u8 data_size)
+{
+	RCU_INIT_POINTER(trie->root, NULL);
+	trie->nodes = 0;
+	trie->data_size = data_size;
+	trie->incomplete = false;
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_init);
+
+/* Add a reference to the prefix @data/@prefixlen. When a node cannot be
+ * allocated, the trie is marked incomplete and must not be used to
+ * restrict lookups until it is flushed.
+ */
+void
+ip_set_net_trie_add(struct ip_set_net_trie *trie, const void *data,
+		    u8 prefixlen)
+{
+	struct ip_set_net_trie_node *node, *new_node, *im_node;
+	struct ip_set_net_trie_node __rcu **slot = &trie->root;
+	u8 matchlen = 0;
+
+	while ((node = trie_dereference(*slot))) {
+		matchlen = match_len(node, data,
+				     min(node->prefixlen, prefixlen));
+		if (node->prefixlen != matchlen ||
+		    node->prefixlen == prefixlen)
+			break;
+		slot = &node->child[extract_bit(data, node->prefixlen)];
+	}
+
+	/* Existing prefix, possibly an intermediate node so far */
+	if (node && node->prefixlen == prefixlen && matchlen == prefixlen) {
+		WRITE_ONCE(node->refcnt, node->refcnt + 1);
+		return;
+	}
+
+	new_node = node_alloc(trie, data, prefixlen, 1);
+	if (!new_node)
+		goto incomplete;
+
+	if (!node) {
+		rcu_assign_pointer(*slot, new_node);
+		return;
+	}
+
+	/* The new prefix covers @node: insert it as its parent */
+	if (matchlen == prefixlen) {
+		RCU_INIT_POINTER(new_node->child[extract_bit(node->data,
+							     prefixlen)],
+				 node);
+		rcu_assign_pointer(*slot, new_node);
+		return;
+	}
+
+	/* The prefixes diverge at matchlen: join them in an intermediate node */
+	im_node = node_alloc(trie, node->data, matchlen, 0);
+	if (!im_node) {
+		trie->nodes--;
+		kfree(new_node);
+		goto incomplete;
+	}
+	if (extract_bit(data, matchlen)) {
+		RCU_INIT_POINTER(im_node->child[0], node);
+		RCU_INIT_POINTER(im_node->child[1], new_node);
+	} else {
+		RCU_INIT_POINTER(im_node->child[0], new_node);
+		RCU_INIT_POINTER(im_node->child[1], node);
+	}
+	rcu_assign_pointer(*slot, im_node);
+	return;
+
+incomplete:
+	WRITE_ONCE(trie->incomplete, true);
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_add);
+
+/* Drop a reference to the prefix @data/@prefixlen and remove the nodes
+ * which are no longer needed.
+ */
+void
+ip_set_net_trie_del(struct ip_set_net_trie *trie, const void *data,
+		    u8 prefixlen)
+{
+	struct ip_set_net_trie_node __rcu **slot = &trie->root;
+	struct ip_set_net_trie_node __rcu **parent_slot = NULL;
+	struct ip_set_net_trie_node *node, *parent = NULL, *child;
+	u8 matchlen = 0;
+
+	while ((node = trie_dereference(*slot))) {
+		matchlen = match_len(node, data,
+				     min(node->prefixlen, prefixlen));
+		if (node->prefixlen != matchlen ||
+		    node->prefixlen == prefixlen)
+			break;
+		parent = node;
+		parent_slot = slot;
+		slot = &node->child[extract_bit(data, node->prefixlen)];
+	}
+
+	/* Not found: possible when the trie is incomplete */
+	if (!node || node->prefixlen != prefixlen || matchlen != prefixlen ||
+	    !node->refcnt)
+		return;
+
+	WRITE_ONCE(node->refcnt, node->refcnt - 1);
+	if (node->refcnt)
+		return;
+
+	/* Still needed to join two subtries */
+	if (rcu_access_pointer(node->child[0]) &&
+	    rcu_access_pointer(node->child[1]))
+		return;
+
+	/* A leaf below an intermediate node: the sibling replaces both */
+	if (parent && !parent->refcnt &&
+	    !rcu_access_pointer(node->child[0]) &&
+	    !rcu_access_pointer(node->child[1])) {
+		child = trie_dereference(parent->child[0]);
+		if (child == node)
+			child = trie_dereference(parent->child[1]);
+		rcu_assign_pointer(*parent_slot, child);
+		node_free(trie, parent);
+		node_free(trie, node);
+		return;
+	}
+
+	child = trie_dereference(node->child[0]);
+	if (!child)
+		child = trie_dereference(node->child[1]);
+	rcu_assign_pointer(*slot, child);
+	node_free(trie, node);
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_del);
+
+/* Set the bit of every prefix length in @prefixes for which the trie holds
+ * a prefix covering the address @data. Must be called under
+ * rcu_read_lock_bh().
+ */
+void
+ip_set_net_trie_match(const struct ip_set_net_trie *trie, const void *data,
+		      unsigned long *prefixes)
+{
+	const struct ip_set_net_trie_node *node;
+	u8 max_prefixlen = trie->data_size * 8;
+
+	for (node = rcu_dereference_bh(trie->root); node; ) {
+		if (match_len(node, data, node->prefixlen) != node->prefixlen)
+			break;
+		if (READ_ONCE(node->refcnt))
+			__set_bit(node->prefixlen, prefixes);
+		if (node->prefixlen == max_prefixlen)
+			break;
+		node = rcu_dereference_bh(
+			node->child[extract_bit(data, node->prefixlen)]);
+	}
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_match);
+
+/* Free all nodes of a detached trie. Right rotations turn the trie into a
+ * list along the right children, which is then freed without recursion.
+ */
+static void
+trie_free(struct ip_set_net_trie *trie, struct ip_set_net_trie_node *node,
+	  bool rcu)
+{
+	struct ip_set_net_trie_node *left, *next;
+
+	while (node) {
+		left = trie_dereference(node->child[0]);
+		if (left) {
+			rcu_assign_pointer(node->child[0],
+					   trie_dereference(left->child[1]));
+			rcu_assign_pointer(left->child[1], node);
+			node = left;
+			continue;
+		}
+		next = trie_dereference(node->child[1]);
+		if (rcu) {
+			node_free(trie, node);
+		} else {
+			trie->nodes--;
+			kfree(node);
+		}
+		node = next;
+	}
+}
+
+/* Remove all prefixes. Readers may still walk the old nodes, which are
+ * freed after a grace period.
+ */
+void
+ip_set_net_trie_flush(struct ip_set_net_trie *trie)
+{
+	struct ip_set_net_trie_node *root = trie_dereference(trie->root);
+
+	rcu_assign_pointer(trie->root, NULL);
+	trie_free(trie, root, true);
+	WRITE_ONCE(trie->incomplete, false);
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_flush);
+
+/* Free the trie when there are no readers left */
+void
+ip_set_net_trie_destroy(struct ip_set_net_trie *trie)
+{
+	trie_free(trie, trie_dereference(trie->root), false);
+	RCU_INIT_POINTER(trie->root, NULL);
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_destroy);
+
+size_t
+ip_set_net_trie_memsize(const struct ip_set_net_trie *trie)
+{
+	return trie->nodes *
+	       (sizeof(struct ip_set_net_trie_node) + trie->data_size);
+}
+EXPORT_SYMBOL_GPL(ip_set_net_trie_memsize);
@@ -32,6 +32,8 @@
 #include <linux/seq_file.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 
 #include <net/net_namespace.h>
 #include <net/ip_vs.h>
@@ -43,10 +45,18 @@
 
 /*
  * Connection hash size. Default is what was selected at compile time.
+ * The table grows with the number of connections, up to conn_tab_max_bits,
+ * and shrinks back down to conn_tab_bits.
 */
 static int ip_vs_conn_tab_bits = CONFIG_IP_VS_TAB_BITS;
 module_param_named(conn_tab_bits, ip_vs_conn_tab_bits, int, 0444);
-MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
+MODULE_PARM_DESC(conn_tab_bits, "Set connections' initial hash size");
+
+#define IP_VS_CONN_TAB_MAX_BITS	20
+
+static int ip_vs_conn_tab_max_bits = IP_VS_CONN_TAB_MAX_BITS;
+module_param_named(conn_tab_max_bits, ip_vs_conn_tab_max_bits, int, 0444);
+MODULE_PARM_DESC(conn_tab_max_bits, "Set connections' maximum hash size");
 
 /* size and mask values */
 int ip_vs_conn_tab_size __read_mostly;
@@ -57,6 +67,21 @@ static int ip_vs_conn_tab_mask __read_mostly;
  */
 static struct hlist_head *ip_vs_conn_tab __read_mostly;
 
+/* Readers snapshot ip_vs_conn_tab and its mask under this seqcount and retry
+ * a lookup that missed while the table was being resized, since entries
+ * move from the old to the new table under them.
+ */
+static seqcount_t ip_vs_conn_tab_seq;
+
+/* Serializes table walks that can sleep with resizing */
+static DEFINE_MUTEX(ip_vs_conn_tab_mutex);
+
+/* number of hashed connections, in all netns */
+static atomic_t ip_vs_conn_tab_count = ATOMIC_INIT(0);
+
+static void ip_vs_conn_resize_work_handler(struct work_struct *work);
+static DECLARE_WORK(ip_vs_conn_resize_work, ip_vs_conn_resize_work_handler);
+
 /*  SLAB cache for IPVS connections */
 static struct kmem_cache *ip_vs_conn_cachep __read_mostly;
 
@@ -69,7 +94,7 @@ static unsigned int ip_vs_conn_rnd __read_mostly;
 /*
  *  Fine locking granularity for big connection hash table
  */
-#define CT_LOCKARRAY_BITS  5
+#define CT_LOCKARRAY_BITS  8
 #define CT_LOCKARRAY_SIZE  (1<<CT_LOCKARRAY_BITS)
 #define CT_LOCKARRAY_MASK  (CT_LOCKARRAY_SIZE-1)
 
@@ -89,9 +114,28 @@ struct ip_vs_aligned_lock
 static struct ip_vs_aligned_lock
 __ip_vs_conntbl_lock_array[CT_LOCKARRAY_SIZE] __cacheline_aligned;
 
+/* Taken with all the lock array by the resizer, see ct_write_lock_all_bh() */
+static DEFINE_SPINLOCK(__ip_vs_conntbl_lock_all);
+static bool __ip_vs_conntbl_locked_all;
+
+/* The lock is selected by the low bits of the full hash, so it does not
+ * change when the table is resized.
+ */
 static inline void ct_write_lock_bh(unsigned int key)
 {
-	spin_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spinlock_t *lock = &__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l;
+
+	spin_lock_bh(lock);
+
+	/* Pairs with smp_store_release() in ct_write_unlock_all_bh() */
+	if (likely(!smp_load_acquire(&__ip_vs_conntbl_locked_all)))
+		return;
+
+	/* the table is being resized, wait for it to finish */
+	spin_unlock(lock);
+	spin_lock(&__ip_vs_conntbl_lock_all);
+	spin_lock(lock);
+	spin_unlock(&__ip_vs_conntbl_lock_all);
 }
 
 static inline void ct_write_unlock_bh(unsigned int key)
@@ -99,10 +143,35 @@ static inline void ct_write_unlock_bh(unsigned int key)
 	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
+static void ct_write_lock_all_bh(void)
+{
+	int i;
+
+	spin_lock_bh(&__ip_vs_conntbl_lock_all);
+	__ip_vs_conntbl_locked_all = true;
+
+	for (i = 0; i < CT_LOCKARRAY_SIZE; i++) {
+		spin_lock(&__ip_vs_conntbl_lock_array[i].l);
+		/* This spin_unlock provides the "release" to ensure that
+		 * __ip_vs_conntbl_locked_all is visible to everyone that
+		 * acquired the lock after us.
+		 */
+		spin_unlock(&__ip_vs_conntbl_lock_array[i].l);
+	}
+}
+
+static void ct_write_unlock_all_bh(void)
+{
+	/* All writers after this see the new table */
+	smp_store_release(&__ip_vs_conntbl_locked_all, false);
+	spin_unlock_bh(&__ip_vs_conntbl_lock_all);
+}
+
 static void ip_vs_conn_expire(struct timer_list *t);
 
 /*
- *	Returns hash value for IPVS connection entry
+ *	Returns hash value for IPVS connection entry, not yet masked
+ *	with the table size
  */
 static unsigned int ip_vs_conn_hashkey(struct netns_ipvs *ipvs, int af, unsigned int proto,
 				       const union nf_inet_addr *addr,
@@ -110,13 +179,13 @@ static unsigned int ip_vs_conn_hashkey(struct netns_ipvs *ipvs, int af, unsigned
 {
 #ifdef CONFIG_IP_VS_IPV6
 	if (af == AF_INET6)
-		return (jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
+		return jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
 				    (__force u32)port, proto, ip_vs_conn_rnd) ^
-			((size_t)ipvs>>8)) & ip_vs_conn_tab_mask;
+			((size_t)ipvs>>8);
 #endif
-	return (jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
+	return jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
 			    ip_vs_conn_rnd) ^
-		((size_t)ipvs>>8)) & ip_vs_conn_tab_mask;
+		((size_t)ipvs>>8);
 }
 
 static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
@@ -126,8 +195,7 @@ static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
 	__be16 port;
 
 	if (p->pe_data && p->pe->hashkey_raw)
-		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse) &
-			ip_vs_conn_tab_mask;
+		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse);
 
 	if (likely(!inverse)) {
 		addr = p->caddr;
@@ -156,6 +224,36 @@ static unsigned int ip_vs_conn_hashkey_conn(const struct ip_vs_conn *cp)
 	return ip_vs_conn_hashkey_param(&p, false);
 }
 
+/* Hash chain for a lookup, @seq is to be rechecked on a miss.
+ * Called under RCU.
+ */
+static inline struct hlist_head *ip_vs_conn_tab_chain(unsigned int hash,
+						      unsigned int *seq)
+{
+	struct hlist_head *tab;
+	unsigned int mask;
+
+	do {
+		*seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+		tab = ip_vs_conn_tab;
+		mask = ip_vs_conn_tab_mask;
+	} while (read_seqcount_retry(&ip_vs_conn_tab_seq, *seq));
+
+	return &tab[hash & mask];
+}
+
+/* Resize the table when it holds more connections than buckets, or less
+ * than an eighth of that
+ */
+static inline void ip_vs_conn_tab_check_size(int count)
+{
+	int size = READ_ONCE(ip_vs_conn_tab_size);
+
+	if ((count > size && size < (1 << ip_vs_conn_tab_max_bits)) ||
+	    (count < size >> 3 && size > (1 << ip_vs_conn_tab_bits)))
+		schedule_work(&ip_vs_conn_resize_work);
+}
+
 /*
  *	Hashes ip_vs_conn in ip_vs_conn_tab by netns,proto,addr,port.
  *	returns bool success.
@@ -177,7 +275,8 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		refcount_inc(&cp->refcnt);
-		hlist_add_head_rcu(&cp->c_list, &ip_vs_conn_tab[hash]);
+		hlist_add_head_rcu(&cp->c_list,
+				   &ip_vs_conn_tab[hash & ip_vs_conn_tab_mask]);
 		ret = 1;
 	} else {
 		pr_err("%s(): request for already hashed, called from %pS\n",
@@ -188,6 +287,9 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	spin_unlock(&cp->lock);
 	ct_write_unlock_bh(hash);
 
+	if (ret)
+		ip_vs_conn_tab_check_size(atomic_inc_return(&ip_vs_conn_tab_count));
+
 	return ret;
 }
 
@@ -218,6 +320,9 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 	spin_unlock(&cp->lock);
 	ct_write_unlock_bh(hash);
 
+	if (ret)
+		atomic_dec(&ip_vs_conn_tab_count);
+
 	return ret;
 }
 
@@ -249,6 +354,9 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 	spin_unlock(&cp->lock);
 	ct_write_unlock_bh(hash);
 
+	if (ret)
+		ip_vs_conn_tab_check_size(atomic_dec_return(&ip_vs_conn_tab_count));
+
 	return ret;
 }
 
@@ -262,14 +370,17 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 static inline struct ip_vs_conn *
 __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	struct hlist_head *head;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+begin:
+	head = ip_vs_conn_tab_chain(hash, &seq);
+	hlist_for_each_entry_rcu(cp, head, c_list) {
 		if (p->cport == cp->cport && p->vport == cp->vport &&
 		    cp->af == p->af &&
 		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
@@ -285,6 +396,9 @@ __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 		}
 	}
 
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto begin;
+
 	rcu_read_unlock();
 
 	return NULL;
@@ -348,14 +462,17 @@ EXPORT_SYMBOL_GPL(ip_vs_conn_in_get_proto);
 /* Get reference to connection template */
 struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	struct hlist_head *head;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+begin:
+	head = ip_vs_conn_tab_chain(hash, &seq);
+	hlist_for_each_entry_rcu(cp, head, c_list) {
 		if (unlikely(p->pe_data && p->pe->ct_match)) {
 			if (cp->ipvs != p->ipvs)
 				continue;
@@ -380,6 +497,8 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 				goto out;
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto begin;
 	cp = NULL;
 
   out:
@@ -400,7 +519,8 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
  *	p->vaddr, p->vport: pkt dest address (foreign host) */
 struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	struct hlist_head *head;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp, *ret=NULL;
 
 	/*
@@ -410,7 +530,9 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+begin:
+	head = ip_vs_conn_tab_chain(hash, &seq);
+	hlist_for_each_entry_rcu(cp, head, c_list) {
 		if (p->vport == cp->cport && p->cport == cp->dport &&
 		    cp->af == p->af &&
 		    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
@@ -425,6 +547,9 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 		}
 	}
 
+	if (!ret && read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto begin;
+
 	rcu_read_unlock();
 
 	IP_VS_DBG_BUF(9, "lookup/out %s %s:%d->%s:%d %s\n",
@@ -452,12 +577,23 @@ EXPORT_SYMBOL_GPL(ip_vs_conn_out_get_proto);
 
 /*
  *      Put back the conn and restart its timer with its timeout
+ *
+ *	Every packet of a connection pushes its expiration a little further,
+ *	so leave a pending timer alone while it would move by less than 1/64
+ *	of the timeout: mod_timer() takes the timer base lock, which is
+ *	shared by all the connections armed on the same CPU.  The connection
+ *	may then expire that much earlier than its full idle timeout.
  */
 static void __ip_vs_conn_put_timer(struct ip_vs_conn *cp)
 {
 	unsigned long t = (cp->flags & IP_VS_CONN_F_ONE_PACKET) ?
 		0 : cp->timeout;
-	mod_timer(&cp->timer, jiffies+t);
+	unsigned long expires = jiffies + t;
+
+	if (!timer_pending(&cp->timer) ||
+	    !time_in_range(expires, cp->timer.expires,
+			   cp->timer.expires + (t >> 6)))
+		mod_timer(&cp->timer, expires);
 
 	__ip_vs_conn_put(cp);
 }
@@ -1037,6 +1173,8 @@ static void *ip_vs_conn_seq_start(struct seq_file *seq, loff_t *pos)
 	struct ip_vs_iter_state *iter = seq->private;
 
 	iter->l = NULL;
+	/* keep the table from being resized under iter->l */
+	mutex_lock(&ip_vs_conn_tab_mutex);
 	rcu_read_lock();
 	return *pos ? ip_vs_conn_array(seq, *pos - 1) :SEQ_START_TOKEN;
 }
@@ -1074,6 +1212,7 @@ static void ip_vs_conn_seq_stop(struct seq_file *seq, void *v)
 	__releases(RCU)
 {
 	rcu_read_unlock();
+	mutex_unlock(&ip_vs_conn_tab_mutex);
 }
 
 static int ip_vs_conn_seq_show(struct seq_file *seq, void *v)
@@ -1263,6 +1402,7 @@ void ip_vs_random_dropentry(struct netns_ipvs *ipvs)
 	int idx;
 	struct ip_vs_conn *cp;
 
+	mutex_lock(&ip_vs_conn_tab_mutex);
 	rcu_read_lock();
 	/*
 	 * Randomly scan 1/32 of the whole table every second
@@ -1323,6 +1463,7 @@ void ip_vs_random_dropentry(struct netns_ipvs *ipvs)
 		cond_resched_rcu();
 	}
 	rcu_read_unlock();
+	mutex_unlock(&ip_vs_conn_tab_mutex);
 }
 
 
@@ -1335,6 +1476,7 @@ static void ip_vs_conn_flush(struct netns_ipvs *ipvs)
 	struct ip_vs_conn *cp, *cp_c;
 
 flush_again:
+	mutex_lock(&ip_vs_conn_tab_mutex);
 	rcu_read_lock();
 	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
 
@@ -1358,6 +1500,7 @@ static void ip_vs_conn_flush(struct netns_ipvs *ipvs)
 		cond_resched_rcu();
 	}
 	rcu_read_unlock();
+	mutex_unlock(&ip_vs_conn_tab_mutex);
 
 	/* the counter may be not NULL, because maybe some conn entries
 	   are run by slow timer handler or unhashed but still referred */
@@ -1366,6 +1509,59 @@ static void ip_vs_conn_flush(struct netns_ipvs *ipvs)
 		goto flush_again;
 	}
 }
+/*
+ *	Resize ip_vs_conn_tab to fit the number of connections
+ */
+static void ip_vs_conn_resize_work_handler(struct work_struct *work)
+{
+	struct hlist_head *tab, *old_tab;
+	int bits, count, size, old_size, idx;
+	struct ip_vs_conn *cp;
+	unsigned int hash;
+
+	count = atomic_read(&ip_vs_conn_tab_count);
+	bits = clamp(count > 1 ? fls(count - 1) : 0,
+		     ip_vs_conn_tab_bits, ip_vs_conn_tab_max_bits);
+	size = 1 << bits;
+	if (size == ip_vs_conn_tab_size)
+		return;
+
+	tab = vmalloc(array_size(size, sizeof(*tab)));
+	if (!tab)
+		return;
+	for (idx = 0; idx < size; idx++)
+		INIT_HLIST_HEAD(&tab[idx]);
+
+	mutex_lock(&ip_vs_conn_tab_mutex);
+	ct_write_lock_all_bh();
+	write_seqcount_begin(&ip_vs_conn_tab_seq);
+
+	old_tab = ip_vs_conn_tab;
+	old_size = ip_vs_conn_tab_size;
+	for (idx = 0; idx < old_size; idx++) {
+		while (!hlist_empty(&old_tab[idx])) {
+			cp = hlist_entry(old_tab[idx].first,
+					 struct ip_vs_conn, c_list);
+			hash = ip_vs_conn_hashkey_conn(cp);
+			hlist_del_rcu(&cp->c_list);
+			hlist_add_head_rcu(&cp->c_list, &tab[hash & (size - 1)]);
+		}
+	}
+	ip_vs_conn_tab = tab;
+	ip_vs_conn_tab_mask = size - 1;
+	WRITE_ONCE(ip_vs_conn_tab_size, size);
+
+	write_seqcount_end(&ip_vs_conn_tab_seq);
+	ct_write_unlock_all_bh();
+	mutex_unlock(&ip_vs_conn_tab_mutex);
+
+	IP_VS_DBG(2, "Connection hash table resized (size=%d -> %d, conns=%d)\n",
+		  old_size, size, count);
+
+	synchronize_net();
+	vfree(old_tab);
+}
+
 /*
  * per netns init and exit
  */
@@ -1393,6 +1589,13 @@ int __init ip_vs_conn_init(void)
 {
 	int idx;
 
+	/* The table can't be smaller than the lock array it is striped over */
+	ip_vs_conn_tab_bits = clamp_val(ip_vs_conn_tab_bits, CT_LOCKARRAY_BITS,
+					IP_VS_CONN_TAB_MAX_BITS);
+	ip_vs_conn_tab_max_bits = clamp_val(ip_vs_conn_tab_max_bits,
+					    ip_vs_conn_tab_bits,
+					    IP_VS_CONN_TAB_MAX_BITS);
+
 	/* Compute size and mask */
 	ip_vs_conn_tab_size = 1 << ip_vs_conn_tab_bits;
 	ip_vs_conn_tab_mask = ip_vs_conn_tab_size - 1;
@@ -1415,8 +1618,8 @@ int __init ip_vs_conn_init(void)
 	}
 
 	pr_info("Connection hash table configured "
-		"(size=%d, memory=%ldKbytes)\n",
-		ip_vs_conn_tab_size,
+		"(size=%d, max=%d, memory=%ldKbytes)\n",
+		ip_vs_conn_tab_size, 1 << ip_vs_conn_tab_max_bits,
 		(long)(ip_vs_conn_tab_size*sizeof(struct list_head))/1024);
 	IP_VS_DBG(0, "Each connection entry needs %zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
@@ -1427,6 +1630,7 @@ int __init ip_vs_conn_init(void)
 	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
 		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
 	}
+	seqcount_init(&ip_vs_conn_tab_seq);
 
 	/* calculate the random value for connection hash */
 	get_random_bytes(&ip_vs_conn_rnd, sizeof(ip_vs_conn_rnd));
@@ -1436,6 +1640,7 @@ int __init ip_vs_conn_init(void)
 
 void ip_vs_conn_cleanup(void)
 {
+	cancel_work_sync(&ip_vs_conn_resize_work);
 	/* Wait all ip_vs_conn_rcu_free() callbacks to complete */
 	rcu_barrier();
 	/* Release the empty cache */
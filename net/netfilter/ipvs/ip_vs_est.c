@@ -21,6 +21,7 @@
 #include <linux/interrupt.h>
 #include <linux/sysctl.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
 
 #include <net/ip_vs.h>
 
@@ -46,6 +47,10 @@
   * Netlink users can see 64-bit values but sockopt users are restricted
     to 32-bit values for conns, packets, bps, cps and pps.
 
+  * The timer walks est_list under RCU only. est_lock serializes the
+    writers, and ip_vs_stop_estimator() waits for a running timer before
+    the stats can be freed.
+
   * A lot of code is taken from net/core/gen_estimator.c
  */
 
@@ -100,8 +105,8 @@ static void estimation_timer(struct timer_list *t)
 	u64 rate;
 	struct netns_ipvs *ipvs = from_timer(ipvs, t, est_timer);
 
-	spin_lock(&ipvs->est_lock);
-	list_for_each_entry(e, &ipvs->est_list, list) {
+	rcu_read_lock();
+	list_for_each_entry_rcu(e, &ipvs->est_list, list) {
 		s = container_of(e, struct ip_vs_stats, est);
 
 		spin_lock(&s->lock);
@@ -130,7 +135,7 @@ static void estimation_timer(struct timer_list *t)
 		e->outbps += ((s64)rate - (s64)e->outbps) >> 2;
 		spin_unlock(&s->lock);
 	}
-	spin_unlock(&ipvs->est_lock);
+	rcu_read_unlock();
 	mod_timer(&ipvs->est_timer, jiffies + 2*HZ);
 }
 
@@ -141,7 +146,7 @@ void ip_vs_start_estimator(struct netns_ipvs *ipvs, struct ip_vs_stats *stats)
 	INIT_LIST_HEAD(&est->list);
 
 	spin_lock_bh(&ipvs->est_lock);
-	list_add(&est->list, &ipvs->est_list);
+	list_add_rcu(&est->list, &ipvs->est_list);
 	spin_unlock_bh(&ipvs->est_lock);
 }
 
@@ -150,8 +155,15 @@ void ip_vs_stop_estimator(struct netns_ipvs *ipvs, struct ip_vs_stats *stats)
 	struct ip_vs_estimator *est = &stats->est;
 
 	spin_lock_bh(&ipvs->est_lock);
-	list_del(&est->list);
+	list_del_rcu(&est->list);
 	spin_unlock_bh(&ipvs->est_lock);
+
+	/* The stats can be freed without a grace period once we return,
+	 * so wait for an estimation_timer() run that can still see them,
+	 * then rearm the timer at the same time.
+	 */
+	del_timer_sync(&ipvs->est_timer);
+	mod_timer(&ipvs->est_timer, ipvs->est_timer.expires);
 }
 
 void ip_vs_zero_estimator(struct ip_vs_stats *stats)
@@ -8,7 +8,10 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
 #include <linux/rhashtable.h>
+#include <linux/sort.h>
 #include <linux/workqueue.h>
 #include <linux/refcount.h>
 
@@ -64,6 +67,11 @@ struct fl_flow_mask_range {
 	unsigned short int end;
 };
 
+struct fl_mask_stats {
+	u64 hits;	/* lookups which found a filter */
+	u64 misses;	/* lookups which did not */
+};
+
 struct fl_flow_mask {
 	struct fl_flow_key key;
 	struct fl_flow_mask_range range;
@@ -76,6 +84,30 @@ struct fl_flow_mask {
 	struct rcu_work rwork;
 	struct list_head list;
 	refcount_t refcnt;
+	struct fl_mask_stats __percpu *stats;
+	/* Protected by masks_lock, only used to sort the masks */
+	u64 sort_hits;
+	u64 sort_key;
+	unsigned int sort_pos;
+};
+
+/* Snapshot of the masks list sorted by decreasing hit rate. Rebuilt by
+ * fl_mask_sort_work() and dropped whenever a mask is added or removed, in
+ * which case lookups fall back to the masks list until the next rebuild.
+ */
+struct fl_mask_array {
+	struct rcu_head rcu;
+	u32 seq;
+	unsigned int n;
+	struct fl_flow_mask *masks[];
+};
+
+/* Mask of the last hit on this CPU, valid while the array with the same
+ * sequence number is the current one.
+ */
+struct fl_mask_hint {
+	struct fl_flow_mask *mask;
+	u32 seq;
 };
 
 struct fl_flow_tmplt {
@@ -89,6 +121,10 @@ struct cls_fl_head {
 	struct rhashtable ht;
 	spinlock_t masks_lock; /* Protect masks list */
 	struct list_head masks;
+	struct fl_mask_array __rcu *sorted;
+	u32 sort_seq;
+	struct delayed_work sort_work;
+	struct fl_mask_hint __percpu *hint;
 	struct list_head hw_filters;
 	struct rcu_work rwork;
 	struct idr handle_idr;
@@ -116,6 +152,16 @@ struct cls_fl_filter {
 	bool deleted;
 };
 
+/* Try the masks in order of decreasing hit rate instead of insertion order.
+ * Which filter matches then becomes unspecified when a packet matches
+ * filters of the same priority that use different masks.
+ */
+static bool mask_sort __read_mostly;
+module_param(mask_sort, bool, 0644);
+MODULE_PARM_DESC(mask_sort, "Look up the most hit masks first");
+
+#define FL_MASK_SORT_INTERVAL	HZ
+
 static const struct rhashtable_params mask_ht_params = {
 	.key_offset = offsetof(struct fl_flow_mask, key),
 	.key_len = sizeof(struct fl_flow_key),
@@ -288,38 +334,194 @@ static u16 fl_ct_info_to_flower_map[] = {
 					TCA_FLOWER_KEY_CT_FLAGS_NEW,
 };
 
+static struct cls_fl_filter *fl_mask_lookup(struct sk_buff *skb,
+					    struct fl_flow_mask *mask,
+					    struct fl_flow_key *skb_key,
+					    struct fl_flow_key *skb_mkey)
+{
+	struct cls_fl_filter *f;
+
+	fl_clear_masked_range(skb_key, mask);
+
+	skb_flow_dissect_meta(skb, &mask->dissector, skb_key);
+	/* skb_flow_dissect() does not set n_proto in case an unknown
+	 * protocol, so do it rather here.
+	 */
+	skb_key->basic.n_proto = skb->protocol;
+	skb_flow_dissect_tunnel_info(skb, &mask->dissector, skb_key);
+	skb_flow_dissect_ct(skb, &mask->dissector, skb_key,
+			    fl_ct_info_to_flower_map,
+			    ARRAY_SIZE(fl_ct_info_to_flower_map));
+	skb_flow_dissect(skb, &mask->dissector, skb_key, 0);
+
+	fl_set_masked_key(skb_mkey, skb_key, mask);
+
+	f = fl_lookup(mask, skb_mkey, skb_key);
+	if (f && !tc_skip_sw(f->flags)) {
+		this_cpu_inc(mask->stats->hits);
+		return f;
+	}
+	this_cpu_inc(mask->stats->misses);
+	return NULL;
+}
+
+static void fl_mask_sort_schedule(struct cls_fl_head *head)
+{
+	if (!delayed_work_pending(&head->sort_work))
+		schedule_delayed_work(&head->sort_work, FL_MASK_SORT_INTERVAL);
+}
+
+static struct cls_fl_filter *fl_lookup_sorted(struct sk_buff *skb,
+					      struct cls_fl_head *head,
+					      struct fl_mask_array *arr,
+					      struct fl_flow_key *skb_key,
+					      struct fl_flow_key *skb_mkey)
+{
+	struct fl_mask_hint *hint = this_cpu_ptr(head->hint);
+	struct fl_flow_mask *mask, *last = NULL;
+	struct cls_fl_filter *f;
+	unsigned int i;
+
+	if (hint->seq == arr->seq) {
+		last = hint->mask;
+		f = fl_mask_lookup(skb, last, skb_key, skb_mkey);
+		if (f)
+			return f;
+	}
+
+	for (i = 0; i < arr->n; i++) {
+		mask = arr->masks[i];
+		if (mask == last)
+			continue;
+		f = fl_mask_lookup(skb, mask, skb_key, skb_mkey);
+		if (f) {
+			hint->mask = mask;
+			hint->seq = arr->seq;
+			if (i)
+				fl_mask_sort_schedule(head);
+			return f;
+		}
+	}
+	return NULL;
+}
+
 static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 		       struct tcf_result *res)
 {
 	struct cls_fl_head *head = rcu_dereference_bh(tp->root);
 	struct fl_flow_key skb_mkey;
 	struct fl_flow_key skb_key;
+	struct fl_mask_array *arr;
 	struct fl_flow_mask *mask;
 	struct cls_fl_filter *f;
+	bool first = true;
+
+	if (READ_ONCE(mask_sort)) {
+		arr = rcu_dereference_bh(head->sorted);
+		if (arr) {
+			f = fl_lookup_sorted(skb, head, arr, &skb_key, &skb_mkey);
+			if (f)
+				goto found;
+			return -1;
+		}
+	}
 
 	list_for_each_entry_rcu(mask, &head->masks, list) {
-		fl_clear_masked_range(&skb_key, mask);
-
-		skb_flow_dissect_meta(skb, &mask->dissector, &skb_key);
-		/* skb_flow_dissect() does not set n_proto in case an unknown
-		 * protocol, so do it rather here.
-		 */
-		skb_key.basic.n_proto = skb->protocol;
-		skb_flow_dissect_tunnel_info(skb, &mask->dissector, &skb_key);
-		skb_flow_dissect_ct(skb, &mask->dissector, &skb_key,
-				    fl_ct_info_to_flower_map,
-				    ARRAY_SIZE(fl_ct_info_to_flower_map));
-		skb_flow_dissect(skb, &mask->dissector, &skb_key, 0);
-
-		fl_set_masked_key(&skb_mkey, &skb_key, mask);
-
-		f = fl_lookup(mask, &skb_mkey, &skb_key);
-		if (f && !tc_skip_sw(f->flags)) {
-			*res = f->res;
-			return tcf_exts_exec(skb, &f->exts, res);
+		f = fl_mask_lookup(skb, mask, &skb_key, &skb_mkey);
+		if (f) {
+			if (!first && READ_ONCE(mask_sort))
+				fl_mask_sort_schedule(head);
+			goto found;
 		}
+		first = false;
 	}
 	return -1;
+
+found:
+	*res = f->res;
+	return tcf_exts_exec(skb, &f->exts, res);
+}
+
+/* Drop the sorted masks array. Called with masks_lock held. */
+static void fl_mask_sort_reset(struct cls_fl_head *head)
+{
+	struct fl_mask_array *arr;
+
+	arr = rcu_dereference_protected(head->sorted,
+					lockdep_is_held(&head->masks_lock));
+	if (!arr)
+		return;
+	RCU_INIT_POINTER(head->sorted, NULL);
+	kfree_rcu(arr, rcu);
+}
+
+static int fl_mask_cmp(const void *a, const void *b)
+{
+	const struct fl_flow_mask *ma = *(const struct fl_flow_mask **)a;
+	const struct fl_flow_mask *mb = *(const struct fl_flow_mask **)b;
+
+	if (ma->sort_key != mb->sort_key)
+		return ma->sort_key > mb->sort_key ? -1 : 1;
+	/* keep insertion order among masks hit equally often */
+	return ma->sort_pos < mb->sort_pos ? -1 : 1;
+}
+
+static void fl_mask_stats_read(const struct fl_flow_mask *mask,
+			       u64 *hits, u64 *misses)
+{
+	const struct fl_mask_stats *stats;
+	int cpu;
+
+	*hits = 0;
+	*misses = 0;
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(mask->stats, cpu);
+		*hits += READ_ONCE(stats->hits);
+		*misses += READ_ONCE(stats->misses);
+	}
+}
+
+/* Sort the masks by the number of hits since the previous run and publish
+ * the result for fl_classify(). Runs at most every FL_MASK_SORT_INTERVAL,
+ * when lookups keep hitting masks other than the first one tried.
+ */
+static void fl_mask_sort_work(struct work_struct *work)
+{
+	struct cls_fl_head *head = container_of(to_delayed_work(work),
+						struct cls_fl_head,
+						sort_work);
+	struct fl_flow_mask *mask;
+	struct fl_mask_array *arr;
+	unsigned int n = 0;
+	u64 hits, misses;
+
+	spin_lock(&head->masks_lock);
+	list_for_each_entry(mask, &head->masks, list) {
+		fl_mask_stats_read(mask, &hits, &misses);
+		mask->sort_key = hits - mask->sort_hits;
+		mask->sort_hits = hits;
+		mask->sort_pos = n++;
+	}
+
+	fl_mask_sort_reset(head);
+	if (n < 2)
+		goto unlock;
+
+	arr = kmalloc(struct_size(arr, masks, n), GFP_ATOMIC);
+	if (!arr)
+		goto unlock;
+	n = 0;
+	list_for_each_entry(mask, &head->masks, list)
+		arr->masks[n++] = mask;
+	sort(arr->masks, n, sizeof(arr->masks[0]), fl_mask_cmp, NULL);
+	arr->n = n;
+	/* zero is the sequence number of unused hints */
+	if (!++head->sort_seq)
+		++head->sort_seq;
+	arr->seq = head->sort_seq;
+	rcu_assign_pointer(head->sorted, arr);
+unlock:
+	spin_unlock(&head->masks_lock);
 }
 
 static int fl_init(struct tcf_proto *tp)
@@ -330,8 +532,15 @@ static int fl_init(struct tcf_proto *tp)
 	if (!head)
 		return -ENOBUFS;
 
+	head->hint = alloc_percpu(struct fl_mask_hint);
+	if (!head->hint) {
+		kfree(head);
+		return -ENOBUFS;
+	}
+
 	spin_lock_init(&head->masks_lock);
 	INIT_LIST_HEAD_RCU(&head->masks);
+	INIT_DELAYED_WORK(&head->sort_work, fl_mask_sort_work);
 	INIT_LIST_HEAD(&head->hw_filters);
 	rcu_assign_pointer(tp->root, head);
 	idr_init(&head->handle_idr);
@@ -346,6 +555,7 @@ static void fl_mask_free(struct fl_flow_mask *mask, bool mask_init_done)
 		WARN_ON(!list_empty(&mask->filters));
 		rhashtable_destroy(&mask->ht);
 	}
+	free_percpu(mask->stats);
 	kfree(mask);
 }
 
@@ -374,6 +584,7 @@ static bool fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask)
 
 	spin_lock(&head->masks_lock);
 	list_del_rcu(&mask->list);
+	fl_mask_sort_reset(head);
 	spin_unlock(&head->masks_lock);
 
 	tcf_queue_work(&mask->rwork, fl_mask_free_work);
@@ -579,6 +790,9 @@ static void fl_destroy_sleepable(struct work_struct *work)
 						struct cls_fl_head,
 						rwork);
 
+	cancel_delayed_work_sync(&head->sort_work);
+	kfree(rcu_dereference_protected(head->sorted, 1));
+	free_percpu(head->hint);
 	rhashtable_destroy(&head->ht);
 	kfree(head);
 	module_put(THIS_MODULE);
@@ -1402,6 +1616,12 @@ static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 
 	fl_mask_copy(newmask, mask);
 
+	newmask->stats = alloc_percpu(struct fl_mask_stats);
+	if (!newmask->stats) {
+		err = -ENOMEM;
+		goto errout_free;
+	}
+
 	if ((newmask->key.tp_min.dst && newmask->key.tp_max.dst) ||
 	    (newmask->key.tp_min.src && newmask->key.tp_max.src))
 		newmask->flags |= TCA_FLOWER_MASK_FLAGS_RANGE;
@@ -1422,6 +1642,7 @@ static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 
 	spin_lock(&head->masks_lock);
 	list_add_tail_rcu(&newmask->list, &head->masks);
+	fl_mask_sort_reset(head);
 	spin_unlock(&head->masks_lock);
 
 	return newmask;
@@ -1429,6 +1650,7 @@ static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 errout_destroy:
 	rhashtable_destroy(&newmask->ht);
 errout_free:
+	free_percpu(newmask->stats);
 	kfree(newmask);
 
 	return ERR_PTR(err);
@@ -2430,6 +2652,7 @@ static int fl_dump(struct net *net, struct tcf_proto *tp, void *fh,
 	struct cls_fl_filter *f = fh;
 	struct nlattr *nest;
 	struct fl_flow_key *key, *mask;
+	u64 hits, misses;
 	bool skip_hw;
 
 	if (!f)
@@ -2465,6 +2688,13 @@ static int fl_dump(struct net *net, struct tcf_proto *tp, void *fh,
 	if (nla_put_u32(skb, TCA_FLOWER_IN_HW_COUNT, f->in_hw_count))
 		goto nla_put_failure;
 
+	fl_mask_stats_read(f->mask, &hits, &misses);
+	if (nla_put_u64_64bit(skb, TCA_FLOWER_MASK_HITS, hits,
+			      TCA_FLOWER_PAD) ||
+	    nla_put_u64_64bit(skb, TCA_FLOWER_MASK_MISSES, misses,
+			      TCA_FLOWER_PAD))
+		goto nla_put_failure;
+
 	if (tcf_exts_dump(skb, &f->exts))
 		goto nla_put_failure;
 
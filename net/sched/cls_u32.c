@@ -35,6 +35,8 @@
 #include <linux/bitmap.h>
 #include <linux/netdevice.h>
 #include <linux/hash.h>
+#include <linux/filter.h>
+#include <linux/workqueue.h>
 #include <net/netlink.h>
 #include <net/act_api.h>
 #include <net/pkt_cls.h>
@@ -76,6 +78,7 @@ struct tc_u_hnode {
 	bool			is_root;
 	struct rcu_head		rcu;
 	u32			flags;
+	struct u32_jit __rcu	*jit;	/* program of a root hash table */
 	/* The 'ht' field MUST be the last field in structure to allow for
 	 * more entries allocated at end of structure.
 	 */
@@ -89,6 +92,7 @@ struct tc_u_common {
 	struct idr		handle_idr;
 	struct hlist_node	hnode;
 	long			knodes;
+	struct delayed_work	jit_work;
 };
 
 static inline unsigned int u32_hash_fold(__be32 key,
@@ -100,6 +104,490 @@ static inline unsigned int u32_hash_fold(__be32 key,
 	return h;
 }
 
+/* Translation of the filter tree into an eBPF program for the BPF JIT.
+ *
+ * The program reproduces the walk of u32_classify() for the tree below one
+ * root hash table: hash tables linked by a key node are inlined at the
+ * place of the link, key values and masks become immediates, and the
+ * stack of offsets turns into a frame slot per depth. Packet loads,
+ * counters and actions go through the helpers below, so that statistics
+ * and results are the same as with u32_classify().
+ *
+ * A program references the key nodes it was built from. Programs are
+ * therefore dropped before the tree is changed and rebuilt once it has
+ * been left alone for U32_JIT_DELAY; the interpreter is used meanwhile,
+ * and whenever the tree cannot be translated or the JIT is disabled.
+ * Programs are only built by changes made while the parameter is set.
+ */
+static bool u32_jit_enable __read_mostly;
+module_param_named(jit, u32_jit_enable, bool, 0644);
+MODULE_PARM_DESC(jit, "Translate filters into eBPF programs for the BPF JIT");
+
+/* Protected by rtnl lock */
+static int u32_jit_progs;
+module_param_named(jit_progs, u32_jit_progs, int, 0444);
+MODULE_PARM_DESC(jit_progs, "Number of filter trees run as eBPF programs");
+
+#define U32_JIT_DELAY		(HZ / 10)
+/* Keeps every jump offset within the 16 bits of the instruction */
+#define U32_JIT_MAX_INSNS	S16_MAX
+/* Linked tables are inlined at every link, so the number of key nodes
+ * translated can grow exponentially with the depth of the tree. Bound
+ * the work done under rtnl and leave such trees to the interpreter.
+ */
+#define U32_JIT_MAX_NODES	4096
+
+#define U32_JIT_CTX		BPF_REG_6
+#define U32_JIT_OFF		BPF_REG_7
+#define U32_JIT_OFF2		BPF_REG_8
+#define U32_JIT_SEL		BPF_REG_9
+
+struct u32_jit_ctx {
+	struct sk_buff		*skb;
+	struct tcf_result	*res;
+	unsigned int		off;
+};
+
+struct u32_jit {
+	struct bpf_prog		*prog;
+	struct rcu_head		rcu;
+};
+
+struct u32_jit_state {
+	struct bpf_insn		*insns;
+	unsigned int		len;
+	unsigned int		size;
+	unsigned int		nodes;
+	int			err;
+};
+
+/* Forward jumps to a location not emitted yet are chained through their
+ * offset field, which holds the index of the previous jump plus one.
+ */
+struct u32_jit_label {
+	int			last;
+};
+
+BPF_CALL_3(u32_jit_load_word, const struct u32_jit_ctx *, ctx, int, off,
+	   u32, check_headroom)
+{
+	struct sk_buff *skb = ctx->skb;
+	__be32 *data, hdata;
+
+	if (check_headroom && skb_headroom(skb) + off > INT_MAX)
+		return U64_MAX;
+
+	data = skb_header_pointer(skb, off, 4, &hdata);
+	if (!data)
+		return U64_MAX;
+	return (__force u32)*data;
+}
+
+BPF_CALL_2(u32_jit_load_half, const struct u32_jit_ctx *, ctx, int, off)
+{
+	__be16 *data, hdata;
+
+	data = skb_header_pointer(ctx->skb, off, 2, &hdata);
+	if (!data)
+		return U64_MAX;
+	return (__force u16)*data;
+}
+
+#ifdef CONFIG_CLS_U32_PERF
+BPF_CALL_1(u32_jit_count, u64 __percpu *, cnt)
+{
+	__this_cpu_inc(*cnt);
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_CLS_U32_MARK
+BPF_CALL_1(u32_jit_count_success, u32 __percpu *, cnt)
+{
+	__this_cpu_inc(*cnt);
+	return 0;
+}
+#endif
+
+/* Terminal key node: returns the verdict of the actions, or -1 to go on
+ * with the next key node.
+ */
+BPF_CALL_2(u32_jit_terminal, const struct u32_jit_ctx *, ctx,
+	   struct tc_u_knode *, n)
+{
+	int r;
+
+	*ctx->res = n->res;
+	if (!tcf_match_indev(ctx->skb, n->ifindex))
+		return -1;
+#ifdef CONFIG_CLS_U32_PERF
+	__this_cpu_inc(n->pf->rhit);
+#endif
+	r = tcf_exts_exec(ctx->skb, &n->exts, ctx->res);
+	return r < 0 ? -1 : r;
+}
+
+static void u32_jit_emit(struct u32_jit_state *s, struct bpf_insn insn)
+{
+	struct bpf_insn *insns;
+	unsigned int size;
+
+	if (s->err)
+		return;
+	if (s->len >= U32_JIT_MAX_INSNS) {
+		s->err = -E2BIG;
+		return;
+	}
+	if (s->len == s->size) {
+		size = min_t(unsigned int, max(2 * s->size, 256U),
+			     U32_JIT_MAX_INSNS);
+		insns = krealloc(s->insns, size * sizeof(*insns), GFP_KERNEL);
+		if (!insns) {
+			s->err = -ENOMEM;
+			return;
+		}
+		s->insns = insns;
+		s->size = size;
+	}
+	s->insns[s->len++] = insn;
+}
+
+static void u32_jit_emit_imm64(struct u32_jit_state *s, int reg, u64 imm)
+{
+	struct bpf_insn insns[] = { BPF_LD_IMM64(reg, imm) };
+
+	u32_jit_emit(s, insns[0]);
+	u32_jit_emit(s, insns[1]);
+}
+
+static void u32_jit_emit_call(struct u32_jit_state *s,
+			      u64 (*func)(u64, u64, u64, u64, u64))
+{
+	long delta = (long)func - (long)__bpf_call_base;
+
+	/* Helpers of a module may be out of reach of a call instruction */
+	if (delta != (s32)delta) {
+		s->err = -ERANGE;
+		return;
+	}
+	u32_jit_emit(s, BPF_EMIT_CALL(func));
+}
+
+static void u32_jit_jump(struct u32_jit_state *s, struct u32_jit_label *l,
+			 struct bpf_insn insn)
+{
+	if (s->err)
+		return;
+	insn.off = l->last;
+	l->last = s->len + 1;
+	u32_jit_emit(s, insn);
+}
+
+static void u32_jit_bind(struct u32_jit_state *s, struct u32_jit_label *l)
+{
+	struct bpf_insn *insn;
+	int idx, next;
+
+	if (s->err)
+		return;
+	for (idx = l->last - 1; idx >= 0; idx = next) {
+		insn = &s->insns[idx];
+		next = insn->off - 1;
+		insn->off = s->len - idx - 1;
+	}
+	l->last = 0;
+}
+
+/* Return -1 from the program when the load helper failed, like the goto out
+ * of u32_classify().
+ */
+static void u32_jit_emit_load(struct u32_jit_state *s, int off,
+			      bool add_off2, u32 offmask, bool check_headroom)
+{
+	u32_jit_emit(s, BPF_MOV32_REG(BPF_REG_2, U32_JIT_OFF));
+	if (off)
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_ADD, BPF_REG_2, off));
+	if (add_off2 && offmask) {
+		u32_jit_emit(s, BPF_MOV32_REG(BPF_REG_3, U32_JIT_OFF2));
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, BPF_REG_3, offmask));
+		u32_jit_emit(s, BPF_ALU32_REG(BPF_ADD, BPF_REG_2, BPF_REG_3));
+	}
+	u32_jit_emit(s, BPF_MOV64_REG(BPF_REG_1, U32_JIT_CTX));
+	u32_jit_emit(s, BPF_MOV32_IMM(BPF_REG_3, check_headroom));
+	u32_jit_emit_call(s, u32_jit_load_word);
+	u32_jit_emit(s, BPF_JMP_IMM(BPF_JNE, BPF_REG_0, -1, 1));
+	u32_jit_emit(s, BPF_EXIT_INSN());
+}
+
+static void u32_jit_emit_skb_field(struct u32_jit_state *s, int reg, int off)
+{
+	u32_jit_emit(s, BPF_LDX_MEM(bytes_to_bpf_size(sizeof(void *)), reg,
+				    U32_JIT_CTX,
+				    offsetof(struct u32_jit_ctx, skb)));
+	u32_jit_emit(s, BPF_LDX_MEM(BPF_W, reg, reg, off));
+}
+
+static void u32_jit_emit_terminal(struct u32_jit_state *s,
+				  struct tc_u_knode *n)
+{
+	if (!(n->sel.flags & TC_U32_TERMINAL))
+		return;
+
+	u32_jit_emit(s, BPF_MOV64_REG(BPF_REG_1, U32_JIT_CTX));
+	u32_jit_emit_imm64(s, BPF_REG_2, (unsigned long)n);
+	u32_jit_emit_call(s, u32_jit_terminal);
+	u32_jit_emit(s, BPF_JMP_IMM(BPF_JSLT, BPF_REG_0, 0, 1));
+	u32_jit_emit(s, BPF_EXIT_INSN());
+}
+
+#ifdef CONFIG_CLS_U32_PERF
+static void u32_jit_emit_count(struct u32_jit_state *s, u64 __percpu *cnt)
+{
+	u32_jit_emit_imm64(s, BPF_REG_1, (__force unsigned long)cnt);
+	u32_jit_emit_call(s, u32_jit_count);
+}
+#endif
+
+static void u32_jit_ht(struct u32_jit_state *s, struct tc_u_hnode *ht,
+		       int depth);
+
+/* Code for one key node, which falls through to the next one unless the
+ * packet is classified.
+ */
+static void u32_jit_knode(struct u32_jit_state *s, struct tc_u_knode *n,
+			  int depth)
+{
+	struct tc_u_hnode *ht = rtnl_dereference(n->ht_down);
+	struct u32_jit_label next = {}, pop = {};
+	struct tc_u32_key *key = n->sel.keys;
+	int i, slot = -4 * (depth + 1);
+
+	if (s->err)
+		return;
+	if (++s->nodes > U32_JIT_MAX_NODES) {
+		s->err = -E2BIG;
+		return;
+	}
+
+#ifdef CONFIG_CLS_U32_PERF
+	u32_jit_emit_count(s, &n->pf->rcnt);
+#endif
+	if (tc_skip_sw(n->flags))
+		return;
+
+#ifdef CONFIG_CLS_U32_MARK
+	u32_jit_emit_skb_field(s, BPF_REG_0, offsetof(struct sk_buff, mark));
+	u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, BPF_REG_0, n->mask));
+	u32_jit_jump(s, &next, BPF_JMP32_IMM(BPF_JNE, BPF_REG_0, n->val, 0));
+	u32_jit_emit_imm64(s, BPF_REG_1,
+			   (__force unsigned long)n->pcpu_success);
+	u32_jit_emit_call(s, u32_jit_count_success);
+#endif
+
+	for (i = 0; i < n->sel.nkeys; i++, key++) {
+		u32_jit_emit_load(s, key->off, true, key->offmask, true);
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_XOR, BPF_REG_0,
+					      (__force u32)key->val));
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, BPF_REG_0,
+					      (__force u32)key->mask));
+		u32_jit_jump(s, &next, BPF_JMP32_IMM(BPF_JNE, BPF_REG_0, 0, 0));
+#ifdef CONFIG_CLS_U32_PERF
+		u32_jit_emit_count(s, &n->pf->kcnts[i]);
+#endif
+	}
+
+	if (!ht) {
+		u32_jit_emit_terminal(s, n);
+		u32_jit_bind(s, &next);
+		return;
+	}
+
+	/* The interpreter gives up on the packet there */
+	if (depth >= TC_U32_MAXDEPTH) {
+		s->err = -ELOOP;
+		return;
+	}
+	u32_jit_emit(s, BPF_STX_MEM(BPF_W, BPF_REG_FP, U32_JIT_OFF, slot));
+
+	if (ht->divisor) {
+		u32_jit_emit_load(s, n->sel.hoff, false, 0, false);
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, BPF_REG_0,
+					      (__force u32)n->sel.hmask));
+		u32_jit_emit(s, BPF_ENDIAN(BPF_FROM_BE, BPF_REG_0, 32));
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_RSH, BPF_REG_0, n->fshift));
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, BPF_REG_0, ht->divisor));
+		u32_jit_emit(s, BPF_MOV32_REG(U32_JIT_SEL, BPF_REG_0));
+	}
+
+	if (n->sel.flags & (TC_U32_OFFSET | TC_U32_VAROFFSET)) {
+		u32_jit_emit(s, BPF_MOV32_IMM(U32_JIT_OFF2, n->sel.off + 3));
+		if (n->sel.flags & TC_U32_VAROFFSET) {
+			u32_jit_emit(s, BPF_MOV32_REG(BPF_REG_2, U32_JIT_OFF));
+			u32_jit_emit(s, BPF_ALU32_IMM(BPF_ADD, BPF_REG_2,
+						      n->sel.offoff));
+			u32_jit_emit(s, BPF_MOV64_REG(BPF_REG_1, U32_JIT_CTX));
+			u32_jit_emit_call(s, u32_jit_load_half);
+			u32_jit_emit(s, BPF_JMP_IMM(BPF_JNE, BPF_REG_0, -1, 1));
+			u32_jit_emit(s, BPF_EXIT_INSN());
+			u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, BPF_REG_0,
+					(__force u16)n->sel.offmask));
+			u32_jit_emit(s, BPF_ENDIAN(BPF_FROM_BE, BPF_REG_0, 16));
+			u32_jit_emit(s, BPF_ALU32_IMM(BPF_RSH, BPF_REG_0,
+						      n->sel.offshift));
+			u32_jit_emit(s, BPF_ALU32_REG(BPF_ADD, U32_JIT_OFF2,
+						      BPF_REG_0));
+		}
+		u32_jit_emit(s, BPF_ALU32_IMM(BPF_AND, U32_JIT_OFF2, ~3));
+	}
+	if (n->sel.flags & TC_U32_EAT) {
+		u32_jit_emit(s, BPF_ALU32_REG(BPF_ADD, U32_JIT_OFF,
+					      U32_JIT_OFF2));
+		u32_jit_emit(s, BPF_MOV32_IMM(U32_JIT_OFF2, 0));
+	}
+	if (n->sel.flags & (TC_U32_VAROFFSET | TC_U32_OFFSET | TC_U32_EAT)) {
+		u32_jit_emit_skb_field(s, BPF_REG_1,
+				       offsetof(struct sk_buff, len));
+		u32_jit_jump(s, &pop, BPF_JMP32_REG(BPF_JGE, U32_JIT_OFF,
+						    BPF_REG_1, 0));
+	}
+
+	u32_jit_ht(s, ht, depth + 1);
+
+	u32_jit_bind(s, &pop);
+	u32_jit_emit(s, BPF_LDX_MEM(BPF_W, U32_JIT_OFF, BPF_REG_FP, slot));
+	u32_jit_emit_terminal(s, n);
+	u32_jit_bind(s, &next);
+}
+
+static void u32_jit_ht(struct u32_jit_state *s, struct tc_u_hnode *ht,
+		       int depth)
+{
+	struct u32_jit_label end = {}, skip;
+	struct tc_u_knode *n;
+	unsigned int h;
+
+	for (h = 0; h <= ht->divisor && !s->err; h++) {
+		n = rtnl_dereference(ht->ht[h]);
+		if (!n)
+			continue;
+
+		skip.last = 0;
+		if (ht->divisor)
+			u32_jit_jump(s, &skip, BPF_JMP32_IMM(BPF_JNE,
+							     U32_JIT_SEL,
+							     h, 0));
+		for (; n && !s->err; n = rtnl_dereference(n->next))
+			u32_jit_knode(s, n, depth);
+		if (ht->divisor)
+			u32_jit_jump(s, &end, BPF_JMP_A(0));
+		u32_jit_bind(s, &skip);
+	}
+	u32_jit_bind(s, &end);
+}
+
+static struct u32_jit *u32_jit_compile(struct tc_u_hnode *root)
+{
+	struct u32_jit_state s = {};
+	struct u32_jit *jit = NULL;
+	struct bpf_prog *fp;
+	int err = 0;
+
+	u32_jit_emit(&s, BPF_MOV64_REG(U32_JIT_CTX, BPF_REG_1));
+	u32_jit_emit(&s, BPF_LDX_MEM(BPF_W, U32_JIT_OFF, U32_JIT_CTX,
+				     offsetof(struct u32_jit_ctx, off)));
+	u32_jit_emit(&s, BPF_MOV32_IMM(U32_JIT_OFF2, 0));
+	u32_jit_ht(&s, root, 0);
+	u32_jit_emit(&s, BPF_MOV32_IMM(BPF_REG_0, -1));
+	u32_jit_emit(&s, BPF_EXIT_INSN());
+	if (s.err)
+		goto out;
+
+	fp = bpf_prog_alloc(bpf_prog_size(s.len), 0);
+	if (!fp)
+		goto out;
+	memcpy(fp->insnsi, s.insns, s.len * sizeof(struct bpf_insn));
+	fp->len = s.len;
+	fp->aux->stack_depth = 4 * TC_U32_MAXDEPTH;
+
+	/* Without the JIT, the eBPF interpreter would not be any faster */
+	fp = bpf_prog_select_runtime(fp, &err);
+	if (err || !fp->jited)
+		goto out_free;
+
+	jit = kmalloc(sizeof(*jit), GFP_KERNEL);
+	if (!jit)
+		goto out_free;
+	jit->prog = fp;
+	goto out;
+
+out_free:
+	bpf_prog_free(fp);
+out:
+	kfree(s.insns);
+	return jit;
+}
+
+static void u32_jit_free_rcu(struct rcu_head *head)
+{
+	struct u32_jit *jit = container_of(head, struct u32_jit, rcu);
+
+	bpf_prog_free(jit->prog);
+	kfree(jit);
+}
+
+/* Protected by rtnl lock */
+static void u32_jit_reset(struct tc_u_common *tp_c)
+{
+	struct tc_u_hnode *ht;
+	struct u32_jit *jit;
+
+	for (ht = rtnl_dereference(tp_c->hlist);
+	     ht;
+	     ht = rtnl_dereference(ht->next)) {
+		jit = rtnl_dereference(ht->jit);
+		if (!jit)
+			continue;
+		RCU_INIT_POINTER(ht->jit, NULL);
+		call_rcu(&jit->rcu, u32_jit_free_rcu);
+		u32_jit_progs--;
+	}
+}
+
+static void u32_jit_schedule(struct tc_u_common *tp_c)
+{
+	if (READ_ONCE(u32_jit_enable))
+		mod_delayed_work(system_wq, &tp_c->jit_work, U32_JIT_DELAY);
+}
+
+static void u32_jit_work(struct work_struct *work)
+{
+	struct tc_u_common *tp_c = container_of(to_delayed_work(work),
+						struct tc_u_common,
+						jit_work);
+	struct tc_u_hnode *ht;
+	struct u32_jit *jit;
+
+	/* u32_destroy() cancels this work with rtnl held */
+	if (!rtnl_trylock()) {
+		schedule_delayed_work(&tp_c->jit_work, U32_JIT_DELAY);
+		return;
+	}
+
+	for (ht = rtnl_dereference(tp_c->hlist);
+	     ht;
+	     ht = rtnl_dereference(ht->next)) {
+		if (!ht->is_root || rtnl_dereference(ht->jit))
+			continue;
+		jit = u32_jit_compile(ht);
+		if (!jit)
+			continue;
+		rcu_assign_pointer(ht->jit, jit);
+		u32_jit_progs++;
+	}
+
+	rtnl_unlock();
+}
+
 static int u32_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 			struct tcf_result *res)
 {
@@ -111,6 +599,7 @@ static int u32_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 	struct tc_u_hnode *ht = rcu_dereference_bh(tp->root);
 	unsigned int off = skb_network_offset(skb);
 	struct tc_u_knode *n;
+	struct u32_jit *jit;
 	int sdepth = 0;
 	int off2 = 0;
 	int sel = 0;
@@ -119,6 +608,17 @@ static int u32_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 #endif
 	int i, r;
 
+	jit = rcu_dereference_bh(ht->jit);
+	if (jit && READ_ONCE(u32_jit_enable)) {
+		struct u32_jit_ctx ctx = {
+			.skb = skb,
+			.res = res,
+			.off = off,
+		};
+
+		return BPF_PROG_RUN(jit->prog, &ctx);
+	}
+
 next_ht:
 	n = rcu_dereference_bh(ht->ht[sel]);
 
@@ -372,6 +872,7 @@ static int u32_init(struct tcf_proto *tp)
 		tp_c->ptr = key;
 		INIT_HLIST_NODE(&tp_c->hnode);
 		idr_init(&tp_c->handle_idr);
+		INIT_DELAYED_WORK(&tp_c->jit_work, u32_jit_work);
 
 		hlist_add_head(&tp_c->hnode, tc_u_hash(key));
 	}
@@ -626,6 +1127,8 @@ static void u32_destroy(struct tcf_proto *tp, bool rtnl_held,
 
 	WARN_ON(root_ht == NULL);
 
+	u32_jit_reset(tp_c);
+
 	if (root_ht && --root_ht->refcnt == 1)
 		u32_destroy_hnode(tp, root_ht, extack);
 
@@ -645,8 +1148,11 @@ static void u32_destroy(struct tcf_proto *tp, bool rtnl_held,
 				kfree_rcu(ht, rcu);
 		}
 
+		cancel_delayed_work_sync(&tp_c->jit_work);
 		idr_destroy(&tp_c->handle_idr);
 		kfree(tp_c);
+	} else {
+		u32_jit_schedule(tp_c);
 	}
 
 	tp->data = NULL;
@@ -660,8 +1166,10 @@ static int u32_delete(struct tcf_proto *tp, void *arg, bool *last,
 	int ret = 0;
 
 	if (TC_U32_KEY(ht->handle)) {
+		u32_jit_reset(tp_c);
 		u32_remove_hw_knode(tp, (struct tc_u_knode *)ht, extack);
 		ret = u32_delete_key(tp, (struct tc_u_knode *)ht);
+		u32_jit_schedule(tp_c);
 		goto out;
 	}
 
@@ -671,7 +1179,9 @@ static int u32_delete(struct tcf_proto *tp, void *arg, bool *last,
 	}
 
 	if (ht->refcnt == 1) {
+		u32_jit_reset(tp_c);
 		u32_destroy_hnode(tp, ht, extack);
+		u32_jit_schedule(tp_c);
 	} else {
 		NL_SET_ERR_MSG_MOD(extack, "Can not delete in-use filter");
 		return -EBUSY;
@@ -842,10 +1352,10 @@ static struct tc_u_knode *u32_init_knode(struct net *net, struct tcf_proto *tp,
 	return new;
 }
 
-static int u32_change(struct net *net, struct sk_buff *in_skb,
-		      struct tcf_proto *tp, unsigned long base, u32 handle,
-		      struct nlattr **tca, void **arg, bool ovr, bool rtnl_held,
-		      struct netlink_ext_ack *extack)
+static int __u32_change(struct net *net, struct sk_buff *in_skb,
+			struct tcf_proto *tp, unsigned long base, u32 handle,
+			struct nlattr **tca, void **arg, bool ovr,
+			struct netlink_ext_ack *extack)
 {
 	struct tc_u_common *tp_c = tp->data;
 	struct tc_u_hnode *ht;
@@ -1110,6 +1620,24 @@ static int u32_change(struct net *net, struct sk_buff *in_skb,
 	return err;
 }
 
+static int u32_change(struct net *net, struct sk_buff *in_skb,
+		      struct tcf_proto *tp, unsigned long base, u32 handle,
+		      struct nlattr **tca, void **arg, bool ovr, bool rtnl_held,
+		      struct netlink_ext_ack *extack)
+{
+	struct tc_u_common *tp_c = tp->data;
+	int err;
+
+	/* Key nodes replaced below are freed after a grace period, drop the
+	 * programs which may still reference them first.
+	 */
+	u32_jit_reset(tp_c);
+	err = __u32_change(net, in_skb, tp, base, handle, tca, arg, ovr,
+			   extack);
+	u32_jit_schedule(tp_c);
+	return err;
+}
+
 static void u32_walk(struct tcf_proto *tp, struct tcf_walker *arg,
 		     bool rtnl_held)
 {
@@ -1431,6 +1959,8 @@ static int __init init_u32(void)
 static void __exit exit_u32(void)
 {
 	unregister_tcf_proto_ops(&cls_u32_ops);
+	/* wait for u32_jit_free_rcu() */
+	rcu_barrier();
 	kvfree(tc_u_common_hash);
 }
 
@@ -66,6 +66,10 @@ static int htb_rate_est = 0; /* htb classes have a default rate estimator */
 module_param(htb_rate_est, int, 0640);
 MODULE_PARM_DESC(htb_rate_est, "setup a default rate estimator (4sec 16sec) for htb classes");
 
+static int htb_bypass __read_mostly = 0; /* under rate leaves skip the class tree */
+module_param(htb_bypass, int, 0640);
+MODULE_PARM_DESC(htb_bypass, "Send packets of idle, under rate pfifo leaves without queueing them in the class tree");
+
 /* used internaly to keep status of single class */
 enum htb_cmode {
 	HTB_CANT_SEND,		/* class can't send and can't borrow */
@@ -164,6 +168,9 @@ struct htb_sched {
 	u32			direct_pkts;
 	u32			overlimits;
 
+	/* skbs of under rate leaves, already charged; see htb_may_bypass */
+	struct qdisc_skb_head	bypass_queue;
+
 	struct qdisc_watchdog	watchdog;
 
 	s64			now;	/* cached dequeue time */
@@ -576,6 +583,35 @@ static inline void htb_deactivate(struct htb_sched *q, struct htb_class *cl)
 	cl->prio_activity = 0;
 }
 
+static void htb_charge_class(struct htb_sched *q, struct htb_class *cl,
+			     int level, struct sk_buff *skb);
+
+/**
+ * htb_may_bypass - check whether a packet can skip the class tree
+ *
+ * When no class is backlogged and the leaf class can send at its own
+ * rate, HTB would dequeue the packet right away anyway: the leaf can be
+ * charged at enqueue and the packet queued to the bypass queue. This
+ * saves activating the class in the feed trees, looking it up in DRR
+ * order and deactivating it again. Only plain pfifo leaves qualify, as
+ * other leaf qdiscs may reorder or drop packets.
+ */
+static bool htb_may_bypass(struct htb_sched *q, struct htb_class *cl,
+			   struct Qdisc *sch)
+{
+	s64 diff;
+
+	if (!htb_bypass || cl->leaf.q->ops != &pfifo_qdisc_ops ||
+	    cl->leaf.q->q.qlen ||
+	    q->bypass_queue.qlen >= q->direct_qlen ||
+	    sch->q.qlen != q->direct_queue.qlen + q->bypass_queue.qlen)
+		return false;
+
+	q->now = ktime_get_ns();
+	diff = min_t(s64, q->now - cl->t_c, cl->mbuffer);
+	return htb_class_mode(cl, &diff) == HTB_CAN_SEND;
+}
+
 static int htb_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 		       struct sk_buff **to_free)
 {
@@ -599,6 +635,11 @@ static int htb_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 		__qdisc_drop(skb, to_free);
 		return ret;
 #endif
+	} else if (htb_may_bypass(q, cl, sch)) {
+		__qdisc_enqueue_tail(skb, &q->bypass_queue);
+		qdisc_bstats_update(cl->leaf.q, skb);
+		bstats_update(&cl->bstats, skb);
+		htb_charge_class(q, cl, 0, skb);
 	} else if ((ret = qdisc_enqueue(skb, cl->leaf.q,
 					to_free)) != NET_XMIT_SUCCESS) {
 		if (net_xmit_drop_count(ret)) {
@@ -896,6 +937,8 @@ static struct sk_buff *htb_dequeue(struct Qdisc *sch)
 
 	/* try to dequeue direct packets as high prio (!) to minimize cpu work */
 	skb = __qdisc_dequeue_head(&q->direct_queue);
+	if (skb == NULL)
+		skb = __qdisc_dequeue_head(&q->bypass_queue);
 	if (skb != NULL) {
 ok:
 		qdisc_bstats_update(sch, skb);
@@ -966,6 +1009,7 @@ static void htb_reset(struct Qdisc *sch)
 	}
 	qdisc_watchdog_cancel(&q->watchdog);
 	__qdisc_reset_queue(&q->direct_queue);
+	__qdisc_reset_queue(&q->bypass_queue);
 	sch->q.qlen = 0;
 	sch->qstats.backlog = 0;
 	memset(q->hlevel, 0, sizeof(q->hlevel));
@@ -1027,6 +1071,7 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		return err;
 
 	qdisc_skb_head_init(&q->direct_queue);
+	qdisc_skb_head_init(&q->bypass_queue);
 
 	if (tb[TCA_HTB_DIRECT_QLEN])
 		q->direct_qlen = nla_get_u32(tb[TCA_HTB_DIRECT_QLEN]);
@@ -1244,6 +1289,7 @@ static void htb_destroy(struct Qdisc *sch)
 	}
 	qdisc_class_hash_destroy(&q->clhash);
 	__qdisc_reset_queue(&q->direct_queue);
+	__qdisc_reset_queue(&q->bypass_queue);
 }
 
 static int htb_delete(struct Qdisc *sch, unsigned long arg)
@@ -21,7 +21,7 @@
 struct bpf_map_def SEC("maps") cpu_map = {
 	.type		= BPF_MAP_TYPE_CPUMAP,
 	.key_size	= sizeof(u32),
-	.value_size	= sizeof(u32),
+	.value_size	= sizeof(struct bpf_cpumap_val),
 	.max_entries	= MAX_CPUS,
 };
 
@@ -30,6 +30,8 @@ struct datarec {
 	__u64 processed;
 	__u64 dropped;
 	__u64 issue;
+	__u64 xdp_pass;
+	__u64 xdp_drop;
 };
 
 /* Count RX packets, as XDP bpf_prog doesn't get direct TX-success
@@ -565,6 +567,41 @@ int  xdp_prognum5_lb_hash_ip_pairs(struct xdp_md *ctx)
 	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
 }
 
+/*** Programs run by the cpumap kthread on the remote CPU ***/
+
+SEC("xdp_cpumap/pass")
+int xdp_cpumap_pass(struct xdp_md *ctx)
+{
+	return XDP_PASS;
+}
+
+SEC("xdp_cpumap/drop")
+int xdp_cpumap_drop(struct xdp_md *ctx)
+{
+	return XDP_DROP;
+}
+
+/* Same filter as xdp_cpu_map4_ddos_filter_pktgen, but on remote CPU */
+SEC("xdp_cpumap/ddos_filter_pktgen")
+int xdp_cpumap_ddos_filter_pktgen(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	u16 eth_proto = 0;
+	u64 l3_offset = 0;
+
+	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset)))
+		return XDP_PASS;
+
+	if (eth_proto == ETH_P_IP &&
+	    get_proto_ipv4(ctx, l3_offset) == IPPROTO_UDP &&
+	    get_dest_port_ipv4_udp(ctx, l3_offset) == 9)
+		return XDP_DROP;
+
+	return XDP_PASS;
+}
+
 char _license[] SEC("license") = "GPL";
 
 /*** Trace point code ***/
@@ -699,6 +736,8 @@ struct cpumap_kthread_ctx {
 	unsigned int drops;	//	offset:20; size:4; signed:0;
 	unsigned int processed;	//	offset:24; size:4; signed:0;
 	int sched;		//	offset:28; size:4; signed:1;
+	unsigned int xdp_pass;	//	offset:32; size:4; signed:0;
+	unsigned int xdp_drop;	//	offset:36; size:4; signed:0;
 };
 
 SEC("tracepoint/xdp/xdp_cpumap_kthread")
@@ -712,6 +751,8 @@ int trace_xdp_cpumap_kthread(struct cpumap_kthread_ctx *ctx)
 		return 0;
 	rec->processed += ctx->processed;
 	rec->dropped   += ctx->drops;
+	rec->xdp_pass  += ctx->xdp_pass;
+	rec->xdp_drop  += ctx->xdp_drop;
 
 	/* Count times kthread yielded CPU via schedule call */
 	if (ctx->sched)
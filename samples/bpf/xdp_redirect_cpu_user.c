@@ -37,6 +37,7 @@ static __u32 prog_id;
 
 static __u32 xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST;
 static int cpu_map_fd;
+static int cpumap_prog_fd; /* XDP prog run by the cpumap kthreads */
 static int rx_cnt_map_fd;
 static int redirect_err_cnt_map_fd;
 static int cpumap_enqueue_cnt_map_fd;
@@ -60,6 +61,7 @@ static const struct option long_options[] = {
 	{"skb-mode",	no_argument,		NULL, 'S' },
 	{"sec",		required_argument,	NULL, 's' },
 	{"progname",	required_argument,	NULL, 'p' },
+	{"cpumap-prog",	required_argument,	NULL, 'm' },
 	{"qsize",	required_argument,	NULL, 'q' },
 	{"cpu",		required_argument,	NULL, 'c' },
 	{"stress-mode", no_argument,		NULL, 'x' },
@@ -91,12 +93,20 @@ static void int_exit(int sig)
 	exit(EXIT_OK);
 }
 
-static void print_avail_progs(struct bpf_object *obj)
+#define CPUMAP_PROG_PREFIX "xdp_cpumap/"
+
+static bool is_cpumap_prog(struct bpf_program *prog)
+{
+	return !strncmp(bpf_program__title(prog, false), CPUMAP_PROG_PREFIX,
+			strlen(CPUMAP_PROG_PREFIX));
+}
+
+static void print_avail_progs(struct bpf_object *obj, bool cpumap)
 {
 	struct bpf_program *pos;
 
 	bpf_object__for_each_program(pos, obj) {
-		if (bpf_program__is_xdp(pos))
+		if (bpf_program__is_xdp(pos) && is_cpumap_prog(pos) == cpumap)
 			printf(" %s\n", bpf_program__title(pos, false));
 	}
 }
@@ -120,7 +130,9 @@ static void usage(char *argv[], struct bpf_object *obj)
 		printf("\n");
 	}
 	printf("\n Programs to be used for --progname:\n");
-	print_avail_progs(obj);
+	print_avail_progs(obj, false);
+	printf("\n Programs to be used for --cpumap-prog:\n");
+	print_avail_progs(obj, true);
 	printf("\n");
 }
 
@@ -147,6 +159,8 @@ struct datarec {
 	__u64 processed;
 	__u64 dropped;
 	__u64 issue;
+	__u64 xdp_pass;
+	__u64 xdp_drop;
 };
 struct record {
 	__u64 timestamp;
@@ -169,6 +183,8 @@ static bool map_collect_percpu(int fd, __u32 key, struct record *rec)
 	__u64 sum_processed = 0;
 	__u64 sum_dropped = 0;
 	__u64 sum_issue = 0;
+	__u64 sum_xdp_pass = 0;
+	__u64 sum_xdp_drop = 0;
 	int i;
 
 	if ((bpf_map_lookup_elem(fd, &key, values)) != 0) {
@@ -187,10 +203,16 @@ static bool map_collect_percpu(int fd, __u32 key, struct record *rec)
 		sum_dropped        += values[i].dropped;
 		rec->cpu[i].issue = values[i].issue;
 		sum_issue        += values[i].issue;
+		rec->cpu[i].xdp_pass = values[i].xdp_pass;
+		sum_xdp_pass        += values[i].xdp_pass;
+		rec->cpu[i].xdp_drop = values[i].xdp_drop;
+		sum_xdp_drop        += values[i].xdp_drop;
 	}
 	rec->total.processed = sum_processed;
 	rec->total.dropped   = sum_dropped;
 	rec->total.issue     = sum_issue;
+	rec->total.xdp_pass  = sum_xdp_pass;
+	rec->total.xdp_drop  = sum_xdp_drop;
 	return true;
 }
 
@@ -293,6 +315,17 @@ static __u64 calc_errs_pps(struct datarec *r,
 	return pps;
 }
 
+static void calc_xdp_pps(struct datarec *r, struct datarec *p,
+			 double *xdp_pass, double *xdp_drop, double period_)
+{
+	*xdp_pass = 0, *xdp_drop = 0;
+
+	if (period_ > 0) {
+		*xdp_pass = (r->xdp_pass - p->xdp_pass) / period_;
+		*xdp_drop = (r->xdp_drop - p->xdp_drop) / period_;
+	}
+}
+
 static void stats_print(struct stats_record *stats_rec,
 			struct stats_record *stats_prev,
 			char *prog_name)
@@ -404,6 +437,31 @@ static void stats_print(struct stats_record *stats_rec,
 		printf(fm2_k, "cpumap_kthread", "total", pps, drop, err, e_str);
 	}
 
+	/* Verdicts of the XDP prog run by the cpumap kthreads */
+	if (cpumap_prog_fd > 0) {
+		char *fmt_x = "%-15s %-7d %'-14.0f %'-11.0f\n";
+		char *fm2_x = "%-15s %-7s %'-14.0f %'-11.0f\n";
+		double xdp_pass, xdp_drop;
+
+		printf("%-15s %-7s %-14s %-11s\n",
+		       "", "", "xdp-pass", "xdp-drop");
+		rec  = &stats_rec->kthread;
+		prev = &stats_prev->kthread;
+		t = calc_period(rec, prev);
+		for (i = 0; i < nr_cpus; i++) {
+			struct datarec *r = &rec->cpu[i];
+			struct datarec *p = &prev->cpu[i];
+
+			calc_xdp_pps(r, p, &xdp_pass, &xdp_drop, t);
+			if (xdp_pass > 0 || xdp_drop > 0)
+				printf(fmt_x, "xdp-in-kthread",
+				       i, xdp_pass, xdp_drop);
+		}
+		calc_xdp_pps(&rec->total, &prev->total,
+			     &xdp_pass, &xdp_drop, t);
+		printf(fm2_x, "xdp-in-kthread", "total", xdp_pass, xdp_drop);
+	}
+
 	/* XDP redirect err tracepoints (very unlikely) */
 	{
 		char *fmt_err = "%-15s %-7d %'-14.0f %'-11.0f\n";
@@ -487,6 +545,10 @@ static inline void swap(struct stats_record **a, struct stats_record **b)
 static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 			    __u32 avail_idx, bool new)
 {
+	struct bpf_cpumap_val value = {
+		.qsize = queue_size,
+		.bpf_prog.fd = cpumap_prog_fd,
+	};
 	__u32 curr_cpus_count = 0;
 	__u32 key = 0;
 	int ret;
@@ -494,7 +556,7 @@ static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 	/* Add a CPU entry to cpumap, as this allocate a cpu entry in
 	 * the kernel for the cpu.
 	 */
-	ret = bpf_map_update_elem(cpu_map_fd, &cpu, &queue_size, 0);
+	ret = bpf_map_update_elem(cpu_map_fd, &cpu, &value, 0);
 	if (ret) {
 		fprintf(stderr, "Create CPU entry failed (err:%d)\n", ret);
 		exit(EXIT_FAIL_BPF);
@@ -620,6 +682,8 @@ int main(int argc, char **argv)
 {
 	struct rlimit r = {10 * 1024 * 1024, RLIM_INFINITY};
 	char *prog_name = "xdp_cpu_map5_lb_hash_ip_pairs";
+	char *cpumap_prog_name = NULL;
+	int add_cpus[MAX_CPUS];
 	struct bpf_prog_load_attr prog_load_attr = {
 		.prog_type	= BPF_PROG_TYPE_UNSPEC,
 	};
@@ -634,7 +698,7 @@ int main(int argc, char **argv)
 	int longindex = 0;
 	int interval = 2;
 	int add_cpu = -1;
-	int opt, err;
+	int opt, err, i;
 	int prog_fd;
 	__u32 qsize;
 
@@ -669,7 +733,7 @@ int main(int argc, char **argv)
 	mark_cpus_unavailable();
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hSd:s:p:q:c:xzF",
+	while ((opt = getopt_long(argc, argv, "hSd:s:p:m:q:c:xzF",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -703,17 +767,20 @@ int main(int argc, char **argv)
 			/* Selecting eBPF prog to load */
 			prog_name = optarg;
 			break;
+		case 'm':
+			/* Selecting eBPF prog run by the cpumap kthreads */
+			cpumap_prog_name = optarg;
+			break;
 		case 'c':
 			/* Add multiple CPUs */
 			add_cpu = strtoul(optarg, NULL, 0);
-			if (add_cpu >= MAX_CPUS) {
+			if (add_cpu >= MAX_CPUS || added_cpus >= MAX_CPUS) {
 				fprintf(stderr,
 				"--cpu nr too large for cpumap err(%d):%s\n",
 					errno, strerror(errno));
 				goto error;
 			}
-			create_cpu_entry(add_cpu, qsize, added_cpus, true);
-			added_cpus++;
+			add_cpus[added_cpus++] = add_cpu;
 			break;
 		case 'q':
 			qsize = atoi(optarg);
@@ -742,6 +809,24 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_OPTION;
 	}
 
+	if (cpumap_prog_name) {
+		prog = bpf_object__find_program_by_title(obj,
+							 cpumap_prog_name);
+		if (!prog || !is_cpumap_prog(prog)) {
+			fprintf(stderr, "ERR: --cpumap-prog %s not found\n",
+				cpumap_prog_name);
+			usage(argv, obj);
+			return EXIT_FAIL_OPTION;
+		}
+		cpumap_prog_fd = bpf_program__fd(prog);
+	}
+
+	/* Entries are created once all options are known, as they
+	 * depend on both --qsize and --cpumap-prog.
+	 */
+	for (i = 0; i < added_cpus; i++)
+		create_cpu_entry(add_cpus[i], qsize, i, true);
+
 	/* Remove XDP program when program is interrupted or killed */
 	signal(SIGINT, int_exit);
 	signal(SIGTERM, int_exit);
@@ -0,0 +1,113 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Benchmark xdp_redirect_cpu over a veth pair, without any NIC.
+#
+# pktgen in a network namespace sends UDP packets (port 9) over the
+# peer veth device; xdp_redirect_cpu runs native XDP on the other end
+# and redirects them to the given CPUs via cpumap.  Compare e.g.:
+#
+#  ./xdp_redirect_cpu_veth.sh -c 2
+#  ./xdp_redirect_cpu_veth.sh -c 2 -m xdp_cpumap/drop
+#  ./xdp_redirect_cpu_veth.sh -c 2 -m xdp_cpumap/ddos_filter_pktgen
+#
+# Without a cpumap program every frame gets an SKB on the remote CPU,
+# which the network stack then drops.  With one, the remote CPU drops
+# the frames before any SKB is allocated.
+#
+DIR=$(dirname $0)
+NS=xdp_cpumap_bench
+DEV=veth_cpumap0
+PEER=veth_cpumap1
+PGDEV=/proc/net/pktgen
+CPUS=()
+MPROG=
+PROG=xdp_cpu_map0
+COUNT=0
+PKT_SIZE=64
+SEC=2
+
+function usage() {
+    echo ""
+    echo "Usage: $0 -c CPU [-c CPU ...] [-m cpumap-prog] [-p prog] [-n count] [-s size]"
+    echo "  -c : CPU to redirect to (required, can be repeated)"
+    echo "  -m : XDP prog to run on the cpumap kthreads, e.g. xdp_cpumap/drop"
+    echo "  -p : XDP prog on $DEV (default $PROG)"
+    echo "  -n : packets to send, 0 means until interrupted (default $COUNT)"
+    echo "  -s : packet size (default $PKT_SIZE)"
+    echo ""
+}
+
+function err() {
+    local exitcode=$1
+    shift
+    echo "ERROR: $@" >&2
+    exit $exitcode
+}
+
+function cleanup() {
+    [ -n "$PID" ] && kill $PID 2>/dev/null && wait $PID 2>/dev/null
+    ip netns exec $NS sh -c "echo stop > $PGDEV/pgctrl" 2>/dev/null
+    ip link del $DEV 2>/dev/null
+    ip netns del $NS 2>/dev/null
+}
+
+function pgset() {
+    local file=$1
+    shift
+    ip netns exec $NS sh -c "echo \"$*\" > $file" ||
+	err 3 "pktgen: failed writing \"$*\" to $file"
+}
+
+while getopts "c:m:p:n:s:h" opt; do
+    case $opt in
+	c) CPUS+=($OPTARG) ;;
+	m) MPROG=$OPTARG ;;
+	p) PROG=$OPTARG ;;
+	n) COUNT=$OPTARG ;;
+	s) PKT_SIZE=$OPTARG ;;
+	*) usage; exit 2 ;;
+    esac
+done
+
+[ ${#CPUS[@]} -eq 0 ] && { usage; err 2 "need at least one -c CPU"; }
+[ $EUID -ne 0 ] && err 4 "need root privileges"
+[ -x $DIR/xdp_redirect_cpu ] || err 4 "build samples/bpf first"
+
+trap cleanup EXIT
+modprobe pktgen || err 4 "pktgen module not available"
+
+ip netns add $NS || err 5 "cannot create netns $NS"
+ip link add $DEV type veth peer name $PEER netns $NS
+ip link set $DEV up
+ip netns exec $NS ip link set $PEER up
+DST_MAC=$(cat /sys/class/net/$DEV/address)
+
+ARGS="--dev $DEV --progname $PROG --sec $SEC"
+for cpu in "${CPUS[@]}"; do
+    ARGS="$ARGS --cpu $cpu"
+done
+[ -n "$MPROG" ] && ARGS="$ARGS --cpumap-prog $MPROG"
+
+$DIR/xdp_redirect_cpu $ARGS &
+PID=$!
+sleep 1
+kill -0 $PID 2>/dev/null || { PID=; err 6 "xdp_redirect_cpu failed to start"; }
+
+# Single pktgen thread, on the first CPU pktgen has a thread for
+PGTHREAD=$(ip netns exec $NS sh -c "ls $PGDEV" | grep -m1 kpktgend_)
+pgset $PGDEV/$PGTHREAD "rem_device_all"
+pgset $PGDEV/$PGTHREAD "add_device $PEER"
+pgset $PGDEV/$PEER "flag NO_TIMESTAMP"
+pgset $PGDEV/$PEER "count $COUNT"
+pgset $PGDEV/$PEER "clone_skb 0"
+pgset $PGDEV/$PEER "pkt_size $PKT_SIZE"
+pgset $PGDEV/$PEER "delay 0"
+pgset $PGDEV/$PEER "dst_mac $DST_MAC"
+pgset $PGDEV/$PEER "dst 198.18.0.42"
+pgset $PGDEV/$PEER "udp_dst_min 9"
+pgset $PGDEV/$PEER "udp_dst_max 9"
+
+echo "Running pktgen over $PEER -> $DEV (ctrl-c to stop)"
+# Blocks until count packets are sent, or interrupted
+ip netns exec $NS sh -c "echo start > $PGDEV/pgctrl"
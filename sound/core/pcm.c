@@ -470,6 +470,9 @@ static void snd_pcm_substream_proc_status_read(struct snd_info_entry *entry,
 	snd_iprintf(buffer, "-----\n");
 	snd_iprintf(buffer, "hw_ptr      : %ld\n", runtime->status->hw_ptr);
 	snd_iprintf(buffer, "appl_ptr    : %ld\n", runtime->control->appl_ptr);
+	if (runtime->no_period_wakeup)
+		snd_iprintf(buffer, "timer_wakeups: %lu\n",
+			    runtime->wakeup_count);
  unlock:
 	mutex_unlock(&substream->pcm->open_mutex);
 }
@@ -967,6 +970,7 @@ int snd_pcm_attach_substream(struct snd_pcm *pcm, int stream,
 	runtime->status->state = SNDRV_PCM_STATE_OPEN;
 
 	substream->runtime = runtime;
+	snd_pcm_wakeup_timer_init(substream);
 	substream->private_data = pcm->private_data;
 	substream->ref_count = 1;
 	substream->f_flags = file->f_flags;
@@ -983,6 +987,7 @@ void snd_pcm_detach_substream(struct snd_pcm_substream *substream)
 	if (PCM_RUNTIME_CHECK(substream))
 		return;
 	runtime = substream->runtime;
+	hrtimer_cancel(&runtime->wakeup_timer);
 	if (runtime->private_free != NULL)
 		runtime->private_free(runtime);
 	free_pages_exact(runtime->status,
@@ -459,6 +459,92 @@ int snd_pcm_update_hw_ptr(struct snd_pcm_substream *substream)
 	return snd_pcm_update_hw_ptr0(substream, 0);
 }
 
+/*
+ * Wakeup timer for streams without period wakeups
+ *
+ * Without period interrupts nothing updates the hw pointer while a task
+ * sleeps for avail_min (or twake) frames.  Instead, a per-stream hrtimer
+ * is armed at the time the requested fill level is expected to be
+ * reached, extrapolated from the current avail and the rate.  On expiry,
+ * the hw pointer is resynced from the driver, which wakes up the sleepers
+ * via snd_pcm_update_state().  If the driver pointer lags behind the
+ * estimate, the timer is simply re-armed for the remaining frames.
+ * A draining playback stream is woken up once the whole buffer is played.
+ *
+ * Non-atomic PCMs are skipped, as their stream lock is a mutex.
+ */
+#define PCM_WAKEUP_MIN_NS	(250 * NSEC_PER_USEC)
+
+static u64 pcm_wakeup_delay_ns(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_uframes_t avail, need;
+
+	if (runtime->status->state == SNDRV_PCM_STATE_DRAINING)
+		need = runtime->buffer_size;
+	else if (runtime->twake)
+		need = runtime->twake;
+	else
+		need = runtime->control->avail_min;
+	avail = snd_pcm_avail(substream);
+	if (avail >= need || !runtime->rate)
+		return 0;
+	return max_t(u64, PCM_WAKEUP_MIN_NS,
+		     div_u64((u64)(need - avail) * NSEC_PER_SEC,
+			     runtime->rate));
+}
+
+static enum hrtimer_restart snd_pcm_wakeup_timer_func(struct hrtimer *timer)
+{
+	struct snd_pcm_runtime *runtime =
+		container_of(timer, struct snd_pcm_runtime, wakeup_timer);
+	struct snd_pcm_substream *substream = runtime->wakeup_substream;
+	unsigned long flags;
+	u64 delay = 0;
+
+	snd_pcm_stream_lock_irqsave(substream, flags);
+	runtime->wakeup_count++;
+	if (snd_pcm_running(substream) &&
+	    snd_pcm_update_hw_ptr(substream) >= 0 &&
+	    (waitqueue_active(&runtime->sleep) ||
+	     waitqueue_active(&runtime->tsleep)))
+		delay = pcm_wakeup_delay_ns(substream);
+	/*
+	 * The timer is only ever started under the stream lock: a sleeper
+	 * may have armed it again while we were waiting for the lock, in
+	 * which case it is queued already and must not be forwarded.
+	 */
+	if (delay && !hrtimer_is_queued(timer))
+		hrtimer_start(timer, ns_to_ktime(delay), HRTIMER_MODE_REL);
+	snd_pcm_stream_unlock_irqrestore(substream, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+void snd_pcm_wakeup_timer_init(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+
+	hrtimer_init(&runtime->wakeup_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	runtime->wakeup_timer.function = snd_pcm_wakeup_timer_func;
+	runtime->wakeup_substream = substream;
+}
+
+/* call it with the stream lock held */
+void snd_pcm_wakeup_timer_arm(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	u64 delay;
+
+	if (!runtime->no_period_wakeup || substream->pcm->nonatomic ||
+	    !snd_pcm_running(substream))
+		return;
+	delay = pcm_wakeup_delay_ns(substream);
+	if (delay)
+		hrtimer_start(&runtime->wakeup_timer, ns_to_ktime(delay),
+			      HRTIMER_MODE_REL);
+}
+
 /**
  * snd_pcm_set_ops - set the PCM operators
  * @pcm: the pcm instance
@@ -1859,6 +1945,7 @@ static int wait_for_avail(struct snd_pcm_substream *substream,
 		avail = snd_pcm_avail(substream);
 		if (avail >= runtime->twake)
 			break;
+		snd_pcm_wakeup_timer_arm(substream);
 		snd_pcm_stream_unlock_irq(substream);
 
 		tout = schedule_timeout(wait_time);
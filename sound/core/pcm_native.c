@@ -1875,6 +1875,8 @@ static int snd_pcm_drain(struct snd_pcm_substream *substream,
 		init_waitqueue_entry(&wait, current);
 		set_current_state(TASK_INTERRUPTIBLE);
 		add_wait_queue(&to_check->sleep, &wait);
+		/* nothing else updates the hw pointer without period wakeups */
+		snd_pcm_wakeup_timer_arm(to_check->wakeup_substream);
 		snd_pcm_stream_unlock_irq(substream);
 		if (runtime->no_period_wakeup)
 			tout = MAX_SCHEDULE_TIMEOUT;
@@ -3188,6 +3190,8 @@ static __poll_t snd_pcm_poll(struct file *file, poll_table *wait)
 	case SNDRV_PCM_STATE_PAUSED:
 		if (avail >= runtime->control->avail_min)
 			mask = ok;
+		else
+			snd_pcm_wakeup_timer_arm(substream);
 		break;
 	case SNDRV_PCM_STATE_DRAINING:
 		if (substream->stream == SNDRV_PCM_STREAM_CAPTURE) {
@@ -11,28 +11,18 @@
 #include "seq_prioq.h"
 
 
-/* Implementation is a simple linked list for now...
+/* Implementation is a red-black tree ordered by timestamp.
 
    This priority queue orders the events on timestamp. For events with an
-   equeal timestamp the queue behaves as a FIFO. 
-
-   *
-   *           +-------+
-   *  Head --> | first |
-   *           +-------+
-   *                 |next
-   *           +-----v-+
-   *           |       |
-   *           +-------+
-   *                 |
-   *           +-----v-+
-   *           |       |
-   *           +-------+
-   *                 |
-   *           +-----v-+
-   *  Tail --> | last  |
-   *           +-------+
-   *
+   equal timestamp the queue behaves as a FIFO, unless the event has the
+   high priority flag, in which case it is put before all the events with
+   the same timestamp.
+
+   The leftmost node is cached, so the head of the queue is found in O(1).
+   The rightmost node is kept in tail, so that ordered data (which is the
+   common case when a sequencer application or a midi file player is
+   feeding us) is appended without walking the tree. Any other insertion
+   is O(log n).
 
  */
 
@@ -48,7 +38,7 @@ struct snd_seq_prioq *snd_seq_prioq_new(void)
 		return NULL;
 	
 	spin_lock_init(&f->lock);
-	f->head = NULL;
+	f->root = RB_ROOT_CACHED;
 	f->tail = NULL;
 	f->cells = 0;
 	
@@ -127,13 +117,30 @@ static inline int compare_timestamp_rel(struct snd_seq_event *a,
 	}
 }
 
+static inline struct snd_seq_event_cell *prioq_cell(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct snd_seq_event_cell, node) : NULL;
+}
+
+/* unlink a cell from prioq; the lock must be held */
+static void prioq_unlink(struct snd_seq_prioq *f,
+			 struct snd_seq_event_cell *cell)
+{
+	if (f->tail == cell)
+		f->tail = prioq_cell(rb_prev(&cell->node));
+	rb_erase_cached(&cell->node, &f->root);
+	RB_CLEAR_NODE(&cell->node);
+	cell->next = NULL;
+	f->cells--;
+}
+
 /* enqueue cell to prioq */
 int snd_seq_prioq_cell_in(struct snd_seq_prioq * f,
 			  struct snd_seq_event_cell * cell)
 {
-	struct snd_seq_event_cell *cur, *prev;
+	struct rb_node **link, *parent;
 	unsigned long flags;
-	int count;
+	bool leftmost = true, rightmost = true;
 	int prior;
 
 	if (snd_BUG_ON(!f || !cell))
@@ -147,52 +154,39 @@ int snd_seq_prioq_cell_in(struct snd_seq_prioq * f,
 	/* check if this element needs to inserted at the end (ie. ordered 
 	   data is inserted) This will be very likeley if a sequencer 
 	   application or midi file player is feeding us (sequential) data */
-	if (f->tail && !prior) {
-		if (compare_timestamp(&cell->event, &f->tail->event)) {
-			/* add new cell to tail of the fifo */
-			f->tail->next = cell;
-			f->tail = cell;
-			cell->next = NULL;
-			f->cells++;
-			spin_unlock_irqrestore(&f->lock, flags);
-			return 0;
-		}
+	if (f->tail && !prior &&
+	    compare_timestamp(&cell->event, &f->tail->event)) {
+		/* the tail is the rightmost node, so it has no right child */
+		parent = &f->tail->node;
+		link = &parent->rb_right;
+		leftmost = false;
+		goto insert;
 	}
-	/* traverse list of elements to find the place where the new cell is
-	   to be inserted... Note that this is a order n process ! */
 
-	prev = NULL;		/* previous cell */
-	cur = f->head;		/* cursor */
-
-	count = 10000; /* FIXME: enough big, isn't it? */
-	while (cur != NULL) {
-		/* compare timestamps */
+	/* descend the tree to find the place where the new cell is to be
+	   inserted; cells with an equal timestamp go to the right unless
+	   the new cell is prior to others */
+	parent = NULL;
+	link = &f->root.rb_root.rb_node;
+	while (*link) {
+		struct snd_seq_event_cell *cur = prioq_cell(*link);
 		int rel = compare_timestamp_rel(&cell->event, &cur->event);
-		if (rel < 0)
-			/* new cell has earlier schedule time, */
-			break;
-		else if (rel == 0 && prior)
-			/* equal schedule time and prior to others */
-			break;
-		/* new cell has equal or larger schedule time, */
-		/* move cursor to next cell */
-		prev = cur;
-		cur = cur->next;
-		if (! --count) {
-			spin_unlock_irqrestore(&f->lock, flags);
-			pr_err("ALSA: seq: cannot find a pointer.. infinite loop?\n");
-			return -EINVAL;
+
+		parent = *link;
+		if (rel < 0 || (rel == 0 && prior)) {
+			link = &parent->rb_left;
+			rightmost = false;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
 		}
 	}
 
-	/* insert it before cursor */
-	if (prev != NULL)
-		prev->next = cell;
-	cell->next = cur;
-
-	if (f->head == cur) /* this is the first cell, set head to it */
-		f->head = cell;
-	if (cur == NULL) /* reached end of the list */
+ insert:
+	cell->next = NULL;
+	rb_link_node(&cell->node, parent, link);
+	rb_insert_color_cached(&cell->node, &f->root, leftmost);
+	if (rightmost) /* reached end of the queue */
 		f->tail = cell;
 	f->cells++;
 	spin_unlock_irqrestore(&f->lock, flags);
@@ -221,22 +215,50 @@ struct snd_seq_event_cell *snd_seq_prioq_cell_out(struct snd_seq_prioq *f,
 	}
 	spin_lock_irqsave(&f->lock, flags);
 
-	cell = f->head;
+	cell = prioq_cell(rb_first_cached(&f->root));
 	if (cell && current_time && !event_is_ready(&cell->event, current_time))
 		cell = NULL;
-	if (cell) {
-		f->head = cell->next;
+	if (cell)
+		prioq_unlink(f, cell);
 
-		/* reset tail if this was the last element */
-		if (f->tail == cell)
-			f->tail = NULL;
+	spin_unlock_irqrestore(&f->lock, flags);
+	return cell;
+}
 
-		cell->next = NULL;
-		f->cells--;
+/* dequeue up to max ready cells from prioq at once;
+ * the cells are returned chained via cell->next in queue order.
+ * the batch ends at a queue control event, since dispatching it may
+ * change the queue time the following cells must be checked against.
+ */
+struct snd_seq_event_cell *snd_seq_prioq_cells_out(struct snd_seq_prioq *f,
+						   void *current_time,
+						   int max)
+{
+	struct snd_seq_event_cell *cell, *first = NULL, *last = NULL;
+	unsigned long flags;
+
+	if (f == NULL) {
+		pr_debug("ALSA: seq: snd_seq_prioq_cells_out() called with NULL prioq\n");
+		return NULL;
+	}
+	spin_lock_irqsave(&f->lock, flags);
+
+	while (max-- > 0) {
+		cell = prioq_cell(rb_first_cached(&f->root));
+		if (!cell || !event_is_ready(&cell->event, current_time))
+			break;
+		prioq_unlink(f, cell);
+		if (last)
+			last->next = cell;
+		else
+			first = cell;
+		last = cell;
+		if (snd_seq_ev_is_queue_type(&cell->event))
+			break;
 	}
 
 	spin_unlock_irqrestore(&f->lock, flags);
-	return cell;
+	return first;
 }
 
 /* return number of events available in prioq */
@@ -274,44 +296,25 @@ static inline int prioq_match(struct snd_seq_event_cell *cell,
 /* remove cells for left client */
 void snd_seq_prioq_leave(struct snd_seq_prioq * f, int client, int timestamp)
 {
-	register struct snd_seq_event_cell *cell, *next;
+	struct snd_seq_event_cell *cell, *next;
 	unsigned long flags;
-	struct snd_seq_event_cell *prev = NULL;
 	struct snd_seq_event_cell *freefirst = NULL, *freeprev = NULL, *freenext;
 
 	/* collect all removed cells */
 	spin_lock_irqsave(&f->lock, flags);
-	cell = f->head;
+	cell = prioq_cell(rb_first_cached(&f->root));
 	while (cell) {
-		next = cell->next;
+		next = prioq_cell(rb_next(&cell->node));
 		if (prioq_match(cell, client, timestamp)) {
 			/* remove cell from prioq */
-			if (cell == f->head) {
-				f->head = cell->next;
-			} else {
-				prev->next = cell->next;
-			}
-			if (cell == f->tail)
-				f->tail = cell->next;
-			f->cells--;
+			prioq_unlink(f, cell);
 			/* add cell to free list */
-			cell->next = NULL;
 			if (freefirst == NULL) {
 				freefirst = cell;
 			} else {
 				freeprev->next = cell;
 			}
 			freeprev = cell;
-		} else {
-#if 0
-			pr_debug("ALSA: seq: type = %i, source = %i, dest = %i, "
-			       "client = %i\n",
-				cell->event.type,
-				cell->event.source.client,
-				cell->event.dest.client,
-				client);
-#endif
-			prev = cell;
 		}
 		cell = next;		
 	}
@@ -386,31 +389,21 @@ void snd_seq_prioq_remove_events(struct snd_seq_prioq * f, int client,
 {
 	struct snd_seq_event_cell *cell, *next;
 	unsigned long flags;
-	struct snd_seq_event_cell *prev = NULL;
 	struct snd_seq_event_cell *freefirst = NULL, *freeprev = NULL, *freenext;
 
 	/* collect all removed cells */
 	spin_lock_irqsave(&f->lock, flags);
-	cell = f->head;
+	cell = prioq_cell(rb_first_cached(&f->root));
 
 	while (cell) {
-		next = cell->next;
+		next = prioq_cell(rb_next(&cell->node));
 		if (cell->event.source.client == client &&
 			prioq_remove_match(info, &cell->event)) {
 
 			/* remove cell from prioq */
-			if (cell == f->head) {
-				f->head = cell->next;
-			} else {
-				prev->next = cell->next;
-			}
-
-			if (cell == f->tail)
-				f->tail = cell->next;
-			f->cells--;
+			prioq_unlink(f, cell);
 
 			/* add cell to free list */
-			cell->next = NULL;
 			if (freefirst == NULL) {
 				freefirst = cell;
 			} else {
@@ -418,8 +411,6 @@ void snd_seq_prioq_remove_events(struct snd_seq_prioq * f, int client,
 			}
 
 			freeprev = cell;
-		} else {
-			prev = cell;
 		}
 		cell = next;		
 	}
@@ -432,5 +423,3 @@ void snd_seq_prioq_remove_events(struct snd_seq_prioq * f, int client,
 		freefirst = freenext;
 	}
 }
-
-
@@ -6,13 +6,14 @@
 #ifndef __SND_SEQ_PRIOQ_H
 #define __SND_SEQ_PRIOQ_H
 
+#include <linux/rbtree.h>
 #include "seq_memory.h"
 
 
 /* === PRIOQ === */
 
 struct snd_seq_prioq {
-	struct snd_seq_event_cell *head;      /* pointer to head of prioq */
+	struct rb_root_cached root;           /* cells ordered by timestamp */
 	struct snd_seq_event_cell *tail;      /* pointer to tail of prioq */
 	int cells;
 	spinlock_t lock;
@@ -32,6 +33,11 @@ int snd_seq_prioq_cell_in(struct snd_seq_prioq *f, struct snd_seq_event_cell *ce
 struct snd_seq_event_cell *snd_seq_prioq_cell_out(struct snd_seq_prioq *f,
 						  void *current_time);
 
+/* dequeue a batch of ready cells from prioq */
+struct snd_seq_event_cell *snd_seq_prioq_cells_out(struct snd_seq_prioq *f,
+						   void *current_time,
+						   int max);
+
 /* return number of events available in prioq */
 int snd_seq_prioq_avail(struct snd_seq_prioq *f);
 
@@ -234,6 +234,21 @@ struct snd_seq_queue *snd_seq_queue_find_name(char *name)
 
 /* -------------------------------------------------------- */
 
+/* max number of ready cells taken out of prioq with a single lock */
+#define SEQ_DISPATCH_BATCH	32
+
+/* dispatch a chain of cells returned by snd_seq_prioq_cells_out() */
+static void dispatch_cells(struct snd_seq_event_cell *cell, int atomic, int hop)
+{
+	struct snd_seq_event_cell *next;
+
+	for (; cell; cell = next) {
+		next = cell->next;
+		cell->next = NULL;
+		snd_seq_dispatch_event(cell, atomic, hop);
+	}
+}
+
 void snd_seq_check_queue(struct snd_seq_queue *q, int atomic, int hop)
 {
 	unsigned long flags;
@@ -255,19 +270,21 @@ void snd_seq_check_queue(struct snd_seq_queue *q, int atomic, int hop)
       __again:
 	/* Process tick queue... */
 	for (;;) {
-		cell = snd_seq_prioq_cell_out(q->tickq,
-					      &q->timer->tick.cur_tick);
+		cell = snd_seq_prioq_cells_out(q->tickq,
+					       &q->timer->tick.cur_tick,
+					       SEQ_DISPATCH_BATCH);
 		if (!cell)
 			break;
-		snd_seq_dispatch_event(cell, atomic, hop);
+		dispatch_cells(cell, atomic, hop);
 	}
 
 	/* Process time queue... */
 	for (;;) {
-		cell = snd_seq_prioq_cell_out(q->timeq, &q->timer->cur_time);
+		cell = snd_seq_prioq_cells_out(q->timeq, &q->timer->cur_time,
+					       SEQ_DISPATCH_BATCH);
 		if (!cell)
 			break;
-		snd_seq_dispatch_event(cell, atomic, hop);
+		dispatch_cells(cell, atomic, hop);
 	}
 
 	/* free lock */
@@ -388,7 +388,13 @@ static int dummy_hrtimer_start(struct snd_pcm_substream *substream)
 	struct dummy_hrtimer_pcm *dpcm = substream->runtime->private_data;
 
 	dpcm->base_time = hrtimer_cb_get_time(&dpcm->timer);
-	hrtimer_start(&dpcm->timer, dpcm->period_time, HRTIMER_MODE_REL_SOFT);
+	/*
+	 * Without period wakeups, the PCM core polls the pointer on its
+	 * own when needed, so no period timer is required.
+	 */
+	if (!substream->runtime->no_period_wakeup)
+		hrtimer_start(&dpcm->timer, dpcm->period_time,
+			      HRTIMER_MODE_REL_SOFT);
 	atomic_set(&dpcm->running, 1);
 	return 0;
 }
@@ -560,6 +566,11 @@ static int dummy_pcm_open(struct snd_pcm_substream *substream)
 	get_dummy_ops(substream) = ops;
 
 	runtime->hw = dummy->pcm_hw;
+#ifdef CONFIG_HIGH_RES_TIMERS
+	/* the hrtimer pointer is computed from the elapsed time */
+	if (ops == &dummy_hrtimer_ops)
+		runtime->hw.info |= SNDRV_PCM_INFO_NO_PERIOD_WAKEUP;
+#endif
 	if (substream->pcm->device & 1) {
 		runtime->hw.info &= ~SNDRV_PCM_INFO_INTERLEAVED;
 		runtime->hw.info |= SNDRV_PCM_INFO_NONINTERLEAVED;
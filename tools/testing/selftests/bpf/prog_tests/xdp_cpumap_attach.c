@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <test_progs.h>
+
+void test_xdp_cpumap_attach(void)
+{
+	const char *file = "./test_xdp_with_cpumap_helpers.o";
+	struct bpf_prog_load_attr attr = {
+		.file = file,
+		.prog_type = BPF_PROG_TYPE_UNSPEC,
+	};
+	struct bpf_cpumap_val val = {
+		.qsize = 192,
+	};
+	struct bpf_prog_info info = {};
+	__u32 len = sizeof(info);
+	struct bpf_program *prog;
+	struct bpf_object *obj;
+	int err, prog_fd, map_fd;
+	__u32 duration = 0;
+	__u32 idx = 0;
+
+	err = bpf_prog_load_xattr(&attr, &obj, &prog_fd);
+	if (CHECK(err, "load", "err %d errno %d\n", err, errno))
+		return;
+
+	map_fd = bpf_find_map(__func__, obj, "cpu_map");
+	if (CHECK(map_fd < 0, "find cpu_map", "map_fd %d\n", map_fd))
+		goto out;
+
+	/* Entry without a program */
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	CHECK(err, "add cpumap entry", "err %d errno %d\n", err, errno);
+
+	err = bpf_map_lookup_elem(map_fd, &idx, &val);
+	CHECK(err || val.qsize != 192 || val.bpf_prog.id != 0,
+	      "read cpumap entry", "err %d qsize %u prog id %u\n",
+	      err, val.qsize, val.bpf_prog.id);
+
+	/* Entry with a BPF_XDP_CPUMAP program */
+	prog = bpf_object__find_program_by_title(obj, "xdp_cpumap/dummy_cm");
+	if (CHECK(!prog, "find cpumap prog", "not found\n"))
+		goto out;
+
+	val.bpf_prog.fd = bpf_program__fd(prog);
+	err = bpf_obj_get_info_by_fd(val.bpf_prog.fd, &info, &len);
+	if (CHECK(err, "prog info", "err %d errno %d\n", err, errno))
+		goto out;
+
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	CHECK(err, "add cpumap entry with prog", "err %d errno %d\n",
+	      err, errno);
+
+	err = bpf_map_lookup_elem(map_fd, &idx, &val);
+	CHECK(err || info.id != val.bpf_prog.id, "read cpumap entry prog id",
+	      "err %d expected id %u got %u\n", err, info.id, val.bpf_prog.id);
+
+	/* Programs without the cpumap expected attach type are refused */
+	prog = bpf_object__find_program_by_title(obj, "xdp_dummy");
+	if (CHECK(!prog, "find xdp prog", "not found\n"))
+		goto out;
+
+	val.bpf_prog.fd = bpf_program__fd(prog);
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	CHECK(!err, "add cpumap entry with non-cpumap prog",
+	      "unexpected success\n");
+
+	/* Deleting the entry releases its program */
+	err = bpf_map_delete_elem(map_fd, &idx);
+	CHECK(err, "delete cpumap entry", "err %d errno %d\n", err, errno);
+out:
+	bpf_object__close(obj);
+}
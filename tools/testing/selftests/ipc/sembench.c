@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * SysV semaphore throughput benchmark.
+ *
+ * Runs one process per online CPU against a single semaphore set and
+ * reports semop() calls per second, first with single-sop operations and
+ * then with multi-sop operations on disjoint semaphores. Without per
+ * semaphore locking of multi-sop operations, the second case serializes
+ * on the array lock.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+
+#include "../kselftest.h"
+
+#define DEFAULT_SECONDS	5
+#define SEMS_PER_WORKER	2
+
+union semun {
+	int val;
+	struct semid_ds *buf;
+	unsigned short *array;
+};
+
+static volatile sig_atomic_t stop;
+
+static void sigalrm_handler(int sig)
+{
+	stop = 1;
+}
+
+static int worker(int semid, int id, int multi, unsigned long *count)
+{
+	unsigned short base = id * SEMS_PER_WORKER;
+	struct sembuf down[SEMS_PER_WORKER], up[SEMS_PER_WORKER];
+	int nsops = multi ? SEMS_PER_WORKER : 1;
+	unsigned long ops = 0;
+	int i;
+
+	for (i = 0; i < SEMS_PER_WORKER; i++) {
+		down[i].sem_num = base + i;
+		down[i].sem_op = -1;
+		down[i].sem_flg = 0;
+		up[i].sem_num = base + i;
+		up[i].sem_op = 1;
+		up[i].sem_flg = 0;
+	}
+
+	while (!stop) {
+		if (semop(semid, down, nsops) || semop(semid, up, nsops)) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ops += 2;
+	}
+	*count = ops;
+	return 0;
+}
+
+static int run(int nworkers, int seconds, int multi, double *rate)
+{
+	unsigned long *counts, total = 0;
+	unsigned short *vals;
+	union semun arg;
+	int semid, i, status, ret = 0;
+
+	semid = semget(IPC_PRIVATE, nworkers * SEMS_PER_WORKER, IPC_CREAT | 0600);
+	if (semid < 0)
+		return -1;
+
+	vals = calloc(nworkers * SEMS_PER_WORKER, sizeof(*vals));
+	counts = mmap(NULL, nworkers * sizeof(*counts), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (!vals || counts == MAP_FAILED) {
+		ret = -1;
+		goto out;
+	}
+	for (i = 0; i < nworkers * SEMS_PER_WORKER; i++)
+		vals[i] = 1;
+	arg.array = vals;
+	if (semctl(semid, 0, SETALL, arg)) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			ret = -1;
+			break;
+		}
+		if (!pid) {
+			signal(SIGALRM, sigalrm_handler);
+			alarm(seconds);
+			exit(worker(semid, i, multi, &counts[i]) ? 1 : 0);
+		}
+	}
+
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+
+	for (i = 0; i < nworkers; i++)
+		total += counts[i];
+	*rate = (double)total / seconds;
+out:
+	if (counts != MAP_FAILED)
+		munmap(counts, nworkers * sizeof(*counts));
+	free(vals);
+	semctl(semid, 0, IPC_RMID);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+	int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	double single, multi;
+
+	if (seconds <= 0 || nworkers <= 0)
+		return ksft_exit_fail();
+
+	if (run(nworkers, seconds, 0, &single)) {
+		if (errno == ENOSYS)
+			return ksft_exit_skip("SysV semaphores not supported\n");
+		printf("single-sop run failed: %s\n", strerror(errno));
+		return ksft_exit_fail();
+	}
+	if (run(nworkers, seconds, 1, &multi)) {
+		printf("multi-sop run failed: %s\n", strerror(errno));
+		return ksft_exit_fail();
+	}
+
+	printf("%d workers, %d s\n", nworkers, seconds);
+	printf("single-sop: %.0f semop/s\n", single);
+	printf("multi-sop:  %.0f semop/s\n", multi);
+
+	return ksft_exit_pass();
+}
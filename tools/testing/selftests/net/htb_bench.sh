@@ -0,0 +1,76 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# HTB throughput with one sender per CPU, each shaped by its own HTB leaf
+# class on a multi-queue veth, with and without the sch_htb htb_bypass
+# fast path. The class rates are far above what the senders reach, so the
+# leaves stay under their rate and the cost measured is the per packet
+# work done under the qdisc lock.
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+readonly PEER_NS="ns-peer-$(mktemp -u XXXXXX)"
+readonly NCPUS=$(nproc)
+readonly PARAM=/sys/module/sch_htb/parameters/htb_bypass
+readonly PORT_BASE=8000
+
+cleanup() {
+	local -r jobs="$(jobs -p)"
+
+	[ -n "${jobs}" ] && kill -INT ${jobs} 2>/dev/null
+	ip link del dev veth0 2>/dev/null
+	ip netns del "${PEER_NS}" 2>/dev/null
+	[ -n "${old_bypass}" ] && echo "${old_bypass}" > ${PARAM}
+}
+trap cleanup EXIT
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: need root privileges"
+	exit $ksft_skip
+fi
+if [ ! -x ./udpgso_bench_tx ]; then
+	echo "SKIP: udpgso_bench_tx not built"
+	exit $ksft_skip
+fi
+modprobe -q sch_htb
+if [ ! -w ${PARAM} ]; then
+	echo "SKIP: sch_htb without htb_bypass"
+	exit $ksft_skip
+fi
+old_bypass=$(cat ${PARAM})
+
+ip netns add "${PEER_NS}"
+ip link add veth0 numtxqueues ${NCPUS} type veth peer name veth1 \
+	numrxqueues ${NCPUS}
+ip link set dev veth1 netns "${PEER_NS}"
+ip addr add dev veth0 192.168.1.2/24
+ip -netns "${PEER_NS}" addr add dev veth1 192.168.1.1/24
+ip link set dev veth0 up
+ip -netns "${PEER_NS}" link set dev veth1 up
+
+tc qdisc add dev veth0 root handle 1: htb default 1
+tc class add dev veth0 parent 1: classid 1:1 htb rate 100gbit
+for ((i = 0; i < NCPUS; i++)); do
+	tc class add dev veth0 parent 1:1 classid 1:$((i + 10)) htb \
+		rate $((90 / NCPUS + 1))gbit ceil 100gbit
+	tc filter add dev veth0 parent 1: protocol ip u32 \
+		match ip dport $((PORT_BASE + i)) 0xffff flowid 1:$((i + 10))
+done
+
+run_one() {
+	local -r bypass=$1
+	local i
+
+	echo ${bypass} > ${PARAM}
+	echo "htb_bypass=${bypass}:"
+	for ((i = 0; i < NCPUS; i++)); do
+		./udpgso_bench_tx -4 -u -D 192.168.1.1 -p $((PORT_BASE + i)) \
+			-C ${i} -s 1400 -l 3 2>&1 | grep sum &
+	done
+	wait
+}
+
+run_one 0
+run_one 1
+tc -s class show dev veth0 classid 1:10
@@ -0,0 +1,109 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# cls_flower lookup cost with many masks in one filter priority.
+#
+# ns1 floods ping to ns2 over a veth pair. The ingress of ns2 holds
+# NUM_MASKS flower filters with distinct masks that don't match, followed by
+# the filter passing the echo requests, whose mask is thus the last one
+# tried in insertion order. The flood is timed with the cls_flower mask_sort
+# parameter off and on; the passing filter must account every packet in
+# both cases.
+#
+# Usage: tc_flower_mask_bench.sh [NUM_MASKS]
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NUM_MASKS=${1:-200}
+NUM_PKTS=20000
+PARAM=/sys/module/cls_flower/parameters/mask_sort
+sfx=$(mktemp -u "XXXXXXXX")
+ns1="ns1-$sfx"
+ns2="ns2-$sfx"
+batch=$(mktemp)
+ret=0
+
+cleanup()
+{
+	ip netns del $ns1 2>/dev/null
+	ip netns del $ns2 2>/dev/null
+	rm -f $batch
+	[ -n "$old_sort" ] && echo $old_sort > $PARAM
+}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+[ $(id -u) -eq 0 ] || skip "need root privileges"
+for tool in ip tc ping; do
+	command -v $tool > /dev/null || skip "could not run test without $tool"
+done
+modprobe -q cls_flower
+[ -w $PARAM ] || skip "cls_flower without mask_sort"
+old_sort=$(cat $PARAM)
+
+trap cleanup EXIT
+
+ip netns add $ns1 || skip "could not create netns"
+ip netns add $ns2
+ip link add veth1 netns $ns1 type veth peer name veth2 netns $ns2
+ip -net $ns1 addr add 192.0.2.1/24 dev veth1
+ip -net $ns2 addr add 192.0.2.2/24 dev veth2
+ip -net $ns1 link set veth1 up
+ip -net $ns2 link set veth2 up
+
+ip netns exec $ns2 tc qdisc add dev veth2 ingress
+
+# Each pair of source and destination prefix lengths is a distinct mask
+for ((i = 0; i < NUM_MASKS; i++)); do
+	echo "filter add dev veth2 ingress protocol ip pref 1 flower" \
+	     "src_ip 10.$((i % 256)).0.0/$((8 + i % 17))" \
+	     "dst_ip 10.$((i % 256)).0.0/$((16 + i / 17 % 17)) action drop"
+done > $batch
+echo "filter add dev veth2 ingress protocol ip pref 1 handle 0xffff" \
+     "flower src_ip 192.0.2.1 ip_proto icmp action pass" >> $batch
+ip netns exec $ns2 tc -b $batch || skip "could not load the flower filters"
+
+passed()
+{
+	ip netns exec $ns2 tc -s filter get dev veth2 ingress protocol ip \
+		pref 1 handle 0xffff flower |
+		awk '/Sent/ { print $4; exit }'
+}
+
+run()
+{
+	local sort=$1 start end elapsed before
+
+	echo $sort > $PARAM
+	before=$(passed)
+	# Let the masks be sorted before the timed run
+	ip netns exec $ns1 ping -q -c 10 -i 0.2 192.0.2.2 > /dev/null || ret=1
+	start=$(date +%s%N)
+	ip netns exec $ns1 ping -q -f -c $NUM_PKTS 192.0.2.2 > /dev/null || ret=1
+	end=$(date +%s%N)
+	elapsed=$(((end - start) / 1000000))
+
+	echo "mask_sort=$sort: $NUM_PKTS requests through $((NUM_MASKS + 1))" \
+	     "masks in $elapsed ms" \
+	     "($((NUM_PKTS * 1000 / (elapsed + 1))) req/s)"
+	if [ "$(passed)" -lt $((before + NUM_PKTS + 10)) ]; then
+		echo "FAIL: mask_sort=$sort: pass filter counted" \
+		     "$(($(passed) - before)) packets"
+		ret=1
+	fi
+}
+
+run 0
+run 1
+
+if [ $ret -ne 0 ]; then
+	echo "FAIL"
+	exit 1
+fi
+echo "PASS"
+exit 0
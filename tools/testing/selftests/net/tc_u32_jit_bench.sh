@@ -0,0 +1,140 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# cls_u32 with and without translation of the filters to eBPF.
+#
+# ns1 floods ping to ns2 from several addresses over a veth pair. The
+# ingress of ns2 holds a u32 tree: the root hashes the source address into
+# a 16 bucket table, each bucket holds NUM_RULES TCP port rules which
+# don't match, then an ICMP rule linking to a table which skips the IP
+# header and matches the echo requests. The flood is run with the cls_u32
+# jit parameter off and on; the per filter counters must be the same, and
+# the tree must have been translated in the second run.
+#
+# Larger NUM_RULES values may exceed the size a tree can be translated at.
+#
+# Usage: tc_u32_jit_bench.sh [NUM_RULES]
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NUM_RULES=${1:-16}
+NUM_BUCKETS=16
+NUM_PKTS=5000
+NUM_SRC=4
+PARAM=/sys/module/cls_u32/parameters/jit
+PROGS=/sys/module/cls_u32/parameters/jit_progs
+sfx=$(mktemp -u "XXXXXXXX")
+ns1="ns1-$sfx"
+ns2="ns2-$sfx"
+batch=$(mktemp)
+ret=0
+
+cleanup()
+{
+	ip netns del $ns1 2>/dev/null
+	ip netns del $ns2 2>/dev/null
+	rm -f $batch $batch.0 $batch.1
+	[ -n "$old_jit" ] && echo $old_jit > $PARAM
+}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+[ $(id -u) -eq 0 ] || skip "need root privileges"
+for tool in ip tc ping; do
+	command -v $tool > /dev/null || skip "could not run test without $tool"
+done
+modprobe -q cls_u32
+[ -w $PARAM ] && [ -r $PROGS ] || skip "cls_u32 without jit"
+old_jit=$(cat $PARAM)
+[ "$(sysctl -n net.core.bpf_jit_enable 2>/dev/null)" = "0" ] &&
+	skip "net.core.bpf_jit_enable is 0, filters are not translated"
+
+trap cleanup EXIT
+
+ip netns add $ns1 || skip "could not create netns"
+ip netns add $ns2
+ip link add veth1 netns $ns1 type veth peer name veth2 netns $ns2
+for ((i = 0; i < NUM_SRC; i++)); do
+	ip -net $ns1 addr add 192.0.2.$((2 * i + 1))/24 dev veth1
+done
+ip -net $ns2 addr add 192.0.2.2/24 dev veth2
+ip -net $ns1 link set veth1 up
+ip -net $ns2 link set veth2 up
+
+for ((i = 0; i < NUM_SRC; i++)); do
+	ip netns exec $ns1 ping -q -c 1 -W 1 -I 192.0.2.$((2 * i + 1)) \
+		192.0.2.2 > /dev/null || skip "no connectivity"
+done
+
+f="filter add dev veth2 parent ffff: protocol ip pref 1"
+(
+	echo "$f handle 2: u32 divisor 1"
+	echo "$f u32 ht 2: match u8 8 0xff at 0 action ok"
+	echo "$f handle 1: u32 divisor $NUM_BUCKETS"
+	for ((b = 0; b < NUM_BUCKETS; b++)); do
+		for ((k = 0; k < NUM_RULES; k++)); do
+			echo "$f u32 ht 1:$(printf %x $b): match ip src 192.0.2.$b" \
+			     "match ip protocol 6 0xff" \
+			     "match ip dport $((1000 + k)) 0xffff action drop"
+		done
+		echo "$f u32 ht 1:$(printf %x $b): match ip src 192.0.2.$b" \
+		     "match ip protocol 1 0xff link 2:" \
+		     "offset at 0 mask 0x0f00 shift 6 eat"
+	done
+	echo "$f u32 ht 800:: match ip dst 192.0.2.2/32" \
+	     "hashkey mask 0x$(printf %08x $((NUM_BUCKETS - 1))) at 12 link 1:"
+) > $batch
+
+run()
+{
+	local jit=$1 start end elapsed i
+
+	echo $jit > $PARAM
+	ip netns exec $ns2 tc qdisc del dev veth2 ingress 2>/dev/null
+	ip netns exec $ns2 tc qdisc add dev veth2 ingress
+	ip netns exec $ns2 tc -b $batch || skip "could not load the u32 filters"
+	# Filters are translated once they have not changed for a while
+	sleep 1
+	if [ $jit -eq 1 ] && [ "$(cat $PROGS)" -eq 0 ]; then
+		echo "FAIL: the u32 filters were not translated"
+		exit 1
+	fi
+
+	start=$(date +%s%N)
+	for ((i = 0; i < NUM_SRC; i++)); do
+		ip netns exec $ns1 ping -q -f -c $NUM_PKTS \
+			-I 192.0.2.$((2 * i + 1)) 192.0.2.2 > /dev/null &
+	done
+	wait
+	end=$(date +%s%N)
+	elapsed=$(((end - start) / 1000000))
+
+	echo "jit=$jit: $((NUM_SRC * NUM_PKTS)) requests in $elapsed ms" \
+	     "($((NUM_SRC * NUM_PKTS * 1000 / (elapsed + 1))) req/s)"
+	ip netns exec $ns2 tc -s filter show dev veth2 ingress |
+		grep -E "filter|Sent|rule hit" > $batch.$jit
+}
+
+run 0
+run 1
+
+if ! diff -u $batch.0 $batch.1; then
+	echo "FAIL: filter counters differ"
+	ret=1
+fi
+if ! grep -q "bytes $((NUM_SRC * NUM_PKTS)) pkt" $batch.1; then
+	echo "FAIL: echo requests not all matched"
+	ret=1
+fi
+
+if [ $ret -ne 0 ]; then
+	echo "FAIL"
+	exit 1
+fi
+echo "PASS"
+exit 0
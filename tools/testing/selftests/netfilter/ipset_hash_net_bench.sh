@@ -0,0 +1,107 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# hash:net lookup benchmark.
+#
+# Fills a hash:net set with NUM_NETS networks of every prefix length from
+# /8 to /32, checks a few lookups, then floods ping over a veth pair
+# between two network namespaces while RULES iptables rules in the
+# receiving namespace look up the source address of each packet in the set.
+# The source address is not covered by any network of the set, which is
+# the worst case when every prefix length of the set is tried in turn.
+#
+# Usage: ipset_hash_net_bench.sh [NUM_NETS [RULES]]
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NUM_NETS=${1:-10000}
+RULES=${2:-50}
+NUM_PKTS=20000
+sfx=$(mktemp -u "XXXXXXXX")
+ns1="ns1-$sfx"
+ns2="ns2-$sfx"
+SET=bench
+ret=0
+
+cleanup()
+{
+	ip netns del $ns1 2>/dev/null
+	ip netns del $ns2 2>/dev/null
+}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+[ $(id -u) -eq 0 ] || skip "need root privileges"
+for tool in ip ipset iptables; do
+	command -v $tool > /dev/null || skip "could not run test without $tool"
+done
+
+trap cleanup EXIT
+
+ip netns add $ns1 || skip "could not create netns"
+ip netns add $ns2
+ip link add veth1 netns $ns1 type veth peer name veth2 netns $ns2
+ip -net $ns1 addr add 192.0.2.1/24 dev veth1
+ip -net $ns2 addr add 192.0.2.2/24 dev veth2
+ip -net $ns1 link set veth1 up
+ip -net $ns2 link set veth2 up
+
+ip netns exec $ns2 ipset create $SET hash:net maxelem $((NUM_NETS * 2)) ||
+	skip "could not create hash:net set"
+
+# Networks within 10.0.0.0/8 with prefix lengths cycling from /8 to /32
+(
+	echo "add $SET 198.51.100.0/24"
+	echo "add $SET 198.51.100.128/25 nomatch"
+	for ((i = 0; i < NUM_NETS; i++)); do
+		cidr=$((8 + i % 25))
+		echo "add $SET 10.$((RANDOM % 256)).$((RANDOM % 256)).$((RANDOM % 256))/$cidr -exist"
+	done
+) | ip netns exec $ns2 ipset restore
+
+check()
+{
+	local addr=$1 expect=$2
+
+	if ip netns exec $ns2 ipset -q test $SET $addr; then
+		result=match
+	else
+		result=miss
+	fi
+	if [ $result != $expect ]; then
+		echo "FAIL: $addr: $result, expected $expect"
+		ret=1
+	fi
+}
+
+check 198.51.100.1 match
+check 198.51.100.200 miss
+check 203.0.113.1 miss
+check 192.0.2.1 miss
+
+for ((i = 0; i < RULES; i++)); do
+	ip netns exec $ns2 iptables -A INPUT -m set --match-set $SET src -j DROP
+done
+
+ip netns exec $ns1 ping -q -c 1 -W 1 192.0.2.2 > /dev/null || ret=1
+start=$(date +%s%N)
+ip netns exec $ns1 ping -q -f -c $NUM_PKTS 192.0.2.2 > /dev/null || ret=1
+end=$(date +%s%N)
+
+elapsed=$(((end - start) / 1000000))
+lookups=$((NUM_PKTS * RULES))
+echo "$(ip netns exec $ns2 ipset list -t $SET | grep -E 'entries|memory' | tr '\n' ' ')"
+echo "$lookups lookups in $elapsed ms" \
+     "($((lookups * 1000 / (elapsed + 1))) lookups/s)"
+
+if [ $ret -ne 0 ]; then
+	echo "FAIL"
+	exit 1
+fi
+echo "PASS"
+exit 0
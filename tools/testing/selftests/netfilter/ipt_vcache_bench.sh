@@ -0,0 +1,114 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# iptables verdict cache benchmark.
+#
+# ns1 floods ping to ns2 over a veth pair. The INPUT chain of ns2 holds
+# NUM_RULES address/port rules that don't match, followed by the rule
+# accepting the echo requests. The flood is timed twice: with a stateless
+# ruleset, whose verdicts ip_tables caches, and with the same ruleset plus
+# a comment match, which disables the cache for the hook. The counter of
+# the accepting rule must account every packet in both cases.
+#
+# The cache is off by default; the vcache module parameter of ip_tables is
+# turned on for the run and restored afterwards.
+#
+# Usage: ipt_vcache_bench.sh [NUM_RULES]
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NUM_RULES=${1:-10000}
+NUM_PKTS=20000
+sfx=$(mktemp -u "XXXXXXXX")
+ns1="ns1-$sfx"
+ns2="ns2-$sfx"
+ret=0
+vcache_param=/sys/module/ip_tables/parameters/vcache
+vcache_saved=
+
+cleanup()
+{
+	ip netns del $ns1 2>/dev/null
+	ip netns del $ns2 2>/dev/null
+	[ -n "$vcache_saved" ] && echo $vcache_saved > $vcache_param
+}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+[ $(id -u) -eq 0 ] || skip "need root privileges"
+for tool in ip iptables-restore iptables; do
+	command -v $tool > /dev/null || skip "could not run test without $tool"
+done
+
+trap cleanup EXIT
+
+ip netns add $ns1 || skip "could not create netns"
+modprobe -q ip_tables
+[ -w $vcache_param ] || skip "ip_tables has no vcache parameter"
+vcache_saved=$(cat $vcache_param)
+echo Y > $vcache_param
+ip netns add $ns2
+ip link add veth1 netns $ns1 type veth peer name veth2 netns $ns2
+ip -net $ns1 addr add 192.0.2.1/24 dev veth1
+ip -net $ns2 addr add 192.0.2.2/24 dev veth2
+ip -net $ns1 link set veth1 up
+ip -net $ns2 link set veth2 up
+
+load_rules()
+{
+	local extra=$1 i
+
+	(
+		echo "*filter"
+		echo ":INPUT DROP [0:0]"
+		for ((i = 0; i < NUM_RULES; i++)); do
+			echo "-A INPUT -s 10.$((i / 256 % 256)).$((i % 256)).0/24 -p tcp --dport $((1024 + i % 1000)) -j DROP"
+		done
+		[ -n "$extra" ] && echo "-A INPUT -s 203.0.113.0/24 $extra -j DROP"
+		echo "-A INPUT -s 192.0.2.1 -p icmp -j ACCEPT"
+		echo "COMMIT"
+	) | ip netns exec $ns2 iptables-restore
+}
+
+accepted()
+{
+	ip netns exec $ns2 iptables -L INPUT -v -x -n |
+		awk '$3 == "ACCEPT" && $4 == "icmp" { print $1 }'
+}
+
+run()
+{
+	local name=$1 start end elapsed
+
+	ip netns exec $ns1 ping -q -c 1 -W 1 192.0.2.2 > /dev/null || ret=1
+	start=$(date +%s%N)
+	ip netns exec $ns1 ping -q -f -c $NUM_PKTS 192.0.2.2 > /dev/null || ret=1
+	end=$(date +%s%N)
+	elapsed=$(((end - start) / 1000000))
+
+	echo "$name: $NUM_PKTS requests through $NUM_RULES rules in $elapsed ms" \
+	     "($((NUM_PKTS * 1000 / (elapsed + 1))) req/s)"
+	if [ "$(accepted)" -lt $((NUM_PKTS + 1)) ]; then
+		echo "FAIL: $name: accept rule counted $(accepted) packets"
+		ret=1
+	fi
+}
+
+load_rules "" || skip "could not load the ruleset"
+run "cached"
+
+load_rules "-m comment --comment uncached" ||
+	skip "could not load the ruleset with a comment match"
+run "uncached"
+
+if [ $ret -ne 0 ]; then
+	echo "FAIL"
+	exit 1
+fi
+echo "PASS"
+exit 0
@@ -0,0 +1,122 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# IPVS connection table benchmark.
+#
+# A client, a load balancer running IPVS in NAT mode and a real server
+# live in three network namespaces:
+#
+#   client (10.0.1.2) -- (10.0.1.1) lb (10.0.2.1) -- (10.0.2.2) server
+#
+# The client opens NUM_CONNS short TCP connections to the virtual service
+# 10.0.1.1:8080 from PARALLEL processes and the script reports the
+# connection rate, the number of IPVS connection entries left behind and
+# the connection hash table size before and after.
+#
+# Usage: ipvs_conn_bench.sh [NUM_CONNS [PARALLEL]]
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NUM_CONNS=${1:-2000}
+PARALLEL=${2:-4}
+sfx=$(mktemp -u "XXXXXXXX")
+ns_client="client-$sfx"
+ns_lb="lb-$sfx"
+ns_server="server-$sfx"
+VIP=10.0.1.1
+PORT=8080
+ret=0
+
+cleanup()
+{
+	[ -n "$server_pid" ] && kill $server_pid 2>/dev/null
+	ip netns del $ns_client 2>/dev/null
+	ip netns del $ns_lb 2>/dev/null
+	ip netns del $ns_server 2>/dev/null
+}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+[ $(id -u) -eq 0 ] || skip "need root privileges"
+for tool in ip ipvsadm socat; do
+	command -v $tool > /dev/null || skip "could not run test without $tool"
+done
+modprobe -q ip_vs || skip "could not load ip_vs"
+
+trap cleanup EXIT
+
+ip netns add $ns_client || skip "could not create netns"
+ip netns add $ns_lb
+ip netns add $ns_server
+
+ip link add veth_c netns $ns_client type veth peer name veth_lc netns $ns_lb
+ip link add veth_s netns $ns_server type veth peer name veth_ls netns $ns_lb
+
+ip -net $ns_client addr add 10.0.1.2/24 dev veth_c
+ip -net $ns_lb addr add $VIP/24 dev veth_lc
+ip -net $ns_lb addr add 10.0.2.1/24 dev veth_ls
+ip -net $ns_server addr add 10.0.2.2/24 dev veth_s
+for ns in $ns_client $ns_lb $ns_server; do
+	ip -net $ns link set lo up
+	ip -net $ns link set $(ip -net $ns -o link show type veth |
+			       awk -F'[:@]' '{print $2}') up
+done
+ip -net $ns_client route add default via $VIP
+ip -net $ns_server route add default via 10.0.2.1
+ip netns exec $ns_lb sysctl -qw net.ipv4.ip_forward=1
+
+ip netns exec $ns_lb ipvsadm -A -t $VIP:$PORT -s rr
+ip netns exec $ns_lb ipvsadm -a -t $VIP:$PORT -r 10.0.2.2:$PORT -m
+
+ip netns exec $ns_server socat TCP-LISTEN:$PORT,reuseaddr,fork EXEC:/bin/true &
+server_pid=$!
+sleep 1
+
+tab_size()
+{
+	ip netns exec $ns_lb head -1 /proc/net/ip_vs | sed 's/.*size=\([0-9]*\).*/\1/'
+}
+
+client()
+{
+	local i
+
+	for ((i = 0; i < $1; i++)); do
+		ip netns exec $ns_client socat -u OPEN:/dev/null \
+			TCP:$VIP:$PORT,connect-timeout=1 || return 1
+	done
+}
+
+size_before=$(tab_size)
+start=$(date +%s%N)
+pids=""
+for ((p = 0; p < PARALLEL; p++)); do
+	client $((NUM_CONNS / PARALLEL)) &
+	pids="$pids $!"
+done
+for pid in $pids; do
+	wait $pid || ret=1
+done
+end=$(date +%s%N)
+
+conns=$(ip netns exec $ns_lb sh -c 'tail -n +2 /proc/net/ip_vs_conn | wc -l')
+elapsed=$(((end - start) / 1000000))
+echo "$NUM_CONNS connections from $PARALLEL clients in $elapsed ms" \
+     "($((NUM_CONNS * 1000 / (elapsed + 1))) conn/s)"
+echo "IPVS entries: $conns, hash table size: $size_before -> $(tab_size)"
+
+if [ $ret -ne 0 ]; then
+	echo "FAIL: some connections through $VIP:$PORT failed"
+	exit 1
+fi
+if [ $conns -eq 0 ]; then
+	echo "FAIL: no IPVS connection entries"
+	exit 1
+fi
+echo "PASS"
+exit 0
@@ -0,0 +1,134 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Bridge flowtable throughput.
+#
+# ns1 and ns2 are linked by a bridge in nsbr, whose forward chain accepts
+# established connections. TCP throughput from ns1 to ns2 is measured with
+# iperf3 without and with a flowtable holding both bridge ports, then with
+# VLAN filtering on the bridge, ns1 sending on VLAN 10 and ns2 untagged.
+# With the flowtable, the flowtable hits must account for the transfer.
+#
+# Usage: nft_flowtable_bridge.sh [SECONDS]
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+DURATION=${1:-5}
+sfx=$(mktemp -u "XXXXXXXX")
+ns1="ns1-$sfx"
+ns2="ns2-$sfx"
+nsbr="nsbr-$sfx"
+ret=0
+
+cleanup()
+{
+	ip netns del $ns1 2>/dev/null
+	ip netns del $ns2 2>/dev/null
+	ip netns del $nsbr 2>/dev/null
+}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+[ $(id -u) -eq 0 ] || skip "need root privileges"
+for tool in ip nft iperf3 bridge; do
+	command -v $tool > /dev/null || skip "could not run test without $tool"
+done
+
+trap cleanup EXIT
+
+ip netns add $ns1 || skip "could not create netns"
+ip netns add $ns2
+ip netns add $nsbr
+ip link add veth0 netns $nsbr type veth peer name eth0 netns $ns1
+ip link add veth1 netns $nsbr type veth peer name eth0 netns $ns2
+ip -net $nsbr link add br0 type bridge
+ip -net $nsbr link set veth0 master br0
+ip -net $nsbr link set veth1 master br0
+for dev in veth0 veth1 br0; do
+	ip -net $nsbr link set $dev up
+done
+ip -net $ns1 link set eth0 up
+ip -net $ns2 link set eth0 up
+ip -net $ns1 addr add 10.0.1.1/24 dev eth0
+ip -net $ns2 addr add 10.0.1.2/24 dev eth0
+ip -net $ns1 link add link eth0 name eth0.10 type vlan id 10
+ip -net $ns1 link set eth0.10 up
+ip -net $ns1 addr add 10.0.10.1/24 dev eth0.10
+ip -net $ns2 addr add 10.0.10.2/24 dev eth0
+
+ip netns exec $nsbr nft -f - <<EOF || skip "could not load the bridge ruleset"
+table bridge filter {
+	chain forward {
+		type filter hook forward priority 0; policy accept;
+		ct state established,related accept
+	}
+}
+EOF
+
+ip netns exec $ns1 ping -q -c 1 -W 1 10.0.1.2 > /dev/null || skip "no connectivity"
+ip netns exec $ns2 iperf3 -s -D -1 > /dev/null 2>&1
+
+hits()
+{
+	ip netns exec $nsbr cat /proc/net/nf_flowtable_bridge 2>/dev/null |
+		awk '$2 == "f" { print $6; exit }'
+}
+
+run()
+{
+	local name=$1 dst=$2 before rate
+
+	before=$(hits)
+	sleep 0.2
+	rate=$(ip netns exec $ns1 iperf3 -c $dst -t $DURATION -f m 2>&1 |
+		awk '/receiver/ { print $7, $8 }')
+	ip netns exec $ns2 iperf3 -s -D -1 > /dev/null 2>&1
+	if [ -z "$rate" ]; then
+		echo "FAIL: $name: no transfer"
+		ret=1
+		return
+	fi
+	echo "$name: $rate"
+
+	[ -n "$before" ] || return
+	if [ "$(hits)" -le $((before + 1000)) ]; then
+		echo "FAIL: $name: flowtable hits $before -> $(hits)"
+		ret=1
+	fi
+}
+
+run "no flowtable" 10.0.1.2
+
+ip netns exec $nsbr nft -f - <<EOF || skip "could not add a bridge flowtable"
+table bridge filter {
+	flowtable f {
+		hook ingress priority 0
+		devices = { veth0, veth1 }
+	}
+}
+EOF
+ip netns exec $nsbr test -r /proc/net/nf_flowtable_bridge ||
+	skip "no bridge flowtable counters"
+
+run "flowtable" 10.0.1.2
+
+ip -net $nsbr link set br0 type bridge vlan_filtering 1
+ip netns exec $nsbr bridge vlan add dev veth0 vid 10
+ip netns exec $nsbr bridge vlan add dev veth1 vid 10 pvid untagged
+ip netns exec $ns1 ping -q -c 1 -W 1 10.0.10.2 > /dev/null || ret=1
+
+run "flowtable, vlan 10 to untagged" 10.0.10.2
+
+ip netns exec $nsbr cat /proc/net/nf_flowtable_bridge
+
+if [ $ret -ne 0 ]; then
+	echo "FAIL"
+	exit 1
+fi
+echo "PASS"
+exit 0